@@ -0,0 +1,14 @@
+movz x0, #0x10, lsl #16
+movz x1, #0
+movz x2, #3
+loop:
+  add x1, x1, x2
+  sub x3, x1, #7
+  eor x4, x3, x1
+  orr x5, x4, x2, lsl #3
+  adds x6, x5, x1
+  and x7, x6, x4, lsr #2
+  subs x0, x0, #1
+  b.ne loop
+
+and x0, x0, x0
@@ -0,0 +1,25 @@
+movz x1, #12345
+movz x2, #0x4c95
+movk x2, #0x5851, lsl #16
+movz x3, #0x3039
+movz x5, #0x1, lsl #16
+movz x6, #0x2, lsl #16
+movz x7, #0x8, lsl #16
+loop:
+  madd x1, x1, x2, x3
+  ands x4, x1, x5
+  b.eq skip1
+  add x10, x10, #1
+skip1:
+  ands x4, x1, x6
+  b.ne skip2
+  sub x11, x11, #1
+skip2:
+  cmp x1, x12
+  b.ge skip3
+  add x13, x13, #3
+skip3:
+  subs x7, x7, #1
+  b.ne loop
+
+and x0, x0, x0
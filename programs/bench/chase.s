@@ -0,0 +1,27 @@
+movz x2, #0x8, lsl #16
+movz x3, #0
+movz x4, #0x4000
+init:
+  add x5, x3, #37
+  cmp x5, x4
+  b.lt linked
+  sub x5, x5, x4
+linked:
+  add x6, x2, x5, lsl #6
+  add x7, x2, x3, lsl #6
+  str x6, [x7]
+  add x3, x3, #1
+  cmp x3, x4
+  b.ne init
+
+orr x1, xzr, x2
+movz x8, #0x10, lsl #16
+chase:
+  ldr x1, [x1]
+  ldr x1, [x1]
+  ldr x1, [x1]
+  ldr x1, [x1]
+  subs x8, x8, #1
+  b.ne chase
+
+and x0, x0, x0
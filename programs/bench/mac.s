@@ -0,0 +1,24 @@
+movz x2, #0x1, lsl #16
+movz x4, #0x1000
+init:
+  str x4, [x2], #8
+  subs x4, x4, #1
+  b.ne init
+
+movz x9, #512
+pass:
+  movz x2, #0x1, lsl #16
+  movz x4, #0x800
+dot:
+  ldr x5, [x2], #8
+  ldr x6, [x2], #8
+  madd x10, x5, x6, x10
+  msub x11, x5, x5, x11
+  mul x12, x5, x6
+  madd x13, x12, x4, x13
+  subs x4, x4, #1
+  b.ne dot
+  subs x9, x9, #1
+  b.ne pass
+
+and x0, x0, x0
@@ -0,0 +1,30 @@
+movz x2, #0x1, lsl #16
+movz x4, #0x1000
+init:
+  str w4, [x2], #4
+  subs x4, x4, #1
+  b.ne init
+
+movz x6, #3
+dup v7.4s, w6
+movz x9, #256
+pass:
+  movz x2, #0x1, lsl #16
+  movz x3, #0x2, lsl #16
+  movz x4, #0x100
+vector:
+  ld1 {v0.4s}, [x2], #16
+  ld1 {v1.4s}, [x2], #16
+  mul v2.4s, v0.4s, v7.4s
+  add v3.4s, v2.4s, v1.4s
+  eor v4.16b, v3.16b, v0.16b
+  add v5.4s, v5.4s, v4.4s
+  st1 {v3.4s}, [x3], #16
+  subs x4, x4, #1
+  b.ne vector
+  subs x9, x9, #1
+  b.ne pass
+
+addv s6, v5.4s
+umov w10, v6.s[0]
+and x0, x0, x0
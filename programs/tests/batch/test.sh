@@ -0,0 +1,15 @@
+#!/bin/sh
+# --batch: every .bin in a directory run on a pool of workers, each writing
+# its state next to the image. Reuses two of the top-level programs.
+. "$TESTS/lib.sh"
+
+mkdir "$WORK/jobs"
+for name in labels literals; do
+    ./assemble "$TESTS/$name.s" "$WORK/jobs/$name.bin" > /dev/null || exit 1
+done
+./emulate --batch "$WORK/jobs" -j 2 > "$WORK/batch.txt" || exit 1
+for name in labels literals; do
+    grep -q "^$WORK/jobs/$name.bin: halt " "$WORK/batch.txt" || exit 1
+    state "$WORK/jobs/$name.out" | diff -u "$TESTS/$name.expected" - || exit 1
+done
+grep -q "^2 guests, " "$WORK/batch.txt"
@@ -0,0 +1,36 @@
+movz x1, #0x2000
+movz x2, #0x11
+movz x3, #0x22
+stp x2, x3, [x1, #16]
+ldp x4, x5, [x1, #16]
+stp w3, w2, [x1, #-8]!
+ldp w6, w7, [x1], #8
+movz x8, #0x8081
+movk x8, #0xfffe, lsl #16
+str w8, [x1]
+ldrb w9, [x1]
+ldrb w10, [x1, #3]
+ldrh w11, [x1, #2]
+strb w2, [x1, #1]
+strh w3, [x1, #2]
+ldr w12, [x1]
+lsl x19, x8, #4
+lsr w20, w8, #16
+asr w21, w8, #16
+sbfx x22, x8, #0, #16
+ubfx x23, x8, #4, #8
+sbfiz x24, x9, #4, #8
+ubfiz x25, x9, #8, #8
+sxtb x26, w8
+sxth x27, w8
+sxtw x28, w8
+uxtb w29, w8
+uxth w30, w8
+cmp x4, x5
+csel x13, x4, x5, lt
+csinc x14, x4, x5, ge
+cset x15, lt
+cset x16, eq
+cinc x17, x4, lt
+csneg x18, x4, x5, gt
+and x0, x0, x0
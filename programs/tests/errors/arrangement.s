@@ -0,0 +1,2 @@
+add v0.3s, v1.4s, v2.4s
+and x8, x8, x8
@@ -0,0 +1,2 @@
+dmb bogus
+and x8, x8, x8
@@ -0,0 +1,4 @@
+movz x0, #1
+cmp x0, #1
+csel x1, x0, x0, zz
+and x8, x8, x8
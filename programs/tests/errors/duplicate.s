@@ -0,0 +1,5 @@
+top:
+movz x0, #1
+top:
+b top
+and x8, x8, x8
@@ -0,0 +1,2 @@
+b missing
+and x8, x8, x8
@@ -0,0 +1,3 @@
+movz x0, #1
+foo x0, x1
+and x8, x8, x8
@@ -0,0 +1,3 @@
+movz x0, #1
+add x1, x0, x32
+and x8, x8, x8
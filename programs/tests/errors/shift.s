@@ -0,0 +1,2 @@
+lsl x0, x1, x2
+and x8, x8, x8
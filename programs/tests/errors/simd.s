@@ -0,0 +1,2 @@
+bic v0.16b, v1.16b, v2.16b
+and x8, x8, x8
@@ -0,0 +1,2 @@
+mrs x0, tpidr_el0
+and x8, x8, x8
@@ -0,0 +1,7 @@
+ldrb w2, [x1]
+cmp w2, #0x46
+b.ne done
+movz x3, #0xffff, lsl #48
+ldr x4, [x3]
+done:
+and x0, x0, x0
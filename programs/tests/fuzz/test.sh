@@ -0,0 +1,15 @@
+#!/bin/sh
+# --fuzz: target.s faults when the first input byte is 'F'. Starting from a
+# seed of "B" and an empty file (which must be skipped), a fixed-seed run has
+# to find the fault and save exactly one crashing input for its PC.
+./assemble "$TESTS/fuzz/target.s" "$WORK/target.bin" > /dev/null || exit 1
+mkdir "$WORK/corpus"
+printf 'B' > "$WORK/corpus/seed"
+: > "$WORK/corpus/empty"
+./emulate "$WORK/target.bin" --fuzz "$WORK/corpus" --input-address 0x10000 --input-size 16 \
+    --crashes "$WORK/crashes" --iterations 3000 --seed 1 --limit 1000 2> "$WORK/log" || exit 1
+cat "$WORK/log"
+grep -q "corpus 1," "$WORK/log" || exit 1
+set -- "$WORK"/crashes/crash-00000010-*
+[ $# -eq 1 ] && [ -e "$1" ] || exit 1
+[ "$(head -c 1 "$1")" = F ]
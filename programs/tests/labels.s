@@ -0,0 +1,22 @@
+ldr x0, wait
+ldr w1, xdata
+movz x2, #0
+wloop:
+add x2, x2, #1
+cmp x2, #3
+b.ne wloop
+cmp x2, #3
+b.eq xskip
+movz x20, #0xbad
+xskip:
+b w2
+movz x21, #0xbad
+w2:
+b xend
+wait:
+.int 0x11
+.int 0x22
+xdata:
+.int 0x33
+xend:
+and x0, x0, x0
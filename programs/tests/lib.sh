@@ -0,0 +1,6 @@
+# Helpers shared by run.sh and the feature tests in tests/<feature>/test.sh
+
+# Prints the registers and flags of an emulator state file
+state() {
+    sed -e '/^PC/d' -e '/^Non-Zero Memory/,$d' "$1"
+}
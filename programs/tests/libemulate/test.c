@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include "libemulate.h"
+
+#define HALT 0x8A000000 // and x0, x0, x0
+
+static int failures = 0;
+
+static void expect(int ok, const char *what) {
+    if (!ok) {
+        printf("FAIL %s\n", what);
+        failures++;
+    }
+}
+
+int main(void) {
+    // movz x0, #1; movz x1, #2; movz x2, #3; HALT
+    const uint32_t image[] = { 0xD2800020, 0xD2800041, 0xD2800062, HALT };
+    const uint32_t halt[] = { HALT };
+    const uint64_t junk = 0x1122334455667788;
+
+    Emulator *emulator = emulator_create(1 << 20);
+    expect(emulator != NULL, "create");
+    if (!emulator) return 1;
+    expect(emulator_load_image(emulator, image, sizeof(image)), "load");
+    expect(emulator_write_memory(emulator, 0x1000, &junk, sizeof(junk)), "write memory");
+    expect(!emulator_write_memory(emulator, emulator_memory_size(emulator) - 4, &junk, sizeof(junk)), "write past the end");
+
+    expect(emulator_step(emulator, 0) == EMULATOR_LIMIT, "step 0 returns LIMIT");
+    expect(emulator_instructions(emulator) == 0, "step 0 executes nothing");
+    expect(emulator_step(emulator, 2) == EMULATOR_LIMIT, "step 2");
+    expect(emulator_instructions(emulator) == 2, "step 2 count");
+    expect(emulator_get_register(emulator, 1) == 2 && emulator_get_register(emulator, 2) == 0, "step 2 registers");
+
+    emulator_reset(emulator);
+    expect(emulator_run_until(emulator, 8, 0, 0) == EMULATOR_BREAK, "run to stop PC");
+    expect(emulator_get_pc(emulator) == 8 && emulator_get_register(emulator, 2) == 0, "stopped before the stop PC");
+    expect(emulator_run_until(emulator, 8, 0, 0) == EMULATOR_HALT, "run from the stop PC");
+    expect(emulator_get_register(emulator, 2) == 3, "ran to HALT");
+
+    emulator_reset(emulator);
+    expect(emulator_run_until(emulator, EMULATOR_NO_STOP_PC, 1, 0) == EMULATOR_LIMIT, "instruction limit");
+    expect(emulator_instructions(emulator) == 1, "limit count");
+
+    // Loading a shorter image clears the old code and data
+    expect(emulator_load_image(emulator, halt, sizeof(halt)), "reload");
+    uint32_t words[4];
+    uint64_t data;
+    expect(emulator_read_memory(emulator, 0, words, sizeof(words)), "read image");
+    expect(emulator_read_memory(emulator, 0x1000, &data, sizeof(data)), "read data");
+    expect(words[0] == HALT && words[1] == 0 && words[2] == 0 && words[3] == 0 && data == 0, "reload clears memory");
+    expect(emulator_get_register(emulator, 0) == 0 && emulator_instructions(emulator) == 0, "reload resets the CPU");
+    expect(emulator_run_until(emulator, EMULATOR_NO_STOP_PC, 0, 0) == EMULATOR_HALT, "run reloaded image");
+
+    emulator_destroy(emulator);
+    return failures ? 1 : 0;
+}
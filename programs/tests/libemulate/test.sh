@@ -0,0 +1,5 @@
+#!/bin/sh
+# libemulate: a small embedder built against libemulate.a exercising load,
+# step, run_until with a stop PC and a limit, and reloading a shorter image.
+${CC:-cc} -std=c17 -Wall -Werror -I. "$TESTS/libemulate/test.c" libemulate.a -lm -lpthread -o "$WORK/test" || exit 1
+"$WORK/test"
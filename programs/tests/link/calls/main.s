@@ -0,0 +1,17 @@
+.global back
+.global limit
+movz x0, #3
+cmp x0, #3
+b.eq setup
+movz x20, #0xbad
+and x0, x0, x0
+back:
+ldr w3, table
+movz x4, #0
+count:
+add x4, x4, #1
+cmp x4, x1
+b.ne count
+and x0, x0, x0
+limit:
+.int 0x5
@@ -0,0 +1,8 @@
+.global setup
+setup:
+ldr w1, limit
+add x2, x1, #1
+b back
+table:
+.int 0x600dcafe
+.globl table
@@ -0,0 +1,20 @@
+add x9, x9, #0
+ldr x0, =0x123456789abcdef0
+ldr w1, =0xdeadbeef
+ldr x2, =0x123456789abcdef0
+ldr x3, =0xffff0000
+ldr x4, =-2
+ldr x5, =target
+b after
+.ltorg
+after:
+mov x10, x10
+ldr x6, =0x123456789abcdef0
+ldr w7, =0x12345678
+ldr x8, =0xfedcba9876543210
+br x5
+movz x20, #0xbad
+and x0, x0, x0
+target:
+movz x5, #1
+and x0, x0, x0
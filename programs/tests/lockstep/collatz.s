@@ -0,0 +1,20 @@
+movz x1, #0x1000
+movz x2, #0
+loop:
+cmp x0, #1
+b.le done
+lsr x3, x0, #1
+lsl x3, x3, #1
+cmp x3, x0
+b.eq even
+add x0, x0, x0, lsl #1
+add x0, x0, #1
+b next
+even:
+lsr x0, x0, #1
+next:
+add x2, x2, #1
+b loop
+done:
+str x2, [x1]
+and x0, x0, x0
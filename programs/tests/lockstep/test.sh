@@ -0,0 +1,16 @@
+#!/bin/sh
+# Lockstep lanes against the scalar engine: collatz.s counts Collatz steps for
+# x0, so lanes branch apart on every step and halt at different times. Eleven
+# lines of registers need two groups of lanes. Each lane's state file must be
+# identical to the dump --serve gives for the same job.
+./assemble "$TESTS/lockstep/collatz.s" "$WORK/collatz.bin" > /dev/null || exit 1
+./emulate "$WORK/collatz.bin" "$WORK/lane" --sweep "$TESTS/lockstep/registers" --limit 100000 > /dev/null || exit 1
+sed "s|^|binary=$WORK/collatz.bin limit=100000 |" "$TESTS/lockstep/registers" | ./emulate --serve -j 1 > "$WORK/replies" || exit 1
+awk -v dir="$WORK" '/^result /{ file = dir "/scalar" $2 ".out"; next } { print > file }' "$WORK/replies"
+lanes=$(wc -l < "$TESTS/lockstep/registers")
+lane=0
+while [ $lane -lt $lanes ]; do
+    diff -u "$WORK/scalar$lane.out" "$WORK/lane$lane.out" || exit 1
+    lane=$((lane + 1))
+done
+grep -q "^X02 = 000000000000006f$" "$WORK/lane10.out" # 27 takes 111 steps
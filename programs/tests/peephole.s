@@ -0,0 +1,38 @@
+movz x0, #5
+subs x1, x0, #5
+adds x0, x0, #0
+b.eq skip
+movz x3, #7
+skip:
+add x4, x4, #0
+sub x4, x4, #0
+mov x5, x5
+movz x4, #0x44
+movz x6, #0x1234
+movk x6, #0x0, lsl #16
+movz x7, #0x1, lsl #16
+movk x7, #0x2345
+movz x8, #8
+eor x8, x8, x8
+movz x9, #3
+subs x10, x9, #3
+cmp x9, #3
+b.ne bad
+movz x11, #1
+ldr w12, data
+b over
+data:
+.int 0xcafef00d
+over:
+movz x13, #0xffff, lsl #48
+add w13, w13, #0
+movz x14, #3
+loop:
+add x15, x15, #0
+add x16, x16, #2
+subs x14, x14, #1
+b.ne loop
+and x0, x0, x0
+bad:
+movz x17, #0xbad
+and x0, x0, x0
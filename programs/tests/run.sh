@@ -0,0 +1,111 @@
+#!/bin/sh
+# Assembler and emulator regression tests, run from src/ by `make test`.
+# Every tests/<name>.s is assembled three ways (on one thread, on two threads
+# and with -O), run in the emulator, and its final registers and flags must
+# match tests/<name>.expected. The PC and memory are not compared, since -O
+# moves code.
+# Every tests/link/<name>/ holds modules that are assembled with -c (and with
+# -c -O), linked in name order and checked against tests/link/<name>.expected.
+# Every tests/errors/<name>.s holds one mistake, which must fail both the
+# assembler, without writing an image, and a direct `./emulate <name>.s`.
+# Every tests/<feature>/test.sh is run from src/ with TESTS set to this
+# directory and WORK to an empty directory of its own; it passes if it exits 0.
+
+TESTS=$(dirname "$0")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+failures=0
+
+. "$TESTS/lib.sh"
+
+# Runs an image and compares its final state with an expected file
+check() { # <name> <mode> <image> <expected>
+    if ! ./emulate "$3" "$WORK/state" > /dev/null 2>&1; then
+        echo "FAIL $1 ($2): emulate failed"
+        failures=$((failures + 1))
+    elif ! state "$WORK/state" | diff -u "$4" - > "$WORK/diff"; then
+        echo "FAIL $1 ($2):"
+        cat "$WORK/diff"
+        failures=$((failures + 1))
+    else
+        echo "ok   $1 ($2)"
+    fi
+}
+
+for source in "$TESTS"/*.s; do
+    name=$(basename "$source" .s)
+    for mode in "-j 1" "-j 2" "-O"; do
+        if ./assemble $mode "$source" "$WORK/image.bin" > /dev/null 2> "$WORK/errors"; then
+            check "$name" "$mode" "$WORK/image.bin" "$TESTS/$name.expected"
+        else
+            echo "FAIL $name ($mode): assemble failed"
+            cat "$WORK/errors"
+            failures=$((failures + 1))
+        fi
+    done
+done
+
+for directory in "$TESTS"/link/*/; do
+    name=link/$(basename "$directory")
+    for mode in "-c" "-c -O"; do
+        objects=""
+        for source in "$directory"*.s; do
+            object="$WORK/$(basename "$source" .s).o"
+            if ! ./assemble $mode "$source" "$object" > /dev/null 2> "$WORK/errors"; then
+                cat "$WORK/errors"
+                objects=""
+                break
+            fi
+            objects="$objects $object"
+        done
+        if [ -z "$objects" ]; then
+            echo "FAIL $name ($mode): assemble failed"
+            failures=$((failures + 1))
+        elif ! ./link $objects "$WORK/image.bin" > /dev/null 2> "$WORK/errors"; then
+            echo "FAIL $name ($mode): link failed"
+            cat "$WORK/errors"
+            failures=$((failures + 1))
+        else
+            check "$name" "$mode" "$WORK/image.bin" "$TESTS/$name.expected"
+        fi
+        rm -f "$WORK"/*.o
+    done
+done
+
+for source in "$TESTS"/errors/*.s; do
+    name=errors/$(basename "$source" .s)
+    for mode in "-j 1" "-j 2"; do
+        rm -f "$WORK/image.bin"
+        if ./assemble $mode "$source" "$WORK/image.bin" > /dev/null 2>&1 || [ -e "$WORK/image.bin" ]; then
+            echo "FAIL $name ($mode): assembled"
+            failures=$((failures + 1))
+        else
+            echo "ok   $name ($mode)"
+        fi
+    done
+    if ./emulate "$source" "$WORK/state" > /dev/null 2>&1; then
+        echo "FAIL $name (emulate): ran"
+        failures=$((failures + 1))
+    else
+        echo "ok   $name (emulate)"
+    fi
+done
+
+for script in "$TESTS"/*/test.sh; do
+    [ -e "$script" ] || continue
+    name=$(basename "$(dirname "$script")")
+    mkdir "$WORK/$name"
+    if TESTS="$TESTS" WORK="$WORK/$name" sh "$script" > "$WORK/$name.log" 2>&1; then
+        echo "ok   $name"
+    else
+        echo "FAIL $name:"
+        cat "$WORK/$name.log"
+        failures=$((failures + 1))
+    fi
+done
+
+if [ $failures -ne 0 ]; then
+    echo "$failures failed"
+    exit 1
+fi
+echo "All tests passed"
@@ -0,0 +1,10 @@
+#!/bin/sh
+# --serve: job lines on stdin answered by a pool of two instances. The image is
+# "add x0, x3, #5; and x0, x0, x0", so X0 shows each job got its own x3 on a
+# cleanly reset instance. Replies arrive in finishing order, so they are keyed
+# by job number before comparing.
+image=image=91001460,8a000000
+printf '%s x3=7\n%s x3=30 limit=1\n%s x3=0x100\nbinary=/nonexistent\nx99=1 %s\n' \
+    $image $image $image $image | ./emulate --serve -j 2 > "$WORK/replies" 2> /dev/null || exit 1
+awk '/^result /{ job = $2; print "result", $2, $3, $4 } /^error /{ print }
+     /^X0[03] /{ print job, $1, $3 }' "$WORK/replies" | LC_ALL=C sort | diff -u "$TESTS/serve/replies.expected" -
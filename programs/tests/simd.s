@@ -0,0 +1,40 @@
+movz x1, #0x1000
+movz w3, #1
+str w3, [x1]
+movz w3, #2
+str w3, [x1, #4]
+movz w3, #3
+str w3, [x1, #8]
+movz w3, #4
+str w3, [x1, #12]
+ld1 {v0.4s}, [x1]
+movz x4, #10
+dup v1.4s, w4
+add v2.4s, v0.4s, v1.4s
+mul v3.4s, v2.4s, v0.4s
+sub v4.4s, v3.4s, v1.4s
+addv s5, v3.4s
+umov w5, v5.s[0]
+umov w6, v4.s[3]
+and v6.16b, v3.16b, v2.16b
+orr v7.16b, v0.16b, v1.16b
+eor v8.16b, v2.16b, v1.16b
+umov w7, v6.s[1]
+umov w8, v7.s[3]
+umov w9, v8.s[2]
+st1 {v3.4s}, [x1], #16
+movz x10, #0x1000
+ld1 {v9.4s}, [x10]
+umov w10, v9.s[3]
+dup v10.16b, w4
+addv b11, v10.16b
+umov w11, v11.b[0]
+dup v12.8h, w3
+add v12.8h, v12.8h, v12.8h
+addv h13, v12.8h
+umov w12, v13.h[0]
+umov x13, v2.d[1]
+add v14.2s, v0.2s, v0.2s
+umov w14, v14.s[1]
+umov x15, v14.d[1]
+and x0, x0, x0
@@ -0,0 +1,7 @@
+#!/bin/sh
+# --smp: two cores add 1000 each to a shared counter with LDAXR/STLXR, then
+# each stores its count to a slot chosen by its MPIDR_EL1 core number. The
+# registers depend on the interleaving, so only memory is compared.
+./assemble "$TESTS/smp/counter.s" "$WORK/counter.bin" > /dev/null || exit 1
+./emulate "$WORK/counter.bin" "$WORK/state" --smp 2 --limit 1000000 || exit 1
+sed -n '/^0x00001/p' "$WORK/state" | diff -u "$TESTS/smp/memory.expected" -
@@ -0,0 +1,6 @@
+movz x0, #2
+movz x1, #0x1000
+movz x2, #0x1234
+str w2, [x1]
+str w0, [x1, #8]
+and x0, x0, x0
@@ -0,0 +1,15 @@
+#!/bin/sh
+# statediff: equal snapshots exit 0 silently, differing ones exit 1 and list
+# each register and run of memory words that differ, anything else exits 2.
+# b.s differs from a.s in X0 and in the word it stores at 0x1008.
+for name in a b; do
+    ./assemble "$TESTS/statediff/$name.s" "$WORK/$name.bin" > /dev/null || exit 1
+    ./emulate "$WORK/$name.bin" "$WORK/$name.out" --state "$WORK/$name.snap" > /dev/null || exit 1
+done
+./statediff "$WORK/a.snap" "$WORK/a.snap" > "$WORK/same" || exit 1
+[ ! -s "$WORK/same" ] || exit 1
+./statediff "$WORK/a.snap" "$WORK/b.snap" > "$WORK/differ"
+[ $? -eq 1 ] || exit 1
+diff -u "$TESTS/statediff/differ.expected" "$WORK/differ" || exit 1
+./statediff "$WORK/a.snap" "$WORK/a.out" > /dev/null 2>&1
+[ $? -eq 2 ]
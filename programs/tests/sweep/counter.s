@@ -0,0 +1,13 @@
+movz x3, #0x1000
+movz x5, #0
+loop:
+ldxr x2, [x3]
+add x2, x2, #1
+stxr w4, x2, [x3]
+cmp x4, #0
+b.ne loop
+add x5, x5, #1
+cmp x5, x1
+b.ne loop
+ldr x6, [x3]
+and x0, x0, x0
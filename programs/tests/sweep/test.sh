@@ -0,0 +1,11 @@
+#!/bin/sh
+# --sweep: one image run in lockstep lanes, one lane per line of registers.
+# counter.s counts x1 times with an LDXR/STXR retry loop, so every lane takes
+# the scalar fallback for the exclusives and must keep its reservation.
+. "$TESTS/lib.sh"
+
+./assemble "$TESTS/sweep/counter.s" "$WORK/counter.bin" > /dev/null || exit 1
+./emulate "$WORK/counter.bin" "$WORK/lane" --sweep "$TESTS/sweep/registers" --limit 100000 > "$WORK/sweep.txt" || exit 1
+for lane in 0 1 2; do
+    state "$WORK/lane$lane.out" | diff -u "$TESTS/sweep/lane$lane.expected" - || exit 1
+done
@@ -1,78 +1,650 @@
+#include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "libassemble.h"
 #include "assemble.h"
 
-Label symbolTable[MAX_LABELS];
-int labelCount = 0;
+_Thread_local FILE *trace = NULL;       // Trace output of the calling thread, NULL for none
+_Thread_local FILE *diagnostics = NULL; // Errors and warnings of the calling thread
+_Thread_local int errorCount = 0;
+_Thread_local Reference *currentReference = NULL; // Set in watch mode to record the label an instruction references
 
-Instruction instructions[MAX_LABELS];
-int instructionCount = 0;
+SymbolTable symbolTable;
+Arena labelArena; // Label names and their pending fixups, freed together
 
-// Function to add label to the symbol table
+int labelsComplete = 0; // Set while every label is defined, so references never need fixups
+int relocatable = 0;    // Set while assembling an object: undefined labels are left to the linker
+int optimize = 0;       // Run the peephole pass on every image (-O)
+
+unsigned char *dataWords = NULL; // Set for the image words written by .int, tracked only with -O
+int dataCapacity = 0;
+
+int *image = NULL; // Encoded instructions, patched in place by fixups
+int imageCount = 0;
+int imageCapacity = 0;
+
+Literal *literals = NULL; // Entries of the pending literal pool, deduplicated by their pool label
+int literalCount = 0;
+int literalCapacity = 0;
+int poolNumber = 0; // Pools written so far, part of the pool label names
+int poolStart = 0;  // Image index of the first load from the pending pool
+int poolWords = 0;  // Words the pending pool takes at most, with alignment
+
+// Function to allocate from an arena, starting a new block when the current one is full
+void *arenaAlloc(Arena *arena, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    if (arena->block == NULL || arena->used + size > arena->block->size) {
+        size_t blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        ArenaBlock *block = malloc(sizeof(ArenaBlock) + blockSize);
+        if (block == NULL) {
+            perror("Error allocating arena");
+            exit(EXIT_FAILURE);
+        }
+        block->next = arena->block;
+        block->size = blockSize;
+        arena->block = block;
+        arena->used = 0;
+    }
+    void *memory = arena->block->data + arena->used;
+    arena->used += size;
+    return memory;
+}
+
+// Function to copy a string into an arena
+char *arenaStrdup(Arena *arena, const char *string) {
+    size_t length = strlen(string) + 1;
+    return memcpy(arenaAlloc(arena, length), string, length);
+}
+
+// Function to free every block of an arena
+void arenaFree(Arena *arena) {
+    while (arena->block != NULL) {
+        ArenaBlock *next = arena->block->next;
+        free(arena->block);
+        arena->block = next;
+    }
+    arena->used = 0;
+}
+
+// FNV-1a hash of a label name
+unsigned int hashLabel(const char *label) {
+    unsigned int hash = 2166136261u;
+    for (; *label != '\0'; label++) {
+        hash = (hash ^ (unsigned char)*label) * 16777619u;
+    }
+    return hash;
+}
+
+// Function to find the slot holding label, or the empty slot where it belongs
+Label *findSlot(SymbolTable *table, const char *label, unsigned int hash) {
+    size_t mask = table->capacity - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        Label *slot = &table->entries[i];
+        if (slot->label == NULL || (slot->hash == hash && strcmp(slot->label, label) == 0)) {
+            return slot;
+        }
+    }
+}
+
+// Function to double the capacity of the symbol table and rehash every label
+void growSymbolTable(SymbolTable *table) {
+    size_t capacity = table->capacity ? table->capacity * 2 : 256;
+    SymbolTable grown = { calloc(capacity, sizeof(Label)), capacity, table->count };
+    if (grown.entries == NULL) {
+        perror("Error allocating symbol table");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->entries[i].label != NULL) {
+            *findSlot(&grown, table->entries[i].label, table->entries[i].hash) = table->entries[i];
+        }
+    }
+    free(table->entries);
+    *table = grown;
+}
+
+// Function to find a label, inserting it undefined if it is not in the table yet
+Label *internLabel(const char *label) {
+    if ((symbolTable.count + 1) * 10 > symbolTable.capacity * 7) { // Keep the load factor below 0.7
+        growSymbolTable(&symbolTable);
+    }
+    unsigned int hash = hashLabel(label);
+    Label *slot = findSlot(&symbolTable, label, hash);
+    if (slot->label == NULL) {
+        slot->label = arenaStrdup(&labelArena, label);
+        slot->hash = hash;
+        slot->address = -1;
+        slot->defined = 0;
+        slot->fixups = NULL;
+        slot->definitions = 0;
+        slot->global = 0;
+        symbolTable.count++;
+    }
+    return slot;
+}
+
+// Function to add label to the symbol table and patch the references waiting for it,
+// a second definition of a name is an error
 void addLabel(char *label, int address) {
-    strcpy(symbolTable[labelCount].label, label);
-    symbolTable[labelCount].address = address;
-    labelCount++;
+    Label *slot = internLabel(label);
+    if (slot->defined) {
+        reportError("Duplicate label: %s\n", label);
+        return;
+    }
+    slot->address = address;
+    slot->defined = 1;
+    for (Fixup *fixup = slot->fixups; fixup != NULL; fixup = fixup->next) {
+        patchOffset(fixup->index, address, fixup->kind, label);
+    }
+    slot->fixups = NULL;
+}
+
+// Function to check for a .global (or .globl) directive, which exports a label
+// from an object and encodes no word
+int isGlobalDirective(const char *token, int length) {
+    return (length == 7 && memcmp(token, ".global", 7) == 0) || (length == 6 && memcmp(token, ".globl", 6) == 0);
+}
+
+// Function to export a label, which may be defined before or after the directive
+void markGlobal(const char *label) {
+    internLabel(label)->global = 1;
+}
+
+// Function to look up a label, returns 1 and sets address if it is defined
+int findLabel(const char *label, int *address) {
+    if (symbolTable.count == 0 || label == NULL) {
+        return 0;
+    }
+    Label *slot = findSlot(&symbolTable, label, hashLabel(label));
+    if (slot->label == NULL || !slot->defined) {
+        return 0; // Label does not exist yet
+    }
+    TRACE("Found label: %s at address: %d\n", label, slot->address);
+    *address = slot->address;
+    return 1;
+}
+
+// Function to check whether an operand names a label rather than a number or register
+int isLabelOperand(const char *operand) {
+    return operand != NULL && (isalpha((unsigned char)operand[0]) || operand[0] == '_' || operand[0] == '.');
+}
+
+// Function to report an error in the source: the assembly fails, but carries on
+// to report the errors after it too
+void reportError(const char *format, ...) {
+    errorCount++;
+    if (diagnostics != NULL) {
+        va_list arguments;
+        va_start(arguments, format);
+        vfprintf(diagnostics, format, arguments);
+        va_end(arguments);
+    }
+}
+
+// Function to check that a word offset fits the field of a fixup kind, returns 0 if not
+int checkOffsetRange(int offset, FixupKind kind, const char *label) {
+    int bits = kind == FIXUP_IMM26 ? 26 : 19;
+    if (offset < -(1 << (bits - 1)) || offset >= (1 << (bits - 1))) {
+        reportError("Label %s out of range for a %d-bit offset (%d words)\n", label, bits, offset);
+        return 0;
+    }
+    return 1;
+}
+
+// Function to write the offset to target into the instruction at index in the image,
+// or the target address itself into a literal pool word
+void patchOffset(int index, int target, FixupKind kind, const char *label) {
+    if (kind == FIXUP_ADDRESS) {
+        image[index] = target;
+        TRACE("Patched address: %s at address: %d\n", label, index * 4);
+        return;
+    }
+    int offset = (target - index * 4) / 4;
+    if (!checkOffsetRange(offset, kind, label)) {
+        return;
+    }
+    if (kind == FIXUP_IMM26) {
+        image[index] = (image[index] & ~0x3FFFFFF) | (offset & 0x3FFFFFF);
+    } else {
+        image[index] = (image[index] & ~(0x7FFFF << 5)) | ((offset & 0x7FFFF) << 5);
+    }
+    TRACE("Patched fixup: %s at address: %d (offset: %d)\n", label, index * 4, offset);
+}
+
+// Function to make the word at index wait for a label to be defined
+void addFixup(Label *slot, int index, FixupKind kind) {
+    Fixup *fixup = arenaAlloc(&labelArena, sizeof(Fixup));
+    *fixup = (Fixup){ index, kind, slot->fixups };
+    slot->fixups = fixup;
+}
+
+// Function to resolve a label operand of the instruction at lineNo to a word offset.
+// A label that is not defined yet gets a fixup and offset 0 until it is.
+int labelOffset(char *label, int lineNo, FixupKind kind) {
+    int address;
+    if (currentReference != NULL) { // Resolved once the whole watch update is done
+        Label *slot = internLabel(label);
+        *currentReference = (Reference){ slot->label, slot->hash, kind, 0 };
+        return 0;
+    }
+    if (findLabel(label, &address)) {
+        int offset = (address - lineNo * 4) / 4;
+        return checkOffsetRange(offset, kind, label) ? offset : 0;
+    }
+    if (labelsComplete) { // The symbol table is shared read-only by the encoding threads
+        reportError("Undefined label: %s\n", label);
+        return 0;
+    }
+    addFixup(internLabel(label), lineNo, kind);
+    TRACE("Forward reference: %s at address: %d\n", label, lineNo * 4);
+    return 0;
+}
+
+// Function to report every label that is still referenced but was never defined
+int checkUndefinedLabels(void) {
+    int undefined = 0;
+    for (size_t i = 0; i < symbolTable.capacity; i++) {
+        Label *slot = &symbolTable.entries[i];
+        if (slot->label != NULL && !slot->defined && slot->fixups != NULL) {
+            reportError("Undefined label: %s\n", slot->label);
+            undefined++;
+        }
+    }
+    return undefined;
+}
+
+// Function to free the symbol table, the label names and their fixups
+void freeSymbolTable(void) {
+    free(symbolTable.entries);
+    symbolTable = (SymbolTable){ NULL, 0, 0 };
+    arenaFree(&labelArena);
+}
+
+// Function to classify 16 source bytes: bit i of *delimiters is set when p[i]
+// ends a token (a comma, blank or other control character), bit i of *lineEnds
+// when it ends the line (newline or NUL)
+void classifyBytes(const char *p, unsigned int *delimiters, unsigned int *lineEnds) {
+#if defined(__SSE2__)
+    __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+    __m128i blanks = _mm_cmpeq_epi8(_mm_min_epu8(bytes, _mm_set1_epi8(' ')), bytes); // bytes <= ' '
+    __m128i ends = _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(bytes, _mm_setzero_si128()));
+    *delimiters = _mm_movemask_epi8(_mm_or_si128(blanks, _mm_cmpeq_epi8(bytes, _mm_set1_epi8(','))));
+    *lineEnds = _mm_movemask_epi8(ends);
+#else
+    *delimiters = 0;
+    *lineEnds = 0;
+    for (int i = 0; i < 16; i++) {
+        if ((unsigned char)p[i] <= ' ' || p[i] == ',') {
+            *delimiters |= 1u << i;
+        }
+        if (p[i] == '\n' || p[i] == '\0') {
+            *lineEnds |= 1u << i;
+        }
+    }
+#endif
+}
+
+// Function to read a whole stream into a buffer followed by LEXER_PADDING zero bytes
+int readSource(int fd, Source *source) {
+    size_t capacity = 65536;
+    size_t size = 0;
+    char *data = malloc(capacity + LEXER_PADDING);
+    while (data != NULL) {
+        ssize_t n = read(fd, data + size, capacity - size);
+        if (n < 0) {
+            free(data);
+            return 0;
+        }
+        if (n == 0) {
+            break;
+        }
+        size += n;
+        if (size == capacity) {
+            capacity *= 2;
+            char *grown = realloc(data, capacity + LEXER_PADDING);
+            if (grown == NULL) {
+                free(data);
+            }
+            data = grown;
+        }
+    }
+    if (data == NULL) {
+        return 0;
+    }
+    memset(data + size, 0, LEXER_PADDING);
+    *source = (Source){ data, size, 0, 0, NULL, 0, 0 };
+    return 1;
+}
+
+// Function to open a source file ("-" for stdin) for the lexer. Regular files are
+// mapped privately over a zeroed reservation, so the lexer can terminate tokens in
+// place and read past the end without copying the file.
+int openSource(const char *fileName, Source *source) {
+    if (strcmp(fileName, "-") == 0) {
+        return readSource(STDIN_FILENO, source);
+    }
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) { // Pipes and devices are read instead
+        int ok = readSource(fd, source);
+        close(fd);
+        return ok;
+    }
+    size_t size = info.st_size;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t mappedSize = (size + LEXER_PADDING + page - 1) / page * page;
+    char *data = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data != MAP_FAILED && size > 0
+        && mmap(data, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(data, mappedSize);
+        data = MAP_FAILED;
+    }
+    close(fd);
+    if (data == MAP_FAILED) {
+        return 0;
+    }
+    madvise(data, mappedSize, MADV_SEQUENTIAL);
+    *source = (Source){ data, size, mappedSize, 0, NULL, 0, 0 };
+    return 1;
+}
+
+void closeSource(Source *source) {
+    if (source->mappedSize != 0) {
+        munmap(source->data, source->mappedSize);
+    } else {
+        free(source->data);
+    }
+    source->data = NULL;
+}
+
+// Function to classify the LEXER_WINDOW bytes at p into the window bit masks
+void classifyWindow(Source *source, char *p) {
+    source->window = p;
+    source->delimiters = 0;
+    source->lineEnds = 0;
+    for (int i = 0; i < LEXER_WINDOW; i += 16) {
+        unsigned int delimiters, lineEnds;
+        classifyBytes(p + i, &delimiters, &lineEnds);
+        source->delimiters |= (uint64_t)delimiters << i;
+        source->lineEnds |= (uint64_t)lineEnds << i;
+    }
+}
+
+// Function to find the first byte at or after p that ends a token (delimiter set)
+// or that starts a token or ends the line (delimiter clear)
+char *scanSource(Source *source, char *p, int delimiter) {
+    for (;;) {
+        if (p < source->window || p >= source->window + LEXER_WINDOW) {
+            classifyWindow(source, p);
+        }
+        uint64_t stops = delimiter ? source->delimiters : ~source->delimiters | source->lineEnds;
+        stops &= ~0ULL << (p - source->window);
+        if (stops != 0) {
+            return source->window + __builtin_ctzll(stops);
+        }
+        p = source->window + LEXER_WINDOW;
+    }
 }
 
-int labelExists(const char *label) {
-    for (int i = 0; i < labelCount; i++) {
-        if (strcmp(symbolTable[i].label, label) == 0) {
-            return 1; // Label exists
+// Function to lex the next line into at most maxTokens tokens, returns the number
+// of tokens or -1 at the end of the input. Tokens are split at blanks and commas
+// and are NUL-terminated in place; tokens past maxTokens are dropped.
+int nextLine(Source *source, Token *tokens, int maxTokens) {
+    char *p = source->data + source->cursor;
+    char *end = source->data + source->size;
+    if (p >= end) {
+        return -1;
+    }
+    int count = 0;
+    for (;;) {
+        p = scanSource(source, p, 0); // Skip blanks
+        if (*p == '\n' || *p == '\0') {
+            break;
+        }
+        char *start = p;
+        p = scanSource(source, p, 1);
+        if (count < maxTokens) {
+            tokens[count++] = (Token){ start, p - start };
+        } else {
+            if (diagnostics != NULL) {
+                fprintf(diagnostics, "Too many operands, ignoring: %.*s\n", (int)(p - start), start);
+            }
+        }
+        if (*p == '\n' || *p == '\0') {
+            break;
         }
+        *p++ = '\0';
     }
-    return 0; // Label does not exist
+    // p is at the newline or NUL that ends the line
+    *p = '\0';
+    source->cursor = (p < end ? p + 1 : end) - source->data;
+    return count;
 }
 
-// Function to get the address of a label
-int getLabelAddress(char *label) {
-    for (int i = 0; i < labelCount; i++) {
-        if (strcmp(symbolTable[i].label, label) == 0) {
-            printf("Found label: %s at address: %d\n", label, symbolTable[i].address);
-            return symbolTable[i].address;
+// Mnemonic descriptors, found through a perfect hash of the mnemonic text
+static const Mnemonic mnemonics[] = {
+    { "add", ENC_ARITHMETIC, 0b00, 0, 0, 0x0E208400 },
+    { "adds", ENC_ARITHMETIC, 0b01, 0, 0 },
+    { "sub", ENC_ARITHMETIC, 0b10, 0, 0, 0x2E208400 },
+    { "subs", ENC_ARITHMETIC, 0b11, 0, 0 },
+    { "cmn", ENC_ARITHMETIC, 0b01, 0, MNEMONIC_ZR_RD },
+    { "cmp", ENC_ARITHMETIC, 0b11, 0, MNEMONIC_ZR_RD },
+    { "neg", ENC_ARITHMETIC, 0b10, 0, MNEMONIC_ZR_RN },
+    { "negs", ENC_ARITHMETIC, 0b11, 0, MNEMONIC_ZR_RN },
+    { "and", ENC_LOGICAL, 0b00, 0, 0, 0x0E201C00 },
+    { "bic", ENC_LOGICAL, 0b00, 1, 0 },
+    { "orr", ENC_LOGICAL, 0b01, 0, 0, 0x0EA01C00 },
+    { "orn", ENC_LOGICAL, 0b01, 1, 0 },
+    { "eor", ENC_LOGICAL, 0b10, 0, 0, 0x2E201C00 },
+    { "eon", ENC_LOGICAL, 0b10, 1, 0 },
+    { "ands", ENC_LOGICAL, 0b11, 0, 0 },
+    { "bics", ENC_LOGICAL, 0b11, 1, 0 },
+    { "tst", ENC_LOGICAL, 0b11, 0, MNEMONIC_ZR_RD },
+    { "mov", ENC_LOGICAL, 0b01, 0, MNEMONIC_ZR_RN },
+    { "mvn", ENC_LOGICAL, 0b01, 1, MNEMONIC_ZR_RN },
+    { "madd", ENC_MULTIPLY, 0, 0, 0 },
+    { "msub", ENC_MULTIPLY, 1, 0, 0 },
+    { "mul", ENC_MULTIPLY, 0, 0, MNEMONIC_ZR_RA, 0x0E209C00 },
+    { "mneg", ENC_MULTIPLY, 1, 0, MNEMONIC_ZR_RA },
+    { "movn", ENC_MOVE, 0b00, 0, 0 },
+    { "movz", ENC_MOVE, 0b10, 0, 0 },
+    { "movk", ENC_MOVE, 0b11, 0, 0 },
+    { "ldr", ENC_TRANSFER, 1, 0, 0 },
+    { "str", ENC_TRANSFER, 0, 0, 0 },
+    { "ldrb", ENC_TRANSFER, 1, 0, MNEMONIC_BYTE },
+    { "strb", ENC_TRANSFER, 0, 0, MNEMONIC_BYTE },
+    { "ldrh", ENC_TRANSFER, 1, 0, MNEMONIC_HALF },
+    { "strh", ENC_TRANSFER, 0, 0, MNEMONIC_HALF },
+    { "ldp", ENC_PAIR, 1, 0, 0 },
+    { "stp", ENC_PAIR, 0, 0, 0 },
+    { "csel", ENC_SELECT, 0, 0, 0 },
+    { "csinc", ENC_SELECT, 0, 1, 0 },
+    { "csinv", ENC_SELECT, 1, 0, 0 },
+    { "csneg", ENC_SELECT, 1, 1, 0 },
+    { "cset", ENC_SELECT, 0, 1, MNEMONIC_ZR_RN | MNEMONIC_INVERT },
+    { "csetm", ENC_SELECT, 1, 0, MNEMONIC_ZR_RN | MNEMONIC_INVERT },
+    { "cinc", ENC_SELECT, 0, 1, MNEMONIC_INVERT },
+    { "cinv", ENC_SELECT, 1, 0, MNEMONIC_INVERT },
+    { "cneg", ENC_SELECT, 1, 1, MNEMONIC_INVERT },
+    { "lsl", ENC_BITFIELD, 0b10, BITFIELD_LSL, 0 },
+    { "lsr", ENC_BITFIELD, 0b10, BITFIELD_SHIFT_RIGHT, 0 },
+    { "asr", ENC_BITFIELD, 0b00, BITFIELD_SHIFT_RIGHT, 0 },
+    { "sbfm", ENC_BITFIELD, 0b00, BITFIELD_MOVE, 0 },
+    { "ubfm", ENC_BITFIELD, 0b10, BITFIELD_MOVE, 0 },
+    { "sbfx", ENC_BITFIELD, 0b00, BITFIELD_EXTRACT, 0 },
+    { "ubfx", ENC_BITFIELD, 0b10, BITFIELD_EXTRACT, 0 },
+    { "sbfiz", ENC_BITFIELD, 0b00, BITFIELD_INSERT, 0 },
+    { "ubfiz", ENC_BITFIELD, 0b10, BITFIELD_INSERT, 0 },
+    { "sxtb", ENC_BITFIELD, 0b00, BITFIELD_EXTEND, MNEMONIC_BYTE },
+    { "sxth", ENC_BITFIELD, 0b00, BITFIELD_EXTEND, MNEMONIC_HALF },
+    { "sxtw", ENC_BITFIELD, 0b00, BITFIELD_EXTEND, 0 },
+    { "uxtb", ENC_BITFIELD, 0b10, BITFIELD_EXTEND, MNEMONIC_BYTE },
+    { "uxth", ENC_BITFIELD, 0b10, BITFIELD_EXTEND, MNEMONIC_HALF },
+    { "ldxr", ENC_EXCLUSIVE, 1, 0, 0 },
+    { "ldaxr", ENC_EXCLUSIVE, 1, 1, 0 },
+    { "stxr", ENC_EXCLUSIVE, 0, 0, 0 },
+    { "stlxr", ENC_EXCLUSIVE, 0, 1, 0 },
+    { "dmb", ENC_SYSTEM, SYSTEM_BARRIER, 0, 0 },
+    { "mrs", ENC_SYSTEM, SYSTEM_REGISTER, 0, 0 },
+    { "b", ENC_BRANCH, 0, 0, 0 },
+    { "br", ENC_BRANCH, 0, 0, MNEMONIC_REGISTER },
+    { "b.eq", ENC_BRANCH, 0x0, 0, MNEMONIC_CONDITIONAL },
+    { "b.ne", ENC_BRANCH, 0x1, 0, MNEMONIC_CONDITIONAL },
+    { "b.cs", ENC_BRANCH, 0x2, 0, MNEMONIC_CONDITIONAL },
+    { "b.hs", ENC_BRANCH, 0x2, 0, MNEMONIC_CONDITIONAL },
+    { "b.cc", ENC_BRANCH, 0x3, 0, MNEMONIC_CONDITIONAL },
+    { "b.lo", ENC_BRANCH, 0x3, 0, MNEMONIC_CONDITIONAL },
+    { "b.mi", ENC_BRANCH, 0x4, 0, MNEMONIC_CONDITIONAL },
+    { "b.pl", ENC_BRANCH, 0x5, 0, MNEMONIC_CONDITIONAL },
+    { "b.vs", ENC_BRANCH, 0x6, 0, MNEMONIC_CONDITIONAL },
+    { "b.vc", ENC_BRANCH, 0x7, 0, MNEMONIC_CONDITIONAL },
+    { "b.hi", ENC_BRANCH, 0x8, 0, MNEMONIC_CONDITIONAL },
+    { "b.ls", ENC_BRANCH, 0x9, 0, MNEMONIC_CONDITIONAL },
+    { "b.ge", ENC_BRANCH, 0xA, 0, MNEMONIC_CONDITIONAL },
+    { "b.lt", ENC_BRANCH, 0xB, 0, MNEMONIC_CONDITIONAL },
+    { "b.gt", ENC_BRANCH, 0xC, 0, MNEMONIC_CONDITIONAL },
+    { "b.le", ENC_BRANCH, 0xD, 0, MNEMONIC_CONDITIONAL },
+    { "b.al", ENC_BRANCH, 0xE, 0, MNEMONIC_CONDITIONAL },
+    { "b.nv", ENC_BRANCH, 0xF, 0, MNEMONIC_CONDITIONAL },
+    { "ld1", ENC_SIMD, SIMD_STRUCTURE, 1, 0 },
+    { "st1", ENC_SIMD, SIMD_STRUCTURE, 0, 0 },
+    { "dup", ENC_SIMD, SIMD_DUP, 0, 0 },
+    { "addv", ENC_SIMD, SIMD_ADDV, 0, 0 },
+    { "umov", ENC_SIMD, SIMD_UMOV, 0, 0 },
+    { ".int", ENC_DIRECTIVE, 0, 0, 0 },
+};
+
+#define MNEMONIC_COUNT ((int)(sizeof(mnemonics) / sizeof(mnemonics[0])))
+
+// Slot of each mnemonic: index into mnemonics plus one, 0 for an empty slot
+static unsigned char mnemonicSlots[1 << MNEMONIC_HASH_BITS];
+static unsigned int mnemonicSeed = MNEMONIC_HASH_SEED;
+
+// Seeded FNV-1a of a token, reduced to MNEMONIC_HASH_BITS
+unsigned int hashMnemonic(const char *text, int length, unsigned int seed) {
+    unsigned int hash = 2166136261u ^ seed;
+    for (int i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)text[i]) * 16777619u;
+    }
+    return hash >> (32 - MNEMONIC_HASH_BITS);
+}
+
+// Function to fill the mnemonic slots. MNEMONIC_HASH_SEED was searched offline
+// so that no two mnemonics share a slot; after a table edit without a new seed
+// the search is repeated here so the hash stays perfect.
+void initMnemonicTable(void) {
+    for (;;) {
+        memset(mnemonicSlots, 0, sizeof(mnemonicSlots));
+        int i;
+        for (i = 0; i < MNEMONIC_COUNT; i++) {
+            unsigned int slot = hashMnemonic(mnemonics[i].name, strlen(mnemonics[i].name), mnemonicSeed);
+            if (mnemonicSlots[slot] != 0) {
+                break;
+            }
+            mnemonicSlots[slot] = i + 1;
+        }
+        if (i == MNEMONIC_COUNT) {
+            return;
         }
+        mnemonicSeed++;
     }
-    printf("Label not found: %s\n", label);
-    return -1; // Label not found
 }
 
-// Function to parse and add instruction
-void addInstruction(char *line, int address) {
-    strcpy(instructions[instructionCount].instruction, line);
-    instructions[instructionCount].address = address;
-    instructionCount++;
+// Function to find the descriptor of a mnemonic token, NULL if unknown
+const Mnemonic *findMnemonic(const char *text, int length) {
+    int entry = mnemonicSlots[hashMnemonic(text, length, mnemonicSeed)];
+    if (entry == 0) {
+        return NULL;
+    }
+    const Mnemonic *m = &mnemonics[entry - 1];
+    if (memcmp(m->name, text, length) != 0 || m->name[length] != '\0') {
+        return NULL;
+    }
+    return m;
+}
+
+// Decimal digit values plus one, 0 for any other character
+static const unsigned char digitValues[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+    ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10
+};
+
+// Function to parse the one or two digit number of an x or w register
+int parseRegisterNumber(const char *digits) {
+    int first = digitValues[(unsigned char)digits[0]] - 1;
+    if (first < 0) {
+        return 0;
+    }
+    int second = digitValues[(unsigned char)digits[1]] - 1;
+    return second < 0 ? first : first * 10 + second;
 }
 
 int parseOperand(char *operand, int *sf) {
     if (operand == NULL) {
         return 0;
     }
-    if (strcmp(operand, "xzr") == 0 || strcmp(operand, "wzr") == 0) {
-        return 31;
+    if (operand[0] == 'x' || operand[0] == 'w') {
+        if (operand[1] == 'z' && operand[2] == 'r') {
+            return 31; // xzr and wzr leave sf alone
+        }
+        if (operand[0] == 'x' && sf != NULL) {
+            *sf = 1;
+        }
+        int number = parseRegisterNumber(&operand[1]);
+        if (digitValues[(unsigned char)operand[1]] == 0 || number > 30) {
+            reportError("Invalid register: %s\n", operand);
+            return 0;
+        }
+        return number;
     }
     if (strncmp(operand, "0x",2) == 0) {
         return strtol(operand, NULL, 16);
     }
     if (operand[0] == '#') {
         return strtoul(&operand[1], NULL, 0);
-    } else if (operand[0] == 'x') {
-        if (sf != NULL) {
-            *sf = 1;
-        }
-        return atoi(&operand[1]);
-    } else if (operand[0] == 'w') {
-        return atoi(&operand[1]);
     } else {
         return strtoul(&operand[0], NULL, 0);
     }
 }
 
-int arithmeticInstructions(char *mnemonic, char *rd, char *rn, char *operand, char *remainder) {
-    printf("Encoding data processing instruction: %s %s %s %s %s\n", mnemonic, rd, rn, operand, remainder);
+int arithmeticInstructions(const Mnemonic *m, char *rd, char *rn, char *operand, char *shift, char *amount) {
+    TRACE("Encoding data processing instruction: %s %s %s %s %s %s\n", m->name, rd, rn, operand, shift, amount);
+
+    // The aliases drop one register, so their shift is one operand earlier
+    char *zr = "xzr";
+    if (m->flags & MNEMONIC_ZR_RD) { // cmp rn, operand
+        amount = shift;
+        shift = operand;
+        operand = rn;
+        rn = rd;
+        rd = zr;
+    } else if (m->flags & MNEMONIC_ZR_RN) { // neg rd, operand
+        amount = shift;
+        shift = operand;
+        operand = rn;
+        rn = zr;
+    }
+
     int instruction = 0;
     int sf = 0;
-    int opc = 0;
+    int opc = m->opc;
     int shiftAmount = 0;
     int imm12 = 0;
     int rm = 0;
@@ -80,67 +652,24 @@ int arithmeticInstructions(char *mnemonic, char *rd, char *rn, char *operand, ch
     int Rd = parseOperand(rd, &sf);
     int sh = 0;
     int opVal = parseOperand(operand, &sf);
-    
-    if (strcmp(mnemonic, "cmp") == 0) {
-        mnemonic = "subs";
-        char *zr = "xzr";
-        if (remainder != NULL) {
-            char input[30];
-            sprintf(input, "%s %s", operand, remainder);
-            return arithmeticInstructions(mnemonic, zr, rd, rn, input);
-        } else {
-            return arithmeticInstructions(mnemonic, zr, rd, rn, NULL);
-        }
-    } else if (strcmp(mnemonic, "cmn") == 0) {
-        mnemonic = "adds";
-        char *zr = "xzr";
-        if (remainder != NULL) {
-            char input[30];
-            sprintf(input, "%s %s", operand, remainder);
-            return arithmeticInstructions(mnemonic, zr, rd, rn, input);
-        } else {
-            return arithmeticInstructions(mnemonic, zr, rd, rn, NULL);
-        }
-    } else if (strcmp(mnemonic, "neg") == 0) {
-        mnemonic = "sub";
-        char *zr = "xzr";
-        return arithmeticInstructions(mnemonic, rd, zr, rn, NULL);
-    } else if (strcmp(mnemonic, "negs") == 0) {
-        mnemonic = "subs";
-        char *zr = "xzr";
-        return arithmeticInstructions(mnemonic, rd, zr, rn, NULL);
-    }
-    
+
     if (strchr(operand, '#') != NULL) {
         
-        if (remainder != NULL) {
-            strtok(remainder, " \t\n");
-            char *shiftVal = strtok(NULL, " \t\n");
-            shiftAmount = parseOperand(shiftVal, NULL);
+        if (shift != NULL) {
+            shiftAmount = parseOperand(amount, NULL);
             if (shiftAmount != 0) {
                 sh = 1;
             }
         } 
         imm12 = opVal;
 
-        if (strcmp(mnemonic, "add") == 0) {
-            opc = 0b000;
-        } else if (strcmp(mnemonic, "adds") == 0) {
-            opc = 0b001;
-        } else if (strcmp(mnemonic, "sub") == 0) {
-            opc = 0b010;
-        } else if (strcmp(mnemonic, "subs") == 0) {
-            opc = 0b011;
-        }
-
         instruction = (sf << 31) | (opc << 29) | (0b100 << 26) | (0b010 << 23) | (sh << 22) | ((imm12 & 0xFFF) << 10) | (Rn << 5) | Rd;
     } else {
         rm = parseOperand(operand, &sf);
         int shiftCode = 8;
-        if (remainder != NULL) {
-            char *shiftType = strtok(remainder, " \t\n");
-            char *shiftVal = strtok(NULL, " \t\n");
-            shiftAmount = parseOperand(shiftVal, NULL);
+        if (shift != NULL) {
+            char *shiftType = shift;
+            shiftAmount = parseOperand(amount, NULL);
             if (strcmp(shiftType, "lsl") == 0) {
                 shiftCode = 0b1000;
             } else if (strcmp(shiftType, "lsr") == 0) {
@@ -150,93 +679,55 @@ int arithmeticInstructions(char *mnemonic, char *rd, char *rn, char *operand, ch
             } else if (strcmp(shiftType, "ror") == 0) {
                 shiftCode = 0b1110; //MAY BE INVALID HERE
             } else {
-                exit(EXIT_FAILURE);
+                reportError("Unknown shift: %s\n", shiftType);
             }
         }
-        if (strcmp(mnemonic, "add") == 0) {
-            opc = 0b000;
-        } else if (strcmp(mnemonic, "adds") == 0) {
-            opc = 0b001;
-        } else if (strcmp(mnemonic, "sub") == 0) {
-            opc = 0b010;
-        } else if (strcmp(mnemonic, "subs") == 0) {
-            opc = 0b011;
-        }
         instruction = (sf << 31) | (opc << 29) | (0 << 28) | (0b101 << 25) | (shiftCode << 21) | (rm << 16) | (shiftAmount << 10) | (Rn << 5) | Rd;
     }
 
-    printf("Encoded instruction: 0x%X\n", instruction);
+    TRACE("Encoded instruction: 0x%X\n", instruction);
     return instruction;
 }
 
 // Function to encode a single data transfer instruction
-int logicalInstructions(char *mnemonic, char *rd, char *rn, char *operand, char *remainder) {
-    printf("Encoding logical instruction: %s %s %s %s %s\n", mnemonic, rd, rn, operand, remainder);
-    
-    if ((strcmp(mnemonic, "and") == 0)
-    && (strcmp(rd, "x0") == 0)
-    && (strcmp(rn, "x0") == 0)
-    && (strcmp(operand, "x0") == 0)) {
-        return 0x8A000000;
-    } else if (strcmp(mnemonic, "tst") == 0) {
-        mnemonic = "ands";
-        char *zr = "w31";
-            if (remainder != NULL) {
-            char input[30];
-            sprintf(input, "%s %s", operand, remainder);
-            return logicalInstructions(mnemonic, zr, rd, rn, input);
-        } else {
-            return logicalInstructions(mnemonic, zr, rd, rn, NULL);
-        }
+int logicalInstructions(const Mnemonic *m, char *rd, char *rn, char *operand, char *shift, char *amount) {
+    TRACE("Encoding logical instruction: %s %s %s %s %s %s\n", m->name, rd, rn, operand, shift, amount);
+
+    // tst is ands and mov and mvn are orr and orn with the zero register
+    char *zr = "xzr";
+    if (m->flags & MNEMONIC_ZR_RD) { // tst rn, operand
+        amount = shift;
+        shift = operand;
+        operand = rn;
+        rn = rd;
+        rd = zr;
+    } else if (m->flags & MNEMONIC_ZR_RN) { // mov rd, operand
+        amount = shift;
+        shift = operand;
+        operand = rn;
+        rn = zr;
     }
 
     int instruction = 0;
     int sf = 0;
-    int opc = 0;
+    int opc = m->opc;
     int shiftAmount = 0;
     int Rn = parseOperand(rn, &sf);
     int Rd = parseOperand(rd, &sf);
     int shiftCode = 0;
-    int N = 0;
-
-    if (strcmp(mnemonic, "and") == 0) {
-            opc = 0b00;
-        } else if (strcmp(mnemonic, "bic") == 0) {
-            opc = 0b00;
-            N = 1;
-        } else if (strcmp(mnemonic, "orr") == 0) {
-            opc = 0b01;
-        } else if (strcmp(mnemonic, "orn") == 0) {
-            opc = 0b01;
-            N = 1;
-        } else if (strcmp(mnemonic, "eor") == 0) {
-            opc = 0b10;
-        } else if (strcmp(mnemonic, "eon") == 0) {
-            opc = 0b10;
-            N = 1;
-        } else if (strcmp(mnemonic, "ands") == 0) {
-            opc = 0b11;
-        } else if (strcmp(mnemonic, "bics") == 0) {
-            opc = 0b11;
-            N = 1;
-    }
+    int N = m->N;
     
     // Check if operand is an immediate value
     if (strchr(operand, '#') != NULL) {
         int imm = parseOperand(operand, NULL);
-        if (remainder != NULL) {
-            strtok(remainder, " \t\n");
-            char *shiftVal = strtok(NULL, " \t\n");
-            shiftAmount = parseOperand(shiftVal, NULL);
-            if (shiftAmount != 0) {
-            }
+        if (shift != NULL) {
+            shiftAmount = parseOperand(amount, NULL);
         } 
         instruction = (sf << 31) | (opc << 29) | (0b100 << 26) | (shiftAmount << 22) | ((imm & 0xFFF) << 10) | (Rn << 5) | Rd;
     } else {
-        if (remainder != NULL) {
-            char *shiftType = strtok(remainder, " \t\n");
-            char *shiftVal = strtok(NULL, " \t\n");
-            shiftAmount = parseOperand(shiftVal, NULL);
+        if (shift != NULL) {
+            char *shiftType = shift;
+            shiftAmount = parseOperand(amount, NULL);
             if (strcmp(shiftType, "lsl") == 0) {
                 shiftCode = 0b000;
             } else if (strcmp(shiftType, "lsr") == 0) {
@@ -246,158 +737,189 @@ int logicalInstructions(char *mnemonic, char *rd, char *rn, char *operand, char
             } else if (strcmp(shiftType, "ror") == 0) {
                 shiftCode = 0b011; //
             } else {
-                exit(EXIT_FAILURE);
+                reportError("Unknown shift: %s\n", shiftType);
             }
         }
         int Rm = parseOperand(operand, &sf);
         instruction = (sf << 31) | (opc << 29) | (0 << 28) | (0b101 << 25) | (shiftCode << 22) | (N << 21) | (Rm << 16) | (shiftAmount << 10) | (Rn << 5) | Rd;
     }
 
-    printf("Encoded instruction: 0x%X\n", instruction);
+    TRACE("Encoded instruction: 0x%X\n", instruction);
     return instruction;
 }
 
-int multiplicationInstructions(char *mnemonic, char *rd, char *rn, char *rm, char *ra) {
-    printf("Encoding multiplication instruction: %s %s %s %s %s\n", mnemonic, rd, rn, rm, ra);
+int multiplicationInstructions(const Mnemonic *m, char *rd, char *rn, char *rm, char *ra) {
+    TRACE("Encoding multiplication instruction: %s %s %s %s %s\n", m->name, rd, rn, rm, ra);
 
+    if (m->flags & MNEMONIC_ZR_RA) { // mul and mneg add to the zero register
+        ra = "xzr";
+    }
     int instruction = 0;
     int sf = 0;  // Size flag (0 for 32-bit, 1 for 64-bit)
-    int x = 0; // Operation code
+    int x = m->opc; // Operation code
     int Rn = parseOperand(rn, &sf);
     int Rd = parseOperand(rd, &sf);
     int Rm = parseOperand(rm, &sf); //
     int Ra = parseOperand(ra, &sf);
 
-    //Determine the operation code for the mnemonic
-    if (strcmp(mnemonic, "msub") == 0) {
-        x = 1;
-    } else if (strcmp(mnemonic, "mul") == 0) {
-        Ra = 31;
-    } else if (strcmp(mnemonic, "mneg") == 0) {
-        mnemonic = "msub";
-        char *zr = "w31";
-        return multiplicationInstructions(mnemonic, rd, rn, rm, zr);
-    }
-
     instruction = (sf << 31) | (0b0011011000 << 21) | (Rm << 16) | (x << 15) | (Ra << 10) | (Rn << 5) | Rd;
 
     return instruction;
 }
 
-int movInstructions(char *mnemonic, char *rd, char *operand, char *remainder) {
-    printf("Encoding mov instruction: %s %s %s\n", mnemonic, rd, operand);
+int movInstructions(const Mnemonic *m, char *rd, char *operand, char *shift, char *amount) {
+    TRACE("Encoding mov instruction: %s %s %s\n", m->name, rd, operand);
 
     int instruction = 0;
     int sf = 0;  // Size flag (0 for 32-bit, 1 for 64-bit)
     int opi = 0b101;
-    int opc = 0b01; // Invalid opc as placeholder
+    int opc = m->opc;
     int Rd = parseOperand(rd, &sf);
     int imm16 = 0;
     int shiftAmount = 0;
-    
-    if (strcmp(mnemonic, "mov") == 0) {
-            mnemonic = "orr";
-            char *zr = "w31";
-            return (logicalInstructions(mnemonic, rd, zr, operand, NULL));
-        } else if (strcmp(mnemonic, "mvn") == 0) {
-            mnemonic = "orn";
-            char *zr = "xzr";
-            return (logicalInstructions(mnemonic, rd, zr, operand, NULL));
-        } else if (strcmp(mnemonic, "movn") == 0) {//
-            opc = 0b00;
-        } else if (strcmp(mnemonic, "movz") == 0) {//
-            opc = 0b10;
-        } else if (strcmp(mnemonic, "movk") == 0) {//
-            opc = 0b11;
-        }
-
-    if (remainder != NULL) {
-            strtok(remainder, " \t\n");
-            char *shiftVal = strtok(NULL, " \t\n");
-            shiftAmount = parseOperand(shiftVal, NULL);
-            if (shiftAmount != 0) {
-            }
+
+    if (shift != NULL) {
+            shiftAmount = parseOperand(amount, NULL);
             shiftAmount /= 16;
         } 
     imm16 = parseOperand(operand, NULL);
     instruction = (sf << 31) | (opc << 29) | (0b100 << 26) | (opi << 23) | (shiftAmount << 21) | (imm16 << 5) | Rd;
 
-    printf("Encoded instruction: 0x%X\n", instruction);
+    TRACE("Encoded instruction: 0x%X\n", instruction);
     return instruction;
 }
-void parseAddressingMode(char *input, int *reg, int *offset, int *preIndex, int *sf, int registerOn) {
-    // Remove the square brackets
-    char *start = strchr(input, '[');
-    char *end = strchr(input, ']');
-    if (start && end) {
-        *start = ' ';
-        *end = ' ';
+// Function to parse the base register of an address operand, "[xn" or "[xn]"
+int parseBaseRegister(char *operand) {
+    if (operand != NULL && operand[0] == '[') {
+        operand++;
     }
-    if (registerOn) {
-            char *token = strtok(input, ", \t\n");
-            if (token) {
-                *reg = parseOperand(token, NULL);
-            }
-            token = strtok(NULL, " ,#");
-            if (token) {
-                *offset = parseOperand(token, NULL);
-            }
+    return parseOperand(operand, NULL);
+}
+
+// Function to encode a constant as a single movz or movn, returns 0 if it needs more
+int singleMove(uint64_t value, int sf, int rd) {
+    uint64_t mask = sf ? ~0ULL : 0xFFFFFFFF;
+    uint32_t size = (uint32_t)sf << 31;
+    for (int hw = 0; hw < (sf ? 4 : 2); hw++) {
+        uint64_t field = 0xFFFFULL << (16 * hw);
+        if ((value & ~field) == 0) {
+            return (int)(size | 0x52800000 | hw << 21 | (uint32_t)((value >> (16 * hw)) & 0xFFFF) << 5 | rd);
+        }
+        if ((~value & mask & ~field) == 0) {
+            return (int)(size | 0x12800000 | hw << 21 | (uint32_t)((~value >> (16 * hw)) & 0xFFFF) << 5 | rd);
+        }
+    }
+    return 0;
+}
+
+// Function to encode ldr rt, =operand: a constant that fits one move becomes a
+// movz or movn, anything else an ldr literal from the pending literal pool, where
+// each constant or label address is stored once
+int literalLoad(int sf, int rt, char *operand, int lineNo) {
+    uint64_t value = 0;
+    const char *target = NULL;
+    if (isLabelOperand(operand)) {
+        if (relocatable) { // Objects only relocate offsets
+            reportError("Label address literal in an object: =%s\n", operand);
+            return 0;
+        }
+        target = operand;
     } else {
-        char *exclamation = strchr(input, '!');
-        if (exclamation == NULL) {
-            *preIndex = 0;  // Post-indexing or offset
-        } else {
-            *preIndex = 1;
-            *exclamation = ' ';
+        char *end;
+        errno = 0;
+        value = operand[0] == '-' ? (uint64_t)strtoll(operand, &end, 0) : strtoull(operand, &end, 0);
+        if (end == operand || *end != '\0' || errno != 0) {
+            reportError("Invalid literal: =%s\n", operand);
+            return 0;
         }
-        char *token = strtok(input, " ,#");
-        if (token) {
-            *reg = parseOperand(token, NULL);
+        if (!sf) {
+            value &= 0xFFFFFFFF;
         }
+        int move = singleMove(value, sf, rt);
+        if (move != 0) {
+            TRACE("Literal 0x%llx fits a move\n", (unsigned long long)value);
+            return move;
+        }
+    }
+    if (currentReference != NULL) { // Pools would move the lines after them
+        reportError("Literal pools are not supported in watch mode: =%s\n", operand);
+        return 0;
+    }
 
-        token = strtok(NULL, " ,#");
-        if (token != NULL) {
-            *offset = parseOperand(token, NULL);
-        } else {
-            *offset = 0;
+    size_t length = strlen(operand) + 48;
+    char *name = malloc(length);
+    if (name == NULL) {
+        perror("Error allocating literal");
+        exit(EXIT_FAILURE);
+    }
+    if (target != NULL) {
+        snprintf(name, length, "=%d:%c:%s", poolNumber, sf ? 'x' : 'w', target);
+    } else {
+        snprintf(name, length, "=%d:%c:0x%llx", poolNumber, sf ? 'x' : 'w', (unsigned long long)value);
+    }
+    Label *slot = internLabel(name);
+    if (slot->fixups == NULL) { // First load of this literal from the pending pool
+        if (literalCount == literalCapacity) {
+            literalCapacity = literalCapacity ? literalCapacity * 2 : 64;
+            literals = realloc(literals, literalCapacity * sizeof(Literal));
+            if (literals == NULL) {
+                perror("Error allocating literal");
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (literalCount == 0) {
+            poolStart = lineNo;
+            poolWords = 1; // Alignment of the x register entries
         }
+        literals[literalCount++] = (Literal){ slot->label, target != NULL ? arenaStrdup(&labelArena, target) : NULL, value, sf ? 2 : 1 };
+        poolWords += sf ? 2 : 1;
     }
+    labelOffset(name, lineNo, FIXUP_IMM19);
+    free(name);
+    return (int)(((uint32_t)sf << 30) | 0x18000000 | rt);
 }
 
-int singleDataTransfer(char *mnemonic, char *rt, char *rn, char *remainder, int lineNo) {
-    printf("\nEncoding single data transfer instruction: %s %s %s %s\n", mnemonic, rt, rn, remainder ? remainder : "NULL");
+int singleDataTransfer(const Mnemonic *m, char *rt, char *rn, char *remainder, int lineNo) {
+    TRACE("\nEncoding single data transfer instruction: %s %s %s %s\n", m->name, rt, rn, remainder ? remainder : "NULL");
 
     int instruction = 0;
     int sf = 0;  // Size flag (0 for 32-bit, 1 for 64-bit)
-    int L = 0; // Load/store flag
+    int L = m->opc; // Load/store flag
     int offset = 0; // Immediate offset value
     int labeloffset = 0;
     int preIndex = 0;
-    int Rn = -1;
+    int label = isLabelOperand(rn);
+    int Rn = label || rn[0] == '=' ? 0 : parseBaseRegister(rn); // A label may start with x or w
     int U = 0;
     int Rt = parseOperand(rt, &sf);
     int neg = 0;
-    int label = labelExists(rn);
+    int size = 2 | sf; // Access size, 1 << size bytes
+    if (m->flags & MNEMONIC_BYTE) {
+        size = 0;
+    } else if (m->flags & MNEMONIC_HALF) {
+        size = 1;
+    }
 
     if (label) {
-        labeloffset = getLabelAddress(rn);
-        labeloffset -= (lineNo * 4);
-        labeloffset /= 4;
+        labeloffset = labelOffset(rn, lineNo, FIXUP_IMM19);
         if (labeloffset < 0) {
             labeloffset *= -1;
             neg = 1;
         }
     }
 
-    if (strcmp(mnemonic, "str") == 0) {
-        L = 0b0; // STR operation code
-        printf("Operation: STR\n");
-    } else if (strcmp(mnemonic, "ldr") == 0) {
-        L = 0b1; // LDR operation code
-        printf("Operation: LDR\n");
-    } else {
-        printf("Unsupported mnemonic: %s\n", mnemonic);
-        exit(EXIT_FAILURE);
+    TRACE("Operation: %s\n", L ? "LDR" : "STR");
+
+    if (rn[0] == '=') {
+        if (!L || size < 2) {
+            reportError("Unsupported literal operand for %s: %s\n", m->name, rn);
+            return 0;
+        }
+        return literalLoad(sf, Rt, rn + 1, lineNo);
+    }
+    if (size < 2 && (rn[0] == '#' || label)) {
+        reportError("Unsupported literal operand for %s: %s\n", m->name, rn);
+        return 0;
     }
 
     if (rn[0] == '#' || label) { // Literal Load NEEDS TO BE CHANGED LATER TO COMPENSATE FOR LABELS
@@ -412,257 +934,1574 @@ int singleDataTransfer(char *mnemonic, char *rt, char *rn, char *remainder, int
             instruction = (0 << 31) | (sf << 30) | (0b011000 << 24) | (offset << 5) | Rt;
         }
     } else if (remainder == NULL || (strchr(remainder, '#') != NULL && strchr(remainder, ']') != NULL && strchr(remainder, '!') == NULL)) { // Offset
-        char input[20];
-        sprintf(input, "%s, %s", rn, remainder);
-        parseAddressingMode(input, &Rn, &offset, &preIndex, &sf, 0);
-        if (sf) {
-            offset /= 8;
-        } else {
-            offset /= 4;
-        }
+        offset = parseOperand(remainder, NULL);
+        offset /= 1 << size; // Scaled by the access size
         U = 1;
-        instruction = (1 << 31) | (sf << 30) | (0b11100 << 25) | (U << 24) | (0 << 23) | (L << 22) | (offset << 10) | (Rn << 5) | Rt;
+        instruction = (size << 30) | (0b11100 << 25) | (U << 24) | (0 << 23) | (L << 22) | (offset << 10) | (Rn << 5) | Rt;
     } else if (strchr(remainder, '!') != NULL) { // Pre-Index
-        char *input = strcat(rn, remainder);
-        parseAddressingMode(input, &Rn, &offset, &preIndex, &sf, 0);
-        instruction = (1 << 31) | (sf << 30) | (0b11100 << 25) | (U << 24) | (0 << 23) | (L << 22) | (0 << 21) | (offset << 12) | (preIndex << 11) | (1 << 10) | (Rn << 5) | Rt;
+        offset = parseOperand(remainder, NULL);
+        preIndex = 1;
+        instruction = (size << 30) | (0b11100 << 25) | (U << 24) | (0 << 23) | (L << 22) | (0 << 21) | ((offset & 0x1FF) << 12) | (preIndex << 11) | (1 << 10) | (Rn << 5) | Rt;
     } else if (strchr(remainder, ']') == NULL) { // Post-Index
-        parseAddressingMode(rn, &Rn, &offset, &preIndex, &sf, 1); // Offset should be 0
-        char *off = strtok(remainder, " \t\n");
-        offset = parseOperand(off, NULL);
+        offset = parseOperand(remainder, NULL);
         if (offset < 0) {
             offset *= -1;
-            instruction = (1 << 31) | (sf << 30) | (0b11100 << 25) | (U << 24) | (0 << 23) | (L << 22) | (0 << 21) | (1 << 20) | (((~offset + 1) & 0xFF) << 12) | (preIndex << 11) | (1 << 10) | (Rn << 5) | Rt;
+            instruction = (size << 30) | (0b11100 << 25) | (U << 24) | (0 << 23) | (L << 22) | (0 << 21) | (1 << 20) | (((~offset + 1) & 0xFF) << 12) | (preIndex << 11) | (1 << 10) | (Rn << 5) | Rt;
         } else {
-            instruction = (1 << 31) | (sf << 30) | (0b11100 << 25) | (U << 24) | (0 << 23) | (L << 22) | (0 << 21) | (offset << 12) | (preIndex << 11) | (1 << 10) | (Rn << 5) | Rt;
-            printf("Post-Index: Rn = %d, Offset = %d\n", Rn, offset);
+            instruction = (size << 30) | (0b11100 << 25) | (U << 24) | (0 << 23) | (L << 22) | (0 << 21) | ((offset & 0x1FF) << 12) | (preIndex << 11) | (1 << 10) | (Rn << 5) | Rt;
+            TRACE("Post-Index: Rn = %d, Offset = %d\n", Rn, offset);
         }
     } else { // Register
-        char string[20];
-        sprintf(string, "%s, %s", rn, remainder);
-        parseAddressingMode(string, &Rn, &offset, &preIndex, &sf, 1); // Offset should be 0
-        instruction = (1 << 31) | (sf << 30) | (0b11100 << 25) | (U << 24) | (0 << 23) | (L << 22) | (1 << 21) | (offset << 16) | (0b011010 << 10) | (Rn << 5) | Rt;
+        offset = parseOperand(remainder, NULL); // Offset register
+        instruction = (size << 30) | (0b11100 << 25) | (U << 24) | (0 << 23) | (L << 22) | (1 << 21) | (offset << 16) | (0b011010 << 10) | (Rn << 5) | Rt;
     }
 
-    printf("Encoded instruction: 0x%X\n", instruction);
+    TRACE("Encoded instruction: 0x%X\n", instruction);
     return instruction;
 }
 
+// Function to map a condition name to its 4-bit code, -1 if unknown. The
+// condition codes are those of the b.<cond> descriptors.
+int conditionCode(char *condition) {
+    char name[8] = "b.";
+    if (condition != NULL && strlen(condition) == 2) {
+        memcpy(name + 2, condition, 3);
+        const Mnemonic *m = findMnemonic(name, 4);
+        if (m != NULL && (m->flags & MNEMONIC_CONDITIONAL)) {
+            return m->opc;
+        }
+    }
+    reportError("Unknown condition: %s\n", condition ? condition : "NULL");
+    return -1;
+}
+
 // Function to encode a branch instruction
-int encodeBranchInstruction(char *mnemonic, char *address, int lineNo) {
+int encodeBranchInstruction(const Mnemonic *m, char *address, int lineNo) {
     int instruction = 0;
     int offset = 0;
     int neg = 0;
-    int label = labelExists(address);
-
-    if (label) {
-        offset = getLabelAddress(address);
-        offset -= (lineNo * 4);
-        offset /= 4;
-        if (offset < 0) {
-            offset *= -1;
-            neg = 1;
-        }
+    if (!(m->flags & MNEMONIC_REGISTER) && isLabelOperand(address)) {
+        offset = labelOffset(address, lineNo, (m->flags & MNEMONIC_CONDITIONAL) ? FIXUP_IMM19 : FIXUP_IMM26);
     } else {
         offset = parseOperand(address, NULL);
     }
+    if (offset < 0) {
+        offset *= -1;
+        neg = 1;
+    }
 
-    if (strcmp(mnemonic, "b") == 0) { // Unconditional branch
-        printf("Unconditional\n");
+    if (m->flags & MNEMONIC_CONDITIONAL) { // Conditional branch
+        TRACE("Conditional\n");
+        int code = m->opc;
+        
+        if (neg == 0) {
+            instruction = (0b01010100 << 24) | (offset << 5) | (0 << 4) | code;
+        } else {
+            instruction = (0b01010100 << 24) | (1 << 23) | (((~offset + 1) & 0x7FFFF) << 5) | (0 << 4) | code;
+        }
+    } else if (!(m->flags & MNEMONIC_REGISTER)) { // Unconditional branch
+        TRACE("Unconditional\n");
         if (neg == 0) {
             instruction = (0b000101 << 26) | offset;
         } else {
             instruction = (0b000101 << 26) | (1 << 25) | ((~offset + 1) & 0x1FFFFFF);
         }
 
-    } else if (strcmp(mnemonic, "br") == 0) { // Register branch
-        printf("Register\n");
+    } else { // Register branch
+        TRACE("Register\n");
         if (neg == 0) {
             instruction = (0b1101011000011111000000 << 10) | (offset << 5) | 0b0000;
         } else {
             instruction = (0b1101011000011111000000 << 10) | (1 << 9) | (((~offset + 1) & 0xF) << 5) | 0b0000;
         }
-    } else { // Conditional branch
-        printf("Conditional\n");
-        char condition[10];
-        char *dotPosition = strchr(mnemonic, '.');
-        if (dotPosition != NULL) {
-            strcpy(condition, dotPosition + 1);
-        }
-        int code = -1;
-        if (strcmp(condition, "eq") == 0) {
-            code = 0x0; // Equal (Z == 1)
-        } else if (strcmp(condition, "ne") == 0) {
-            code = 0x1; // Not equal (Z == 0)
-        } else if (strcmp(condition, "ge") == 0) {
-            code = 0xA; // Signed greater or equal (N == 1)
-        } else if (strcmp(condition, "lt") == 0) {
-            code = 0xB; // Signed less than (N != 1)
-        } else if (strcmp(condition, "gt") == 0) {
-            code = 0xC; // Signed greater than (Z == 0 && N == V)
-        } else if (strcmp(condition, "le") == 0) {
-            code = 0xD; // Signed less than or equal (!(Z == 0 && N == V))
-        } else if (strcmp(condition, "al") == 0) {
-            code = 0xE; // Always (any)
-        } else {
-            printf("Unknown condition: %s\n", condition);
-        }
-        
-        if (neg == 0) {
-            instruction = (0b01010100 << 24) | (offset << 5) | (0 << 4) | code;
-        } else {
-            instruction = (0b01010100 << 24) | (1 << 23) | (((~offset + 1) & 0x7FFFF) << 5) | (0 << 4) | code;
-        }
     }
 
-    printf("Encoding branch instruction: %s %s\n", mnemonic, address);
+    TRACE("Encoding branch instruction: %s %s\n", m->name, address);
     return instruction;
 }
 
-// Function to encode a special directive
-int encodeDirective(char *directive, char *value) {
-    if (strcmp(directive, ".int") == 0) {
-        return (int)strtol(value, NULL, 0);
+// Function to encode a load/store pair: ldp/stp rt, rt2, [rn{, #imm}]{!} or [rn], #imm
+int pairInstructions(const Mnemonic *m, char *rt, char *rt2, char *base, char *offsetOperand) {
+    TRACE("Encoding pair instruction: %s %s %s %s %s\n", m->name, rt, rt2, base, offsetOperand);
+
+    int sf = 0;
+    int L = m->opc;
+    int Rt = parseOperand(rt, &sf);
+    int Rt2 = parseOperand(rt2, &sf);
+    int Rn = parseBaseRegister(base);
+    int offset = offsetOperand ? parseOperand(offsetOperand, NULL) : 0;
+    int index = 2; // Signed offset
+    if (offsetOperand != NULL && strchr(offsetOperand, '!') != NULL) {
+        index = 3; // Pre-index
+    } else if (offsetOperand != NULL && strchr(base, ']') != NULL) {
+        index = 1; // Post-index
     }
-    return 0;
+    int imm7 = (offset / (sf ? 8 : 4)) & 0x7F;
+
+    int instruction = ((sf ? 2 : 0) << 30) | (0b101 << 27) | (index << 23) | (L << 22) | (imm7 << 15) | (Rt2 << 10) | (Rn << 5) | Rt;
+    TRACE("Encoded instruction: 0x%X\n", instruction);
+    return instruction;
 }
 
-// Function to process each line and determine if it is a label, instruction, or directive
-int processLine(char *line, int address) {
-    char *token = strtok(line, " \t\n");
-    if (token == NULL) return 1;
+// Function to encode a conditional select (csel, csinc, csinv, csneg) and the
+// cset, csetm, cinc, cinv and cneg aliases
+int conditionalSelect(const Mnemonic *m, char *rd, char *rn, char *rm, char *cond) {
+    TRACE("Encoding conditional select instruction: %s %s %s %s %s\n", m->name, rd, rn, rm ? rm : "NULL", cond ? cond : "NULL");
 
-    if (strchr(token, ':') != NULL) {
-        // It's a label
-        token[strlen(token) - 1] = '\0'; // Remove the colon
-        addLabel(token, address);
-        return 1;
-    } else {
-        // It's an instruction or directive
-        addInstruction(line, address);
-        return 0;
+    // The aliases select the first operand on the inverted condition
+    if (m->flags & MNEMONIC_ZR_RN) { // cset rd, cond
+        cond = rn;
+        rn = rm = "xzr";
+    } else if (m->flags & MNEMONIC_INVERT) { // cinc rd, rn, cond
+        cond = rm;
+        rm = rn;
     }
-}
 
-// Function to parse the assembly file and perform the two-pass assembly
-void assemble(char *inputFileName, char *outputFileName) {
-    FILE *inputFile = fopen(inputFileName, "r");
-    if (inputFile == NULL) {
-        perror("Error opening input file");
-        exit(EXIT_FAILURE);
+    int sf = 0;
+    int Rd = parseOperand(rd, &sf);
+    int Rn = parseOperand(rn, &sf);
+    int Rm = parseOperand(rm, &sf);
+    int code = conditionCode(cond) & 0xF;
+    if (m->flags & MNEMONIC_INVERT) {
+        code ^= 1;
     }
+    int op = m->opc;
+    int op2 = m->N;
 
-    char line[MAX_LINE_LENGTH];
-    int address = MEMORY_OFFSET;
+    int instruction = (sf << 31) | (op << 30) | (0b11010100 << 21) | (Rm << 16) | (code << 12) | (op2 << 10) | (Rn << 5) | Rd;
+    TRACE("Encoded instruction: 0x%X\n", instruction);
+    return instruction;
+}
 
-    // First pass: Create symbol table
-    while (fgets(line, sizeof(line), inputFile)) {
-        int blank = processLine(line, address);
-        if (blank != 1) {
-            address += 4; // Each instruction is 4 bytes
-        }
-    }
-    fclose(inputFile);
+// Function to encode a bitfield move (sbfm, ubfm) and its aliases: asr, lsl and
+// lsr by immediate, sbfx, ubfx, sbfiz, ubfiz, sxtb, sxth, sxtw, uxtb and uxth
+int bitfieldInstructions(const Mnemonic *m, char *rd, char *rn, char *operand, char *remainder) {
+    TRACE("Encoding bitfield instruction: %s %s %s %s %s\n", m->name, rd, rn, operand ? operand : "NULL", remainder ? remainder : "NULL");
 
-    inputFile = fopen(inputFileName, "r");
-    if (inputFile == NULL) {
-        perror("Error opening input file");
-        exit(EXIT_FAILURE);
-    }
+    int sf = 0;
+    int Rd = parseOperand(rd, &sf);
+    int Rn = parseOperand(rn, NULL); // sxtw x0, w1 reads a W register
+    int datasize = sf ? 64 : 32;
+    int first = operand ? parseOperand(operand, NULL) : 0;
+    int second = remainder ? parseOperand(remainder, NULL) : 0;
+    int opc = m->opc;
+    int immr = 0;
+    int imms = 0;
 
-    FILE *outputFile = fopen(outputFileName, "wb");
-    if (outputFile == NULL) {
-        perror("Error opening output file");
-        exit(EXIT_FAILURE);
+    switch (m->N) {
+        case BITFIELD_LSL:
+        case BITFIELD_SHIFT_RIGHT:
+            if (operand == NULL || operand[0] != '#') {
+                reportError("Unsupported register shift: %s %s\n", m->name, operand ? operand : "NULL");
+                return 0;
+            }
+            immr = m->N == BITFIELD_LSL ? (datasize - first) % datasize : first;
+            imms = m->N == BITFIELD_LSL ? datasize - 1 - first : datasize - 1;
+            break;
+        case BITFIELD_EXTRACT: // #lsb, #width
+            immr = first;
+            imms = first + second - 1;
+            break;
+        case BITFIELD_INSERT: // #lsb, #width
+            immr = (datasize - first) % datasize;
+            imms = second - 1;
+            break;
+        case BITFIELD_EXTEND:
+            imms = (m->flags & MNEMONIC_BYTE) ? 7 : (m->flags & MNEMONIC_HALF) ? 15 : 31;
+            break;
+        default: // sbfm, ubfm rd, rn, #immr, #imms
+            immr = first;
+            imms = second;
+            break;
     }
 
-    int lineNo = 0;
-    fseek(outputFile,MEMORY_OFFSET*4,SEEK_SET);
-    // Second pass: Encode instructions
-    while (fgets(line, sizeof(line), inputFile)) {
-        char *token = strtok(line, " \t\n");
-        if (token == NULL) continue;
+    int instruction = (sf << 31) | (opc << 29) | (0b100110 << 23) | (sf << 22) | ((immr & 0x3F) << 16) | ((imms & 0x3F) << 10) | (Rn << 5) | Rd;
+    TRACE("Encoded instruction: 0x%X\n", instruction);
+    return instruction;
+}
 
-        if (strchr(token, ':') != NULL) {
-            // It's a label, skip it
-            continue;
-        }
-        int binaryInstruction = 0;
-        char *mnemonic = token;
-        char *rd = strtok(NULL, ", \t\n");
-        char *rn = strtok(NULL, ", \t\n");
-        
-        if (
-            strncmp(mnemonic, "add", 3) == 0 || 
-            strncmp(mnemonic, "sub", 3) == 0 || 
-            strncmp(mnemonic, "cm", 2) == 0  || 
-            strncmp(mnemonic, "neg", 3) == 0
-        ) {
-            char *operand = strtok(NULL, ", \t\n");
-            char *remainder = strtok(NULL, "");
-            binaryInstruction = arithmeticInstructions(mnemonic, rd, rn, operand, remainder);
-        } 
-        else if (
-            strcmp(mnemonic, "madd") == 0 || 
-            strcmp(mnemonic, "msub") == 0 || 
-            strcmp(mnemonic, "mul") == 0  || 
-            strcmp(mnemonic, "mneg") == 0
-            ) {
-            char *operand = strtok(NULL, ", \t\n");
-            char *rm = strtok(NULL, " \t\n");
-            binaryInstruction = multiplicationInstructions(mnemonic, rd, rn, operand, rm);
-        } 
-        else if (
-            strncmp(mnemonic, "mov",3) == 0 || 
-            strcmp(mnemonic, "mvn") == 0
-            ) {
-            char *remainder = strtok(NULL, "");
-            binaryInstruction = movInstructions(mnemonic, rd, rn, remainder);
-        }
-        else if (
-            strcmp(mnemonic, "ldr") == 0 || 
-            strcmp(mnemonic, "str") == 0
-        ) {
-            char *remainder = strtok(NULL, "");
-            binaryInstruction = singleDataTransfer(mnemonic, rd, rn, remainder, lineNo);
-        } 
-        else if (
-            strcmp(mnemonic, "b") == 0  ||
-            strcmp(mnemonic, "br") == 0 ||
-            strncmp(mnemonic, "b.", 2) == 0
-            ) {
-            binaryInstruction = encodeBranchInstruction(mnemonic, rd, lineNo);
-        } 
-        else if (
-            strncmp(mnemonic, ".int", 3) == 0
-            ) {
-            binaryInstruction = encodeDirective(mnemonic, rd);
-        } 
-        else if (
-            strncmp(mnemonic, "and", 3) == 0 || 
-            strncmp(mnemonic, "bic", 3) == 0 || 
-            strncmp(mnemonic, "or", 2) == 0  || 
-            strncmp(mnemonic, "eo", 2) == 0  ||
-            strncmp(mnemonic, "tst", 3) == 0
-            ) {
-            char *operand = strtok(NULL, ", \t\n");
-            char *remainder = strtok(NULL, "");
-            binaryInstruction = logicalInstructions(mnemonic, rd, rn, operand, remainder);
-        }
-        printf("Writing binary instruction: 0x%X\n", binaryInstruction);
-        fwrite(&binaryInstruction, sizeof(int), 1, outputFile);
+// Function to encode a load/store exclusive instruction
+int exclusiveInstructions(const Mnemonic *m, char *rs, char *rt, char *rn) {
+    TRACE("Encoding exclusive instruction: %s %s %s %s\n", m->name, rs, rt, rn);
+
+    int L = m->opc;
+    int o0 = m->N;
+    int sf = 0;
+    int Rs = 31;
+    if (L) { // ldxr rt, [rn]
+        rn = rt;
+        rt = rs;
+    } else { // stxr ws, rt, [rn]
+        Rs = parseOperand(rs, NULL);
+    }
+    int Rt = parseOperand(rt, &sf);
+    if (rn != NULL && rn[0] == '[') {
+        rn++;
+    }
+    int Rn = parseOperand(rn, NULL);
+
+    int instruction = ((2 | sf) << 30) | (0b001000 << 24) | (L << 22) | (Rs << 16) | (o0 << 15) | (31 << 10) | (Rn << 5) | Rt;
+    TRACE("Encoded instruction: 0x%X\n", instruction);
+    return instruction;
+}
+
+// Function to encode a barrier or system register instruction
+int systemInstructions(const Mnemonic *m, char *operand, char *sysreg) {
+    TRACE("Encoding system instruction: %s %s %s\n", m->name, operand, sysreg);
+
+    int instruction = 0;
+    if (m->opc == SYSTEM_BARRIER) {
+        static const char *options[16] = {
+            NULL, "oshld", "oshst", "osh", NULL, "nshld", "nshst", "nsh",
+            NULL, "ishld", "ishst", "ish", NULL, "ld", "st", "sy"
+        };
+        int CRm = operand == NULL ? 15 : -1; // dmb sy
+        for (int i = 0; i < 16; i++) {
+            if (operand != NULL && options[i] != NULL && strcmp(operand, options[i]) == 0) {
+                CRm = i;
+            }
+        }
+        if (CRm < 0) {
+            reportError("Unknown barrier option: %s\n", operand);
+            return 0;
+        }
+        instruction = 0xD50330BF | (CRm << 8);
+    } else {
+        if (sysreg == NULL || strcmp(sysreg, "mpidr_el1") != 0) {
+            reportError("Unsupported system register: %s\n", sysreg ? sysreg : "NULL");
+            return 0;
+        }
+        int Rt = parseOperand(operand, NULL);
+        instruction = 0xD5300000 | (0xC005 << 5) | Rt; // MPIDR_EL1
+    }
+
+    TRACE("Encoded instruction: 0x%X\n", instruction);
+    return instruction;
+}
+
+// Function to parse a vector register "v<n>.<arrangement>" (braces allowed) or a
+// scalar/element form "<b|h|s|d><n>" / "v<n>.<b|h|s|d>[<index>]", setting size and Q
+int parseVector(char *operand, int *size, int *Q, int *index) {
+    static const char *arrangements[] = { "8b", "16b", "4h", "8h", "2s", "4s", "1d", "2d" };
+    if (operand == NULL) {
+        return 0;
+    }
+    if (operand[0] == '{') {
+        operand++;
+    }
+    char *dot = strchr(operand, '.');
+    if (dot == NULL) { // Scalar register, the letter gives the size
+        const char *letter = strchr("bhsd", operand[0]);
+        *size = letter ? letter - "bhsd" : 0;
+        return atoi(&operand[1]);
+    }
+    for (int i = 0; i < 8; i++) {
+        size_t length = strlen(arrangements[i]);
+        if (strncmp(dot + 1, arrangements[i], length) == 0 && !isalnum((unsigned char)dot[1 + length])) {
+            *size = i / 2;
+            *Q = i % 2;
+            return atoi(&operand[1]);
+        }
+    }
+    const char *letter = strchr("bhsd", dot[1]);
+    if (letter != NULL && dot[2] == '[') { // Element
+        *size = letter - "bhsd";
+        *index = atoi(&dot[3]);
+        return atoi(&operand[1]);
+    }
+    reportError("Unknown vector arrangement: %s\n", operand);
+    return 0;
+}
+
+// Function to check for a vector register operand: "{v<n>..." or "v<n>.<T>"
+int isVectorOperand(const char *operand) {
+    return operand != NULL && (operand[0] == '{' || (operand[0] == 'v' && isdigit((unsigned char)operand[1]) && strchr(operand, '.')));
+}
+
+// Function to encode an AdvSIMD instruction: ld1, st1, dup, addv, umov, or the
+// three-register form of add, sub, mul, and, orr and eor
+int simdInstructions(const Mnemonic *m, char *rd, char *rn, char *rm) {
+    TRACE("Encoding SIMD instruction: %s %s %s %s\n", m->name, rd, rn, rm ? rm : "NULL");
+
+    int instruction = 0;
+    int size = 0, Q = 0, index = 0;
+    int scratch = 0;
+    if (m->encoder != ENC_SIMD) { // Three registers of the same arrangement
+        if (m->vector == 0) {
+            reportError("Unsupported SIMD mnemonic: %s\n", m->name);
+            return 0;
+        }
+        int Rd = parseVector(rd, &size, &Q, &index);
+        int Rn = parseVector(rn, &scratch, &scratch, &index);
+        int Rm = parseVector(rm, &scratch, &scratch, &index);
+        int sized = m->encoder != ENC_LOGICAL; // The bitwise operations have no element size
+        instruction = m->vector | (Q << 30) | ((sized ? size : 0) << 22) | (Rm << 16) | (Rn << 5) | Rd;
+    } else if (m->opc == SIMD_STRUCTURE) { // ld1 {vt.T}, [xn] {, #imm | xm}
+        int Rt = parseVector(rd, &size, &Q, &index);
+        int Rn = parseOperand(rn + (rn[0] == '['), NULL);
+        int L = m->N;
+        instruction = 0x0C007000 | (Q << 30) | (L << 22) | (size << 10) | (Rn << 5) | Rt;
+        if (rm != NULL) { // Post-index by the register size or by a register
+            int Rm = rm[0] == '#' ? 31 : parseOperand(rm, NULL);
+            instruction |= (1 << 23) | (Rm << 16);
+        }
+    } else if (m->opc == SIMD_DUP) { // dup vd.T, rn
+        int Rd = parseVector(rd, &size, &Q, &index);
+        int Rn = parseOperand(rn, NULL);
+        instruction = 0x0E000C00 | (Q << 30) | ((1 << size) << 16) | (Rn << 5) | Rd;
+    } else if (m->opc == SIMD_UMOV) { // umov rd, vn.T[index]
+        int Rd = parseOperand(rd, NULL);
+        int Rn = parseVector(rn, &size, &Q, &index);
+        int imm5 = (index << (size + 1)) | (1 << size);
+        instruction = 0x0E003C00 | ((size == 3) << 30) | (imm5 << 16) | (Rn << 5) | Rd;
+    } else { // addv <b|h|s>d, vn.T
+        int Rd = parseVector(rd, &scratch, &scratch, &index);
+        int Rn = parseVector(rn, &size, &Q, &index);
+        instruction = 0x0E31B800 | (Q << 30) | (size << 22) | (Rn << 5) | Rd;
+    }
+
+    TRACE("Encoded instruction: 0x%X\n", instruction);
+    return instruction;
+}
+
+// Function to encode a special directive
+int encodeDirective(char *directive, char *value) {
+    if (strcmp(directive, ".int") == 0) {
+        return (int)strtol(value, NULL, 0);
+    }
+    return 0;
+}
+
+// Function to encode one lexed instruction line at instruction index lineNo
+int encodeLine(Token *tokens, int count, int lineNo) {
+    char *operands[MAX_TOKENS] = { NULL }; // Missing operands are NULL
+    for (int i = 1; i < count; i++) {
+        operands[i - 1] = tokens[i].text;
+    }
+    int binaryInstruction = 0;
+    char *mnemonic = tokens[0].text;
+    char *rd = operands[0];
+    char *rn = operands[1];
+
+    const Mnemonic *m = findMnemonic(mnemonic, tokens[0].length);
+
+    if (m == NULL) {
+        reportError("Unknown mnemonic: %s\n", mnemonic);
+    } else {
+        // Vector operands select the AdvSIMD form of add, and, ...
+        switch (isVectorOperand(rd) ? ENC_SIMD : m->encoder) {
+            case ENC_ARITHMETIC:
+                binaryInstruction = arithmeticInstructions(m, rd, rn, operands[2], operands[3], operands[4]);
+                break;
+            case ENC_LOGICAL:
+                binaryInstruction = logicalInstructions(m, rd, rn, operands[2], operands[3], operands[4]);
+                break;
+            case ENC_MULTIPLY:
+                binaryInstruction = multiplicationInstructions(m, rd, rn, operands[2], operands[3]);
+                break;
+            case ENC_MOVE:
+                binaryInstruction = movInstructions(m, rd, rn, operands[2], operands[3]);
+                break;
+            case ENC_TRANSFER:
+                binaryInstruction = singleDataTransfer(m, rd, rn, operands[2], lineNo);
+                break;
+            case ENC_PAIR:
+                binaryInstruction = pairInstructions(m, rd, rn, operands[2], operands[3]);
+                break;
+            case ENC_SELECT:
+                binaryInstruction = conditionalSelect(m, rd, rn, operands[2], operands[3]);
+                break;
+            case ENC_BITFIELD:
+                binaryInstruction = bitfieldInstructions(m, rd, rn, operands[2], operands[3]);
+                break;
+            case ENC_EXCLUSIVE:
+                binaryInstruction = exclusiveInstructions(m, rd, rn, operands[2]);
+                break;
+            case ENC_SYSTEM:
+                binaryInstruction = systemInstructions(m, rd, rn);
+                break;
+            case ENC_BRANCH:
+                binaryInstruction = encodeBranchInstruction(m, rd, lineNo);
+                break;
+            case ENC_DIRECTIVE:
+                binaryInstruction = encodeDirective(mnemonic, rd);
+                if (optimize) {
+                    markDataWord(lineNo, 0);
+                }
+                break;
+            case ENC_SIMD:
+                binaryInstruction = simdInstructions(m, rd, rn, operands[2]);
+                break;
+        }
+    }
+    TRACE("Writing binary instruction: 0x%X\n", binaryInstruction);
+    return binaryInstruction;
+}
+
+// Function to add a word at the end of the image
+void appendWord(int word) {
+    if (imageCount == imageCapacity) {
+        imageCapacity = imageCapacity ? imageCapacity * 2 : 1024;
+        image = realloc(image, imageCapacity * sizeof(int));
+        if (image == NULL) {
+            perror("Error allocating image");
+            exit(EXIT_FAILURE);
+        }
+    }
+    image[imageCount++] = word;
+}
+
+// Function to check for a .ltorg (or .pool) directive, which writes the pending
+// literal pool in place
+int isPoolDirective(const char *token, int length) {
+    return (length == 6 && memcmp(token, ".ltorg", 6) == 0) || (length == 5 && memcmp(token, ".pool", 5) == 0);
+}
+
+// Function to write the pending literal pool at the end of the image and point
+// its loads at it: the x register entries first, aligned to 8 bytes, then the
+// w register entries. A label address not defined yet is patched in later.
+void flushLiterals(void) {
+    if (literalCount == 0) {
+        return;
+    }
+    TRACE("Literal pool %d: %d entries at address: %d\n", poolNumber, literalCount, imageCount * 4);
+    for (int i = 0; i < literalCount; i++) {
+        if (literals[i].words == 2 && imageCount % 2 != 0) {
+            if (optimize) {
+                markDataWord(imageCount, 0);
+            }
+            appendWord(0);
+            break;
+        }
+    }
+    for (int words = 2; words >= 1; words--) {
+        for (int i = 0; i < literalCount; i++) {
+            Literal *literal = &literals[i];
+            if (literal->words != words) continue;
+            int index = imageCount;
+            uint64_t value = literal->value;
+            if (literal->target != NULL) {
+                int address;
+                if (findLabel(literal->target, &address)) {
+                    value = address;
+                } else {
+                    addFixup(internLabel(literal->target), index, FIXUP_ADDRESS);
+                }
+            }
+            for (int j = 0; j < words; j++) {
+                if (optimize) {
+                    markDataWord(imageCount, j == 0 && literal->target != NULL);
+                }
+                appendWord((int)(uint32_t)(value >> (32 * j)));
+            }
+            addLabel((char *)literal->name, MEMORY_OFFSET + index * 4);
+        }
+    }
+    literalCount = 0;
+    poolNumber++;
+}
+
+// Function to assemble the whole source in one pass: each line is encoded as it
+// is lexed and forward label references are patched once the label is defined.
+// Literal pools are written at .ltorg and at the end of the source, or behind a
+// branch over them before the first load from a pool would be out of range.
+void assembleSequential(Source *source) {
+    Token tokens[MAX_TOKENS];
+    int count;
+    int lineNo = 0;
+    literalCount = 0;
+    poolNumber = 0;
+    while ((count = nextLine(source, tokens, MAX_TOKENS)) >= 0) {
+        if (count == 0) continue;
+        char *token = tokens[0].text;
+
+        if (strchr(token, ':') != NULL) {
+            // It's a label
+            *strchr(token, ':') = '\0'; // Remove the colon
+            addLabel(token, MEMORY_OFFSET + lineNo * 4);
+            continue;
+        }
+        if (isGlobalDirective(token, tokens[0].length)) {
+            if (count < 2) {
+                reportError("Missing label: %s\n", token);
+            } else {
+                markGlobal(tokens[1].text);
+            }
+            continue;
+        }
+        if (isPoolDirective(token, tokens[0].length)) {
+            flushLiterals();
+            lineNo = imageCount;
+            continue;
+        }
+        if (literalCount > 0 && lineNo - poolStart + poolWords + 8 >= LITERAL_RANGE) { // Room for this line and its literal
+            int branch = imageCount;
+            appendWord(0x14000000); // b over the pool
+            flushLiterals();
+            image[branch] |= imageCount - branch;
+            lineNo = imageCount;
+        }
+        appendWord(encodeLine(tokens, count, lineNo));
         lineNo++;
     }
+    flushLiterals();
+    free(literals);
+    literals = NULL;
+    literalCapacity = 0;
+    if (!relocatable) {
+        checkUndefinedLabels();
+    }
+}
 
-    fclose(inputFile);
-    fclose(outputFile);
+// Function to find the first line end (newline or NUL) at or after p
+char *scanLineEnd(Source *source, char *p) {
+    for (;;) {
+        if (p < source->window || p >= source->window + LEXER_WINDOW) {
+            classifyWindow(source, p);
+        }
+        uint64_t stops = source->lineEnds & (~0ULL << (p - source->window));
+        if (stops != 0) {
+            return source->window + __builtin_ctzll(stops);
+        }
+        p = source->window + LEXER_WINDOW;
+    }
+}
+
+// Function to count the instructions of a chunk and record its label
+// definitions (first parallel pass), without writing to the source
+void scanChunk(Chunk *chunk) {
+    Source local = *chunk->source;
+    local.window = NULL;
+    char *end = local.data + chunk->end;
+    char *p = local.data + chunk->start;
+    while (p < end) {
+        p = scanSource(&local, p, 0); // Skip blanks
+        if (*p != '\n' && *p != '\0') {
+            char *start = p;
+            p = scanSource(&local, p, 1);
+            char *colon = memchr(start, ':', p - start);
+            int global = isGlobalDirective(start, p - start);
+            int load = p - start == 3 && memcmp(start, "ldr", 3) == 0;
+            if (isPoolDirective(start, p - start)) {
+                chunk->literals = 1;
+            }
+            if (colon != NULL || global) {
+                if (chunk->labelCount == chunk->labelCapacity) {
+                    chunk->labelCapacity = chunk->labelCapacity ? chunk->labelCapacity * 2 : 64;
+                    chunk->labels = realloc(chunk->labels, chunk->labelCapacity * sizeof(LabelDefinition));
+                    if (chunk->labels == NULL) {
+                        perror("Error allocating labels");
+                        exit(EXIT_FAILURE);
+                    }
+                }
+                if (global) { // The label is the next token
+                    start = p = scanSource(&local, p, 0);
+                    p = scanSource(&local, p, 1);
+                    colon = p;
+                }
+                chunk->labels[chunk->labelCount++] = (LabelDefinition){ start, colon - start, chunk->count, global };
+            } else {
+                chunk->count++;
+            }
+            if (load && memchr(p, '=', scanLineEnd(&local, p) - p) != NULL) {
+                chunk->literals = 1;
+            }
+        }
+        p = scanLineEnd(&local, p);
+        p = p < end ? p + 1 : end;
+    }
+}
+
+// Function to lex and encode the lines in [from, to) of a chunk into the image
+void encodeRange(Source *local, size_t from, size_t to, int *lineNo) {
+    Token tokens[MAX_TOKENS];
+    int count;
+    local->cursor = from;
+    local->size = to;
+    local->window = NULL;
+    while ((count = nextLine(local, tokens, MAX_TOKENS)) >= 0) {
+        if (count == 0 || strchr(tokens[0].text, ':') != NULL || isGlobalDirective(tokens[0].text, tokens[0].length)) {
+            continue; // Labels are already defined and exported
+        }
+        image[*lineNo] = encodeLine(tokens, count, *lineNo);
+        (*lineNo)++;
+    }
 }
-int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <input file> <output file>\n", argv[0]);
+
+// Function to encode a chunk at its offset in the image (second parallel pass)
+// with its trace output buffered. The lexer classifies whole windows and writes
+// NULs into the source, so the lines within a window of the chunk end are lexed
+// from a private copy and never read the next chunk while it is being written.
+void encodeChunk(Chunk *chunk) {
+    errorCount = 0;
+    trace = chunk->traced ? open_memstream(&chunk->traceText, &chunk->traceLength) : NULL;
+    diagnostics = open_memstream(&chunk->diagnosticText, &chunk->diagnosticLength);
+    Source local = *chunk->source;
+    size_t tail = chunk->end > chunk->start + LEXER_WINDOW ? chunk->end - LEXER_WINDOW : chunk->start;
+    while (tail > chunk->start && local.data[tail - 1] != '\n') {
+        tail--; // Back to the start of the line
+    }
+    int lineNo = chunk->base;
+    encodeRange(&local, chunk->start, tail, &lineNo);
+
+    size_t length = chunk->end - tail;
+    char *copy = calloc(length + LEXER_PADDING, 1);
+    if (copy == NULL) {
+        perror("Error allocating chunk");
         exit(EXIT_FAILURE);
     }
+    memcpy(copy, local.data + tail, length);
+    local.data = copy;
+    encodeRange(&local, 0, length, &lineNo);
+    free(copy);
+
+    chunk->errors = errorCount;
+    if (trace != NULL) {
+        fclose(trace);
+        trace = NULL;
+    }
+    fclose(diagnostics);
+    diagnostics = NULL;
+}
+
+// Thread body of a parallel pass: takes chunks in source order and writes out the
+// buffered trace and diagnostics of every finished chunk whose predecessors are done
+void *chunkWorker(void *argument) {
+    ChunkQueue *queue = argument;
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        int i = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+        if (i >= queue->count) {
+            return NULL;
+        }
+        queue->body(&queue->chunks[i]);
+
+        pthread_mutex_lock(&queue->lock);
+        queue->chunks[i].done = 1;
+        while (queue->flushed < queue->count && queue->chunks[queue->flushed].done) {
+            Chunk *chunk = &queue->chunks[queue->flushed++];
+            if (chunk->traceText != NULL) {
+                fwrite(chunk->traceText, 1, chunk->traceLength, queue->trace);
+                free(chunk->traceText);
+                chunk->traceText = NULL;
+            }
+            if (chunk->diagnosticText != NULL) {
+                if (queue->diagnostics != NULL) {
+                    fwrite(chunk->diagnosticText, 1, chunk->diagnosticLength, queue->diagnostics);
+                }
+                free(chunk->diagnosticText);
+                chunk->diagnosticText = NULL;
+            }
+        }
+        pthread_mutex_unlock(&queue->lock);
+    }
+}
 
-    assemble(argv[1], argv[2]);
+// Function to run body on every chunk with up to threads threads
+void runChunks(ChunkQueue *queue, int threads, void (*body)(Chunk *chunk)) {
+    queue->body = body;
+    queue->next = 0;
+    queue->flushed = 0;
+    for (int i = 0; i < queue->count; i++) {
+        queue->chunks[i].done = 0;
+    }
+    if (threads > queue->count) {
+        threads = queue->count;
+    }
+    pthread_t *ids = malloc(threads * sizeof(pthread_t));
+    if (ids == NULL) {
+        perror("Error allocating threads");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&ids[i], NULL, chunkWorker, queue) != 0) {
+            perror("Error creating thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(ids[i], NULL);
+    }
+    free(ids);
+}
+
+// Function to assemble the source on several threads. The source is split into
+// chunks of whole lines; a first pass finds the labels and instruction count of
+// every chunk, so once the labels are in the symbol table each chunk knows its
+// addresses and is encoded independently, straight into its part of the image.
+// Returns 0 without assembling if the source uses literal pools, whose layout
+// depends on every load before them.
+int assembleParallel(Source *source, int threads) {
+    ChunkQueue queue = { .count = source->size / CHUNK_SIZE + 1, .trace = trace, .diagnostics = diagnostics };
+    pthread_mutex_init(&queue.lock, NULL);
+    queue.chunks = calloc(queue.count, sizeof(Chunk));
+    if (queue.chunks == NULL) {
+        perror("Error allocating chunks");
+        exit(EXIT_FAILURE);
+    }
+    size_t start = 0;
+    for (int i = 0; i < queue.count; i++) {
+        size_t end = source->size * (i + 1) / queue.count;
+        char *newline = end < source->size ? memchr(source->data + end, '\n', source->size - end) : NULL;
+        end = newline != NULL ? (size_t)(newline - source->data) + 1 : source->size;
+        if (end < start) {
+            end = start;
+        }
+        queue.chunks[i] = (Chunk){ .source = source, .start = start, .end = end, .traced = trace != NULL };
+        start = end;
+    }
+
+    runChunks(&queue, threads, scanChunk);
+    int literals = 0;
+    for (int i = 0; i < queue.count; i++) {
+        literals |= queue.chunks[i].literals;
+    }
+    if (literals) {
+        for (int i = 0; i < queue.count; i++) {
+            free(queue.chunks[i].labels);
+        }
+        free(queue.chunks);
+        pthread_mutex_destroy(&queue.lock);
+        return 0;
+    }
+
+    // Labels are defined in source order, so the first definition of a name wins
+    char *name = NULL;
+    int nameCapacity = 0;
+    int base = 0;
+    for (int i = 0; i < queue.count; i++) {
+        Chunk *chunk = &queue.chunks[i];
+        chunk->base = base;
+        for (int j = 0; j < chunk->labelCount; j++) {
+            LabelDefinition *label = &chunk->labels[j];
+            if (label->length + 1 > nameCapacity) {
+                nameCapacity = label->length + 1;
+                name = realloc(name, nameCapacity);
+                if (name == NULL) {
+                    perror("Error allocating label");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            memcpy(name, label->name, label->length);
+            name[label->length] = '\0';
+            if (!label->global) {
+                addLabel(name, MEMORY_OFFSET + (base + label->index) * 4);
+            } else if (label->length == 0) {
+                reportError("Missing label: .global\n");
+            } else {
+                markGlobal(name);
+            }
+        }
+        base += chunk->count;
+    }
+    free(name);
+
+    imageCount = imageCapacity = base;
+    image = malloc((base ? base : 1) * sizeof(int));
+    if (image == NULL) {
+        perror("Error allocating image");
+        exit(EXIT_FAILURE);
+    }
+    if (optimize) { // Sized up front, so the encoding threads never grow it
+        dataWords = calloc(base + 1, 1);
+        dataCapacity = base + 1;
+        if (dataWords == NULL) {
+            perror("Error allocating image");
+            exit(EXIT_FAILURE);
+        }
+    }
+    labelsComplete = 1;
+    runChunks(&queue, threads, encodeChunk);
+    labelsComplete = 0;
+
+    for (int i = 0; i < queue.count; i++) {
+        free(queue.chunks[i].labels);
+        errorCount += queue.chunks[i].errors;
+    }
+    free(queue.chunks);
+    pthread_mutex_destroy(&queue.lock);
+    return 1;
+}
+
+// Function to record that an image word is data rather than an instruction, and
+// whether it holds a label address that moves with the label
+void markDataWord(int index, int address) {
+    if (index >= dataCapacity) {
+        int capacity = dataCapacity ? dataCapacity * 2 : 1024;
+        if (capacity <= index) {
+            capacity = index + 1;
+        }
+        dataWords = realloc(dataWords, capacity);
+        if (dataWords == NULL) {
+            perror("Error allocating image");
+            exit(EXIT_FAILURE);
+        }
+        memset(dataWords + dataCapacity, 0, capacity - dataCapacity);
+        dataCapacity = capacity;
+    }
+    dataWords[index] = address ? 2 : 1;
+}
+
+// Function to decode a PC-relative word (b, b.cond or ldr literal), returns 0 if
+// it is none, else sets the image index it refers to and its offset field
+int relativeTarget(int word, int index, int *target, FixupKind *kind) {
+    if ((word & 0x7C000000) == 0x14000000) { // b
+        *kind = FIXUP_IMM26;
+        *target = index + ((int32_t)((uint32_t)word << 6) >> 6);
+        return 1;
+    }
+    if ((word & 0xFF000010) == 0x54000000 || (word & 0x3B000000) == 0x18000000) { // b.cond, ldr literal
+        *kind = FIXUP_IMM19;
+        *target = index + ((int32_t)((uint32_t)word << 8) >> 13);
+        return 1;
+    }
+    return 0;
+}
+
+// Function to check for an instruction without effect: add/sub x, x, #0 and mov x, x.
+// The 32-bit forms clear the upper half of the register and are kept.
+int isNoOp(int word) {
+    int rd = word & 0x1F, rn = (word >> 5) & 0x1F, rm = (word >> 16) & 0x1F;
+    if ((word & 0xBF000000) == (int)0x91000000) { // add/sub immediate, 64-bit, not adds/subs
+        return ((word >> 10) & 0xFFF) == 0 && rd == rn;
+    }
+    if ((word & 0xFF200000) == (int)0xAA000000) { // orr (shifted register), 64-bit
+        return ((word >> 10) & 0x3F) == 0 && rn == 31 && rm == rd;
+    }
     return 0;
-}
\ No newline at end of file
+}
+
+// Function to turn eor/sub rd, rn, rn (the zeroing idiom) into movz rd, #0,
+// returns the word unchanged otherwise
+int zeroingMove(int word) {
+    int rd = word & 0x1F, rn = (word >> 5) & 0x1F, rm = (word >> 16) & 0x1F;
+    int type = word & 0x7F200000;
+    if ((type == 0x4A000000 || type == 0x4B000000) && ((word >> 10) & 0x3F) == 0 && rn == rm && rd != 31) {
+        return (word & 0x80000000) | 0x52800000 | rd;
+    }
+    return word;
+}
+
+// Function to fold a movk into the movz before it when the value still has at
+// most one non-zero halfword, returns 1 and sets merged if it does
+int mergeMoves(int first, int second, int *merged) {
+    if ((first & 0x7F800000) != 0x52800000 || (second & 0x7F800000) != 0x72800000
+        || (first & 0x1F) != (second & 0x1F)) {
+        return 0;
+    }
+    uint64_t value = (uint64_t)((first >> 5) & 0xFFFF) << (16 * ((first >> 21) & 3));
+    int shift = 16 * ((second >> 21) & 3);
+    value = (value & ~(0xFFFFULL << shift)) | (uint64_t)((second >> 5) & 0xFFFF) << shift;
+    if (!(second & 0x80000000)) {
+        value &= 0xFFFFFFFF; // A 32-bit movk clears the upper half
+    }
+    int hw = 0;
+    while (hw < 3 && (value & ~(0xFFFFULL << (16 * hw))) != 0) {
+        hw++;
+    }
+    if ((value & ~(0xFFFFULL << (16 * hw))) != 0) {
+        return 0;
+    }
+    *merged = (second & 0x80000000) | 0x52800000 | hw << 21 | (int)((value >> (16 * hw)) & 0xFFFF) << 5 | (second & 0x1F);
+    return 1;
+}
+
+// Function to check for a flag-setting adds/subs/ands, immediate or shifted register
+int setsFlags(int word) {
+    return (word & 0x3F000000) == 0x31000000 || (word & 0x3F200000) == 0x2B000000 || (word & 0x7F000000) == 0x6A000000;
+}
+
+// Function to check whether second is a compare (cmp/cmn/tst) that sets the same
+// flags as the instruction before it, which computed them from the same operands
+int repeatsFlags(int first, int second) {
+    if (!setsFlags(first) || (second & 0x1F) != 31 || (first & ~0x1F) != (second & ~0x1F)) {
+        return 0;
+    }
+    int rd = first & 0x1F;
+    int registerForm = (first & 0x1F000000) != 0x11000000;
+    return rd == 31 || (((first >> 5) & 0x1F) != rd && (!registerForm || ((first >> 16) & 0x1F) != rd));
+}
+
+// Peephole pass (-O): removes instructions without effect, turns zeroing eor/sub
+// into movz, folds movz+movk pairs that fit one movz and drops compares that
+// repeat the flags of the previous instruction. Only straight-line code is
+// changed: nothing is merged across a label or branch target, and words written
+// by .int or read by ldr literal are kept as they are. The image is compacted,
+// then every branch, ldr literal, label, fixup and literal pool address is moved
+// to the new addresses.
+void optimizeImage(void) {
+    enum { WORD_START = 1, WORD_DATA = 2, WORD_PINNED = 4 };
+    int count = imageCount;
+    unsigned char *kinds = calloc(count + 1, 1);
+    int *newIndex = malloc((count + 1) * sizeof(int));
+    int *oldIndex = malloc((count + 1) * sizeof(int));
+    if (kinds == NULL || newIndex == NULL || oldIndex == NULL) {
+        perror("Error allocating image");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < symbolTable.capacity; i++) {
+        Label *slot = &symbolTable.entries[i];
+        int index = (slot->address - MEMORY_OFFSET) / 4;
+        if (slot->label != NULL && slot->defined && index >= 0 && index <= count) {
+            kinds[index] |= WORD_START;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        int target;
+        FixupKind kind;
+        if (i < dataCapacity && dataWords[i]) {
+            kinds[i] |= WORD_DATA;
+            target = (image[i] - MEMORY_OFFSET) / 4;
+            if (dataWords[i] == 2 && target >= 0 && target <= count) {
+                kinds[target] |= WORD_START; // Reached through the address
+            }
+        } else if (relativeTarget(image[i], i, &target, &kind) && target >= 0 && target <= count) {
+            kinds[target] |= WORD_START;
+            if ((image[i] & 0x3B000000) == 0x18000000) { // Read as data by ldr literal, up to a q register
+                int opc = (image[i] >> 30) & 3;
+                int words = image[i] & 0x04000000 ? 1 << opc : opc == 1 ? 2 : 1;
+                for (int j = target; j < target + words && j < count; j++) {
+                    kinds[j] |= WORD_PINNED;
+                }
+            }
+        }
+    }
+
+    // A branch read as data keeps its value only if nothing between it and its
+    // target moves, so that span is pinned too (newIndex counts the nesting)
+    memset(newIndex, 0, (count + 1) * sizeof(int));
+    for (int i = 0; i < count; i++) {
+        int target;
+        FixupKind kind;
+        if ((kinds[i] & (WORD_PINNED | WORD_DATA)) == WORD_PINNED && relativeTarget(image[i], i, &target, &kind)) {
+            int from = target < i ? target : i, to = target < i ? i : target;
+            newIndex[from < 0 ? 0 : from]++;
+            newIndex[to < count ? to + 1 : count]--;
+        }
+    }
+    for (int i = 0, spans = 0; i < count; i++) {
+        spans += newIndex[i];
+        if (spans > 0) {
+            kinds[i] |= WORD_PINNED;
+        }
+    }
+
+    int kept = 0, removed = 0, rewritten = 0;
+    int rewritable = 0; // The last kept word may still be rewritten
+    for (int i = 0; i < count; i++) {
+        newIndex[i] = kept;
+        int word = image[i];
+        int fixed = kinds[i] & (WORD_DATA | WORD_PINNED);
+        if (!fixed) {
+            if (isNoOp(word)) {
+                TRACE("Removed no-op: 0x%X at address: %d\n", word, i * 4);
+                if (kinds[i] & WORD_START) {
+                    kinds[i + 1] |= WORD_START; // Its branch target is now the next word
+                }
+                removed++;
+                continue;
+            }
+            int zeroing = zeroingMove(word);
+            if (zeroing != word) {
+                TRACE("Replaced zeroing: 0x%X with: 0x%X at address: %d\n", word, zeroing, i * 4);
+                word = zeroing;
+                rewritten++;
+            }
+            if (rewritable && !(kinds[i] & WORD_START)) {
+                int merged;
+                if (mergeMoves(image[kept - 1], word, &merged)) {
+                    TRACE("Merged move: 0x%X into: 0x%X at address: %d\n", word, merged, i * 4);
+                    image[kept - 1] = merged;
+                    removed++;
+                    continue;
+                }
+                if (repeatsFlags(image[kept - 1], word)) {
+                    TRACE("Removed repeated compare: 0x%X at address: %d\n", word, i * 4);
+                    removed++;
+                    continue;
+                }
+            }
+        }
+        image[kept] = word;
+        oldIndex[kept++] = i;
+        rewritable = !fixed;
+    }
+    newIndex[count] = kept;
+
+    // Branches keep their targets, which only come closer
+    for (int i = 0; i < kept && removed > 0; i++) {
+        int target;
+        FixupKind kind;
+        if (!(kinds[oldIndex[i]] & WORD_DATA) && relativeTarget(image[i], oldIndex[i], &target, &kind)
+            && target >= 0 && target <= count) {
+            int offset = newIndex[target] - i;
+            if (kind == FIXUP_IMM26) {
+                image[i] = (image[i] & ~0x3FFFFFF) | (offset & 0x3FFFFFF);
+            } else {
+                image[i] = (image[i] & ~(0x7FFFF << 5)) | ((offset & 0x7FFFF) << 5);
+            }
+        } else if (oldIndex[i] < dataCapacity && dataWords[oldIndex[i]] == 2) {
+            int target = (image[i] - MEMORY_OFFSET) / 4;
+            if (target >= 0 && target <= count) {
+                image[i] = MEMORY_OFFSET + newIndex[target] * 4;
+            }
+        }
+    }
+    for (size_t i = 0; i < symbolTable.capacity && removed > 0; i++) {
+        Label *slot = &symbolTable.entries[i];
+        if (slot->label == NULL) continue;
+        int index = (slot->address - MEMORY_OFFSET) / 4;
+        if (slot->defined && index >= 0 && index <= count) {
+            slot->address = MEMORY_OFFSET + newIndex[index] * 4;
+        }
+        for (Fixup *fixup = slot->fixups; fixup != NULL; fixup = fixup->next) {
+            fixup->index = newIndex[fixup->index];
+        }
+    }
+    imageCount = kept;
+    if (diagnostics != NULL) {
+        fprintf(diagnostics, "Optimized: removed %d of %d instructions, rewrote %d\n", removed, count, rewritten);
+    }
+    free(kinds);
+    free(newIndex);
+    free(oldIndex);
+}
+
+// Function to assemble a source on threads threads, leaving the image in image
+// and the labels in the symbol table. Returns the number of errors.
+int assembleSource(Source *source, int threads) {
+    errorCount = 0;
+    initMnemonicTable();
+    // Objects are the unit of parallelism when linking
+    if (threads <= 1 || relocatable || !assembleParallel(source, threads)) {
+        assembleSequential(source);
+    }
+    if (optimize && errorCount == 0) {
+        optimizeImage();
+    }
+    free(dataWords);
+    dataWords = NULL;
+    dataCapacity = 0;
+    return errorCount;
+}
+
+// Function to order symbols by address, then name
+int compareSymbols(const void *a, const void *b) {
+    const AssemblySymbol *x = a, *y = b;
+    if (x->address != y->address) {
+        return x->address < y->address ? -1 : 1;
+    }
+    return strcmp(x->name, y->name);
+}
+
+// Function to move the result of assembleSource into an Assembly and reset the
+// assembler for the next source
+void finishAssembly(Assembly *assembly, int errors) {
+    assembly->errors = errors;
+    if (errors == 0) {
+        assembly->image = (uint32_t *)image;
+        assembly->size = imageCount * sizeof(uint32_t);
+        image = NULL;
+        assembly->symbols = malloc((symbolTable.count ? symbolTable.count : 1) * sizeof(AssemblySymbol));
+        if (assembly->symbols == NULL) {
+            perror("Error allocating symbols");
+            exit(EXIT_FAILURE);
+        }
+        size_t relocationCount = 0;
+        for (size_t i = 0; i < symbolTable.capacity; i++) {
+            Label *slot = &symbolTable.entries[i];
+            if (slot->label == NULL) continue;
+            if (slot->label[0] == '=') continue; // Literal pool entry
+            // An object lists only what the linker needs, its exports and the labels it references
+            int listed = relocatable ? (slot->defined ? slot->global : slot->fixups != NULL) : slot->defined;
+            if (!listed) continue;
+            char *name = strdup(slot->label);
+            if (name == NULL) {
+                perror("Error allocating symbols");
+                exit(EXIT_FAILURE);
+            }
+            int flags = (slot->global ? ASSEMBLY_SYMBOL_GLOBAL : 0) | (slot->defined ? 0 : ASSEMBLY_SYMBOL_UNDEFINED);
+            assembly->symbols[assembly->symbol_count++] = (AssemblySymbol){ name, slot->defined ? slot->address : 0, flags };
+            for (Fixup *fixup = slot->fixups; fixup != NULL; fixup = fixup->next) {
+                relocationCount++;
+            }
+        }
+        qsort(assembly->symbols, assembly->symbol_count, sizeof(AssemblySymbol), compareSymbols);
+
+        // The fixups still waiting on undefined labels become relocations
+        assembly->relocations = malloc((relocationCount ? relocationCount : 1) * sizeof(AssemblyRelocation));
+        if (assembly->relocations == NULL) {
+            perror("Error allocating relocations");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < assembly->symbol_count && relocationCount > 0; i++) {
+            if (!(assembly->symbols[i].flags & ASSEMBLY_SYMBOL_UNDEFINED)) continue;
+            Label *slot = findSlot(&symbolTable, assembly->symbols[i].name, hashLabel(assembly->symbols[i].name));
+            for (Fixup *fixup = slot->fixups; fixup != NULL; fixup = fixup->next) {
+                int bits = fixup->kind == FIXUP_IMM26 ? 26 : 19;
+                assembly->relocations[assembly->relocation_count++] = (AssemblyRelocation){ fixup->index, bits, i };
+            }
+        }
+    }
+    free(image);
+    image = NULL;
+    imageCount = imageCapacity = 0;
+    freeSymbolTable();
+}
+
+// Function to assemble a source that is already open, with diagnostics collected
+// into the Assembly
+int assembleOpenSource(Source *source, int threads, FILE *traceOutput, Assembly *assembly) {
+    size_t diagnosticLength;
+    trace = traceOutput;
+    diagnostics = open_memstream(&assembly->diagnostics, &diagnosticLength);
+    if (diagnostics == NULL) {
+        perror("Error allocating diagnostics");
+        exit(EXIT_FAILURE);
+    }
+    int errors = assembleSource(source, threads);
+    closeSource(source);
+    if (trace != NULL) {
+        fflush(trace);
+    }
+    fclose(diagnostics);
+    diagnostics = NULL;
+    trace = NULL;
+    finishAssembly(assembly, errors);
+    return errors == 0;
+}
+
+int assemble_source(const char *text, size_t length, int threads, FILE *traceOutput, Assembly *assembly) {
+    *assembly = (Assembly){ 0 };
+    Source source = { 0 };
+    source.data = malloc(length + LEXER_PADDING);
+    if (source.data == NULL) {
+        perror("Error allocating source");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(source.data, text, length);
+    memset(source.data + length, 0, LEXER_PADDING);
+    source.size = length;
+    return assembleOpenSource(&source, threads, traceOutput, assembly);
+}
+
+int assemble_file(const char *filename, int threads, FILE *traceOutput, Assembly *assembly) {
+    *assembly = (Assembly){ 0 };
+    Source source;
+    if (!openSource(filename, &source)) {
+        char *message;
+        size_t length;
+        FILE *stream = open_memstream(&message, &length);
+        if (stream == NULL) {
+            perror("Error allocating diagnostics");
+            exit(EXIT_FAILURE);
+        }
+        fprintf(stream, "Error opening input file %s: %s\n", filename, strerror(errno));
+        fclose(stream);
+        assembly->diagnostics = message;
+        assembly->errors = 1;
+        return 0;
+    }
+    return assembleOpenSource(&source, threads, traceOutput, assembly);
+}
+
+void assembly_free(Assembly *assembly) {
+    free(assembly->image);
+    for (size_t i = 0; i < assembly->symbol_count; i++) {
+        free(assembly->symbols[i].name);
+    }
+    free(assembly->symbols);
+    free(assembly->relocations);
+    free(assembly->diagnostics);
+    *assembly = (Assembly){ 0 };
+}
+
+void assemble_set_optimize(int enabled) {
+    optimize = enabled;
+}
+
+int assemble_object(const char *filename, FILE *traceOutput, Assembly *assembly) {
+    relocatable = 1;
+    int assembled = assemble_file(filename, 1, traceOutput, assembly);
+    relocatable = 0;
+    return assembled;
+}
+
+// Function to find the length of the common prefix of two buffers of at least limit bytes
+size_t commonPrefix(const char *a, const char *b, size_t limit) {
+    size_t n = 0;
+    while (n + COMPARE_BLOCK <= limit && memcmp(a + n, b + n, COMPARE_BLOCK) == 0) {
+        n += COMPARE_BLOCK;
+    }
+    while (n < limit && a[n] == b[n]) {
+        n++;
+    }
+    return n;
+}
+
+// Function to find the length of the common suffix of two buffers, at most limit bytes
+size_t commonSuffix(const char *a, size_t aLength, const char *b, size_t bLength, size_t limit) {
+    size_t n = 0;
+    while (n + COMPARE_BLOCK <= limit && memcmp(a + aLength - n - COMPARE_BLOCK, b + bLength - n - COMPARE_BLOCK, COMPARE_BLOCK) == 0) {
+        n += COMPARE_BLOCK;
+    }
+    while (n < limit && a[aLength - n - 1] == b[bLength - n - 1]) {
+        n++;
+    }
+    return n;
+}
+
+// Function to find the last line starting at or before offset, or with after set
+// the first line starting after offset (lineCount if there is none)
+int findLine(Watch *watch, size_t offset, int after) {
+    int low = 0, high = watch->lineCount; // Lines before low start at or before offset, lines from high after it
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (watch->lines[middle].start <= offset) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return after ? low : (low > 0 ? low - 1 : 0);
+}
+
+// Function to find the first token of the line [p, end) without writing to it,
+// NULL if the line is blank. Delimiters are the lexer's: blanks, controls and commas.
+char *firstToken(char *p, char *end, int *length) {
+    while (p < end && ((unsigned char)*p <= ' ' || *p == ',')) {
+        p++;
+    }
+    char *start = p;
+    while (p < end && (unsigned char)*p > ' ' && *p != ',') {
+        p++;
+    }
+    *length = p - start;
+    return p > start ? start : NULL;
+}
+
+// Function to widen the range of image words the output file is missing
+void markDirty(Watch *watch, int from, int to) {
+    if (from >= to) {
+        return;
+    }
+    if (watch->dirtyFrom >= watch->dirtyTo) {
+        watch->dirtyFrom = from;
+        watch->dirtyTo = to;
+    } else {
+        watch->dirtyFrom = from < watch->dirtyFrom ? from : watch->dirtyFrom;
+        watch->dirtyTo = to > watch->dirtyTo ? to : watch->dirtyTo;
+    }
+}
+
+// Function to drop everything watch mode keeps, so the next update assembles from scratch
+void resetWatch(Watch *watch) {
+    if (watch->text.data != NULL) {
+        closeSource(&watch->text);
+    }
+    free(watch->lines);
+    free(watch->references);
+    free(image);
+    image = NULL;
+    imageCount = imageCapacity = 0;
+    freeSymbolTable();
+    *watch = (Watch){ .dirtyFrom = 0, .dirtyTo = 0 };
+}
+
+// Function to bring the resident assembly up to date with a new version of the
+// source, taking ownership of it. Only the lines between the unchanged prefix and
+// suffix are lexed and encoded; the later lines keep their encodings and move
+// with their labels, and references are re-resolved only if a label moved.
+// Returns the number of errors and sets encoded to the instructions encoded.
+int updateWatch(Watch *watch, Source *source, int *encoded) {
+    errorCount = 0;
+    Source old = watch->text;
+    size_t shorter = old.size < source->size ? old.size : source->size;
+    size_t prefix = commonPrefix(old.data, source->data, shorter);
+    if (prefix == old.size && prefix == source->size && watch->lineCount > 0) {
+        closeSource(source); // Touched but not changed
+        *encoded = 0;
+        return watch->failed;
+    }
+
+    // Old lines [first, last) are replaced by the new lines in [start, end)
+    int first = findLine(watch, prefix, 0);
+    size_t start = first < watch->lineCount ? watch->lines[first].start : 0;
+    size_t suffix = commonSuffix(old.data, old.size, source->data, source->size, shorter - start);
+    int last = findLine(watch, old.size - suffix, 1); // Its newline is unchanged too
+    if (last <= first && first < watch->lineCount) {
+        last = first + 1;
+    }
+    if (last > watch->lineCount) {
+        last = watch->lineCount;
+    }
+    size_t oldEnd = last < watch->lineCount ? watch->lines[last].start : old.size;
+    size_t end = source->size - (old.size - oldEnd);
+    int base = first < watch->lineCount ? watch->lines[first].before : imageCount;
+    int oldCount = (last < watch->lineCount ? watch->lines[last].before : imageCount) - base;
+
+    // Lines and labels of the changed region, without writing to the source
+    int capacity = 64, count = 0, instructions = 0;
+    WatchLine *added = malloc(capacity * sizeof(WatchLine));
+    int *labelLengths = malloc(capacity * sizeof(int));
+    if (added == NULL || labelLengths == NULL) {
+        perror("Error allocating lines");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t p = start; p < end; ) {
+        char *lineEnd = memchr(source->data + p, '\n', end - p);
+        size_t next = lineEnd != NULL ? (size_t)(lineEnd - source->data) + 1 : end;
+        int length;
+        char *token = firstToken(source->data + p, source->data + next, &length);
+        char *colon = token != NULL ? memchr(token, ':', length) : NULL;
+        if (count == capacity) {
+            capacity *= 2;
+            added = realloc(added, capacity * sizeof(WatchLine));
+            labelLengths = realloc(labelLengths, capacity * sizeof(int));
+            if (added == NULL || labelLengths == NULL) {
+                perror("Error allocating lines");
+                exit(EXIT_FAILURE);
+            }
+        }
+        added[count] = (WatchLine){ p, base + instructions, colon != NULL ? token : NULL };
+        labelLengths[count++] = colon != NULL ? colon - token : 0;
+        if (token != NULL && colon == NULL && !isGlobalDirective(token, length) && !isPoolDirective(token, length)) {
+            instructions++;
+        }
+        p = next;
+    }
+    int delta = instructions - oldCount;
+
+    // Labels defined in the replaced lines go away. A label with several
+    // definitions cannot be patched locally, the winning one is not known.
+    int fromScratch = watch->lineCount == 0;
+    int rebuild = 0;
+    int labelsMoved = 0;
+    for (int i = first; i < last; i++) {
+        if (watch->lines[i].label == NULL) continue;
+        Label *slot = findSlot(&symbolTable, watch->lines[i].label, hashLabel(watch->lines[i].label));
+        if (slot->definitions > 1) {
+            rebuild = 1;
+        }
+        slot->definitions--;
+        slot->defined = 0;
+        labelsMoved = 1;
+    }
+
+    // Later lines keep their encodings and labels, moved by the size change
+    ptrdiff_t shift = (ptrdiff_t)source->size - (ptrdiff_t)old.size;
+    for (int i = last; i < watch->lineCount; i++) {
+        WatchLine *line = &watch->lines[i];
+        line->start += shift;
+        line->before += delta;
+        if (line->label != NULL && delta != 0) {
+            Label *slot = findSlot(&symbolTable, line->label, hashLabel(line->label));
+            if (slot->definitions > 1) {
+                rebuild = 1;
+            }
+            slot->address += delta * 4;
+            labelsMoved = 1;
+        }
+    }
+
+    // Labels of the changed region; a name defined again would make the first definition ambiguous
+    for (int i = 0; i < count && !rebuild; i++) {
+        if (added[i].label == NULL) continue;
+        char *name = arenaAlloc(&labelArena, labelLengths[i] + 1);
+        memcpy(name, added[i].label, labelLengths[i]);
+        name[labelLengths[i]] = '\0';
+        Label *slot = internLabel(name);
+        added[i].label = slot->label;
+        labelsMoved = 1;
+        if (slot->definitions++ > 0) {
+            if (!fromScratch) {
+                rebuild = 1;
+            } else {
+                reportError("Duplicate label: %s\n", name);
+                watch->duplicateLabels++;
+            }
+            continue;
+        }
+        slot->defined = 1;
+        slot->address = MEMORY_OFFSET + added[i].before * 4;
+    }
+    free(labelLengths);
+    if (rebuild) {
+        free(added);
+        resetWatch(watch);
+        return updateWatch(watch, source, encoded);
+    }
+
+    // Splice the new lines in
+    int lineCount = watch->lineCount + count - (last - first);
+    if (lineCount > watch->lineCapacity) {
+        watch->lineCapacity = lineCount * 2;
+        watch->lines = realloc(watch->lines, watch->lineCapacity * sizeof(WatchLine));
+        if (watch->lines == NULL) {
+            perror("Error allocating lines");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memmove(&watch->lines[first + count], &watch->lines[last], (watch->lineCount - last) * sizeof(WatchLine));
+    memcpy(&watch->lines[first], added, count * sizeof(WatchLine));
+    watch->lineCount = lineCount;
+    free(added);
+
+    // Make room in the image and move the later words
+    int newImageCount = imageCount + delta;
+    if (newImageCount > watch->referenceCapacity) {
+        watch->referenceCapacity = newImageCount * 2;
+        imageCapacity = watch->referenceCapacity;
+        image = realloc(image, imageCapacity * sizeof(int));
+        watch->references = realloc(watch->references, watch->referenceCapacity * sizeof(Reference));
+        if (image == NULL || watch->references == NULL) {
+            perror("Error allocating image");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = base; i < base + oldCount; i++) {
+        watch->failedWords -= watch->references[i].failed;
+    }
+    int tail = imageCount - base - oldCount;
+    memmove(&image[base + instructions], &image[base + oldCount], tail * sizeof(int));
+    memmove(&watch->references[base + instructions], &watch->references[base + oldCount], tail * sizeof(Reference));
+    imageCount = newImageCount;
+
+    // Encode the changed region from a copy, so the source stays as it was read
+    char *copy = calloc(end - start + LEXER_PADDING, 1);
+    if (copy == NULL) {
+        perror("Error allocating source");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(copy, source->data + start, end - start);
+    Source local = { .data = copy, .size = end - start };
+    Token tokens[MAX_TOKENS];
+    int tokenCount;
+    int lineNo = base;
+    int encodeErrors = 0;
+    labelsComplete = 1;
+    while ((tokenCount = nextLine(&local, tokens, MAX_TOKENS)) >= 0) {
+        if (tokenCount == 0 || strchr(tokens[0].text, ':') != NULL || isGlobalDirective(tokens[0].text, tokens[0].length)
+            || isPoolDirective(tokens[0].text, tokens[0].length)) {
+            continue; // No pools are written, pool literals are rejected
+        }
+        Reference *reference = &watch->references[lineNo];
+        *reference = (Reference){ NULL, 0, FIXUP_IMM26, 0 };
+        int errorsBefore = errorCount;
+        currentReference = reference;
+        image[lineNo] = encodeLine(tokens, tokenCount, lineNo);
+        currentReference = NULL;
+        reference->failed = errorCount != errorsBefore;
+        encodeErrors += reference->failed;
+        lineNo++;
+    }
+    labelsComplete = 0;
+    free(copy);
+    watch->failedWords += encodeErrors;
+    markDirty(watch, base, delta != 0 ? imageCount : base + instructions);
+
+    // Labels are resolved once all of them are known. Outside the changed region
+    // only references that may have moved relative to their label need patching.
+    int resolveAll = labelsMoved || delta != 0 || watch->failed;
+    int from = resolveAll ? 0 : base;
+    int to = resolveAll ? imageCount : base + instructions;
+    for (int i = from; i < to; i++) {
+        Reference *reference = &watch->references[i];
+        if (reference->label == NULL) continue;
+        Label *slot = findSlot(&symbolTable, reference->label, reference->hash);
+        if (!slot->defined) {
+            reportError("Undefined label: %s\n", reference->label);
+            continue;
+        }
+        int word = image[i];
+        patchOffset(i, slot->address, reference->kind, reference->label);
+        if (image[i] != word) {
+            markDirty(watch, i, i + 1);
+        }
+    }
+
+    if (old.data != NULL) {
+        closeSource(&old);
+    }
+    watch->text = *source;
+    // Lines outside the changed region that failed to encode still fail, and a
+    // duplicate label found by the last full reassembly is still there
+    int errors = errorCount + watch->failedWords - encodeErrors + (fromScratch ? 0 : watch->duplicateLabels);
+    watch->failed = errors != 0;
+    *encoded = instructions;
+    return errors;
+}
+
+// Function to write the image words changed since the last write to the output
+// file and truncate it to the image size, returns 0 on failure
+int writeWatchOutput(Watch *watch, const char *outputFileName) {
+    int fd = open(outputFileName, O_WRONLY | O_CREAT, 0644);
+    if (fd < 0) {
+        return 0;
+    }
+    const char *p = (const char *)&image[watch->dirtyFrom];
+    size_t length = watch->dirtyFrom < watch->dirtyTo ? (watch->dirtyTo - watch->dirtyFrom) * sizeof(int) : 0;
+    off_t offset = watch->dirtyFrom * sizeof(int);
+    while (length > 0) {
+        ssize_t written = pwrite(fd, p, length, offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            close(fd);
+            return 0;
+        }
+        p += written;
+        offset += written;
+        length -= written;
+    }
+    if (ftruncate(fd, imageCount * sizeof(int)) != 0 || close(fd) != 0) {
+        return 0;
+    }
+    watch->dirtyFrom = watch->dirtyTo = 0;
+    return 1;
+}
+
+int assemble_watch(const char *input, const char *output) {
+    Watch watch = { 0 };
+    struct stat last = { 0 };
+    initMnemonicTable();
+    diagnostics = stderr;
+    optimize = 0; // Patching in place needs every line at a fixed address
+    for (;; nanosleep(&(struct timespec){ 0, WATCH_INTERVAL_MS * 1000000L }, NULL)) {
+        struct stat info;
+        if (stat(input, &info) != 0 || (info.st_mtim.tv_sec == last.st_mtim.tv_sec && info.st_mtim.tv_nsec == last.st_mtim.tv_nsec
+                                        && info.st_size == last.st_size && info.st_ino == last.st_ino)) {
+            continue;
+        }
+        struct timespec begin, done;
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+
+        // Read rather than mapped: editors that write in place would change
+        // a mapping under the comparison with the previous version
+        Source source;
+        int fd = open(input, O_RDONLY);
+        int ok = fd >= 0 && readSource(fd, &source);
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (!ok) { // Replaced while being saved, tried again on the next poll
+            continue;
+        }
+        last = info;
+
+        int encoded;
+        int errors = updateWatch(&watch, &source, &encoded);
+        if (errors == 0 && !writeWatchOutput(&watch, output)) {
+            perror("Error writing output file");
+            return 0;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &done);
+        double milliseconds = (done.tv_sec - begin.tv_sec) * 1e3 + (done.tv_nsec - begin.tv_nsec) / 1e6;
+        if (errors == 0) {
+            printf("Assembled %s: %d instructions, %d encoded in %.3f ms\n", input, imageCount, encoded, milliseconds);
+        } else {
+            printf("%s has %d errors, %s not updated\n", input, errors, output);
+        }
+        fflush(stdout);
+    }
+}
@@ -1,29 +1,303 @@
-#define MAX_LABELS 1024
-#define MAX_LINE_LENGTH 256
-#define MEMORY_OFFSET 0
-
-typedef struct {
-    char label[MAX_LINE_LENGTH];
-    int address;
-} Label;
-
-typedef struct {
-    char instruction[MAX_LINE_LENGTH];
-    int address;
-} Instruction;
-
-void addLabel(char *label, int address);
-int labelExists(const char *label);
-int getLabelAddress(char *label);
-void addInstruction(char *line, int address);
-int parseOperand(char *operand, int *sf);
-int arithmeticInstructions(char *mnemonic, char *rd, char *rn, char *operand, char *remainder);
-int logicalInstructions(char *mnemonic, char *rd, char *rn, char *operand, char *remainder);
-int multiplicationInstructions(char *mnemonic, char *rd, char *rn, char *rm, char *ra);
-int movInstructions(char *mnemonic, char *rd, char *operand, char *remainder);
-void parseAddressingMode(char *input, int *reg, int *offset, int *preIndex, int *sf, int registerOn);
-int singleDataTransfer(char *mnemonic, char *rt, char *rn, char *remainder, int lineNo);
-int encodeBranchInstruction(char *mnemonic, char *address, int lineNo);
-int encodeDirective(char *directive, char *value);
-int processLine(char *line, int address);
-void assemble(char *inputFileName, char *outputFileName);
\ No newline at end of file
+#define MAX_TOKENS 16    // Mnemonic and operands per line
+#define LEXER_WINDOW 64  // Bytes classified at once by the lexer
+#define LEXER_PADDING 64 // Zero bytes after the source, at least one window
+#define MEMORY_OFFSET 0
+
+#define ARENA_BLOCK_SIZE 65536
+#define CHUNK_SIZE (256 * 1024) // Source bytes per chunk of a parallel assembly
+#define WATCH_INTERVAL_MS 50     // How often --watch checks the source for changes
+#define COMPARE_BLOCK 4096       // Bytes compared at once when diffing sources
+#define LITERAL_RANGE (1 << 18)  // Words an ldr literal reaches forward
+
+#define TRACE(...) do { if (trace) fprintf(trace, __VA_ARGS__); } while (0)
+
+#define MNEMONIC_HASH_BITS 9    // The mnemonic hash indexes 1 << MNEMONIC_HASH_BITS slots
+#define MNEMONIC_HASH_SEED 55302u // First seed that hashes every mnemonic to its own slot
+
+// Mnemonic flags: aliases supply a zero register, invert their condition or
+// narrow the access; branches are to a register or conditional
+#define MNEMONIC_ZR_RD 0x01      // cmp, cmn, tst: Rd is the zero register
+#define MNEMONIC_ZR_RN 0x02      // neg, negs, mov, mvn, cset, csetm: Rn is the zero register
+#define MNEMONIC_ZR_RA 0x04      // mul, mneg: Ra is the zero register
+#define MNEMONIC_INVERT 0x08     // cset, csetm, cinc, cinv, cneg: select on the inverted condition
+#define MNEMONIC_BYTE 0x10       // ldrb, strb, sxtb, uxtb
+#define MNEMONIC_HALF 0x20       // ldrh, strh, sxth, uxth
+#define MNEMONIC_REGISTER 0x40   // br
+#define MNEMONIC_CONDITIONAL 0x80 // b.<cond>, opc is the condition code
+
+// Source text for the lexer, followed by at least LEXER_PADDING zero bytes
+typedef struct {
+    char *data;
+    size_t size;
+    size_t mappedSize; // Length of the mapping, 0 if data was read into a buffer
+    size_t cursor;     // Start of the next line
+    char *window;      // Bytes classified by the last classifyWindow()
+    uint64_t delimiters; // Bit i set when window[i] ends a token
+    uint64_t lineEnds;   // Bit i set when window[i] ends the line
+} Source;
+
+// Slice of the source text, NUL-terminated in place by the lexer
+typedef struct {
+    char *text;
+    int length;
+} Token;
+
+// Bump allocator: blocks are chained and only freed all at once
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size;
+    char data[];
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock *block;
+    size_t used; // Bytes used in the current block
+} Arena;
+
+typedef struct {
+    const char *label;    // Interned in the label arena, NULL for an empty slot
+    unsigned int hash;
+    int address;
+    int defined;          // 0 while the label is only referenced
+    int definitions;      // Lines defining the label, kept in watch mode only
+    struct Fixup *fixups; // Pending fixups, NULL if none
+    int global;           // Exported with .global
+} Label;
+
+// Open-addressing hash table with linear probing, capacity is a power of two
+typedef struct {
+    Label *entries;
+    size_t capacity;
+    size_t count;
+} SymbolTable;
+
+// Fields patched by a fixup: imm26 for b, imm19 for b.cond and ldr literal, or
+// a whole literal pool word holding the label's address
+typedef enum {
+    FIXUP_IMM26,
+    FIXUP_IMM19,
+    FIXUP_ADDRESS
+} FixupKind;
+
+// Reference to a label that was not defined yet when the instruction was encoded,
+// allocated in the label arena
+typedef struct Fixup {
+    int index;          // Instruction index in the image
+    FixupKind kind;
+    struct Fixup *next; // Next fixup waiting on the same label, NULL at the end
+} Fixup;
+
+// Label reference of an image word, kept in watch mode to re-resolve it when
+// the label moves
+typedef struct {
+    const char *label; // Interned in the label arena, NULL if the word references no label
+    unsigned int hash;
+    FixupKind kind;
+    int failed;     // The line did not encode
+} Reference;
+
+// Source line as last assembled in watch mode
+typedef struct {
+    size_t start;      // Offset of the line in the source
+    int before;        // Instructions before the line, its image index if it has one
+    const char *label; // Interned label defined on the line, NULL if none
+} WatchLine;
+
+// Everything watch mode keeps resident between reassemblies; the image itself
+// is in image
+typedef struct {
+    Source text;           // Source as last assembled, never written by the lexer
+    WatchLine *lines;
+    int lineCount;
+    int lineCapacity;
+    Reference *references; // One per image word
+    int referenceCapacity;
+    int dirtyFrom;         // Image words not written to the output yet
+    int dirtyTo;
+    int failedWords;       // Image words whose line did not encode
+    int duplicateLabels;   // Labels defined again, counted by a full reassembly
+    int failed;            // The last reassembly had errors
+} Watch;
+
+// Constant or label address loaded by ldr =, waiting for the next literal pool
+typedef struct {
+    const char *name;   // Pool label the loads reference, interned
+    const char *target; // Label whose address is loaded, NULL for a constant
+    uint64_t value;
+    int words;          // 2 for an x register, 1 for a w register
+} Literal;
+
+// Label definition or export found by the first parallel pass, name is not NUL-terminated
+typedef struct {
+    char *name;
+    int length;
+    int index;  // Instruction index within the chunk
+    int global; // A .global directive rather than a definition
+} LabelDefinition;
+
+// Whole lines of the source, assembled by one thread
+typedef struct {
+    Source *source;
+    size_t start;       // Byte range of the chunk in the source
+    size_t end;
+    int base;           // Image index of the first instruction of the chunk
+    int count;          // Instructions in the chunk
+    LabelDefinition *labels;
+    int labelCount;
+    int labelCapacity;
+    int literals;       // Uses ldr = or .ltorg, so the source is assembled on one thread
+    int traced;         // Buffer trace output in traceText
+    char *traceText;
+    size_t traceLength;
+    char *diagnosticText;
+    size_t diagnosticLength;
+    int errors;
+    int done;
+} Chunk;
+
+// Chunks of a parallel pass, handed out and their trace output written in order
+typedef struct {
+    Chunk *chunks;
+    int count;
+    int next;           // First chunk not taken by a thread yet
+    int flushed;        // Chunks whose trace output has been written
+    pthread_mutex_t lock;
+    FILE *trace;
+    FILE *diagnostics;
+    void (*body)(Chunk *chunk);
+} ChunkQueue;
+
+// Encoder a mnemonic is dispatched to
+typedef enum {
+    ENC_ARITHMETIC,
+    ENC_LOGICAL,
+    ENC_MULTIPLY,
+    ENC_MOVE,
+    ENC_TRANSFER,
+    ENC_PAIR,
+    ENC_SELECT,
+    ENC_BITFIELD,
+    ENC_EXCLUSIVE,
+    ENC_SYSTEM,
+    ENC_BRANCH,
+    ENC_SIMD,
+    ENC_DIRECTIVE
+} EncoderKind;
+
+// Variants of the bitfield, system and AdvSIMD encoders, kept in the N field
+// of bitfield descriptors and the opc field of the others
+enum {
+    BITFIELD_MOVE,        // sbfm, ubfm rd, rn, #immr, #imms
+    BITFIELD_LSL,         // lsl rd, rn, #shift
+    BITFIELD_SHIFT_RIGHT, // lsr, asr rd, rn, #shift
+    BITFIELD_EXTRACT,     // sbfx, ubfx rd, rn, #lsb, #width
+    BITFIELD_INSERT,      // sbfiz, ubfiz rd, rn, #lsb, #width
+    BITFIELD_EXTEND       // sxtb, uxth, ...: the width is in the flags
+};
+enum {
+    SYSTEM_BARRIER,       // dmb <option>
+    SYSTEM_REGISTER       // mrs rt, <sysreg>
+};
+enum {
+    SIMD_STRUCTURE,       // ld1, st1 {vt.T}, [xn], N is L
+    SIMD_DUP,             // dup vd.T, rn
+    SIMD_UMOV,            // umov rd, vn.T[index]
+    SIMD_ADDV             // addv <b|h|s>d, vn.T
+};
+
+// Everything the encoders need to know about a mnemonic: opc and N are the
+// encoder's opcode fields (L and o0 for loads and stores, op and op2 for
+// conditional selects, opc for bitfield moves) or its variant, and vector is
+// the three-register AdvSIMD encoding of a mnemonic that also takes vector
+// operands (add v0.4s, v1.4s, v2.4s)
+typedef struct {
+    const char *name;
+    EncoderKind encoder;
+    int opc;
+    int N;
+    int flags;
+    int vector;
+} Mnemonic;
+
+void *arenaAlloc(Arena *arena, size_t size);
+char *arenaStrdup(Arena *arena, const char *string);
+void arenaFree(Arena *arena);
+unsigned int hashLabel(const char *label);
+Label *findSlot(SymbolTable *table, const char *label, unsigned int hash);
+void growSymbolTable(SymbolTable *table);
+Label *internLabel(const char *label);
+void addLabel(char *label, int address);
+int isGlobalDirective(const char *token, int length);
+void markGlobal(const char *label);
+int findLabel(const char *label, int *address);
+int isLabelOperand(const char *operand);
+void reportError(const char *format, ...);
+int checkOffsetRange(int offset, FixupKind kind, const char *label);
+void patchOffset(int index, int target, FixupKind kind, const char *label);
+void addFixup(Label *slot, int index, FixupKind kind);
+int labelOffset(char *label, int lineNo, FixupKind kind);
+int checkUndefinedLabels(void);
+void freeSymbolTable(void);
+void classifyBytes(const char *p, unsigned int *delimiters, unsigned int *lineEnds);
+int readSource(int fd, Source *source);
+int openSource(const char *fileName, Source *source);
+void closeSource(Source *source);
+void classifyWindow(Source *source, char *p);
+char *scanSource(Source *source, char *p, int delimiter);
+int nextLine(Source *source, Token *tokens, int maxTokens);
+unsigned int hashMnemonic(const char *text, int length, unsigned int seed);
+void initMnemonicTable(void);
+const Mnemonic *findMnemonic(const char *text, int length);
+int parseRegisterNumber(const char *digits);
+int parseOperand(char *operand, int *sf);
+int arithmeticInstructions(const Mnemonic *m, char *rd, char *rn, char *operand, char *shift, char *amount);
+int logicalInstructions(const Mnemonic *m, char *rd, char *rn, char *operand, char *shift, char *amount);
+int multiplicationInstructions(const Mnemonic *m, char *rd, char *rn, char *rm, char *ra);
+int movInstructions(const Mnemonic *m, char *rd, char *operand, char *shift, char *amount);
+int parseBaseRegister(char *operand);
+int singleMove(uint64_t value, int sf, int rd);
+int literalLoad(int sf, int rt, char *operand, int lineNo);
+int singleDataTransfer(const Mnemonic *m, char *rt, char *rn, char *remainder, int lineNo);
+int conditionCode(char *condition);
+int encodeBranchInstruction(const Mnemonic *m, char *address, int lineNo);
+int pairInstructions(const Mnemonic *m, char *rt, char *rt2, char *base, char *offsetOperand);
+int conditionalSelect(const Mnemonic *m, char *rd, char *rn, char *rm, char *cond);
+int bitfieldInstructions(const Mnemonic *m, char *rd, char *rn, char *operand, char *remainder);
+int exclusiveInstructions(const Mnemonic *m, char *rs, char *rt, char *rn);
+int isVectorOperand(const char *operand);
+int systemInstructions(const Mnemonic *m, char *operand, char *sysreg);
+int parseVector(char *operand, int *size, int *Q, int *index);
+int simdInstructions(const Mnemonic *m, char *rd, char *rn, char *rm);
+int encodeDirective(char *directive, char *value);
+int encodeLine(Token *tokens, int count, int lineNo);
+void appendWord(int word);
+int isPoolDirective(const char *token, int length);
+void flushLiterals(void);
+void assembleSequential(Source *source);
+char *scanLineEnd(Source *source, char *p);
+void scanChunk(Chunk *chunk);
+void encodeRange(Source *local, size_t from, size_t to, int *lineNo);
+void encodeChunk(Chunk *chunk);
+void *chunkWorker(void *argument);
+void runChunks(ChunkQueue *queue, int threads, void (*body)(Chunk *chunk));
+int assembleParallel(Source *source, int threads);
+void markDataWord(int index, int address);
+int relativeTarget(int word, int index, int *target, FixupKind *kind);
+int isNoOp(int word);
+int zeroingMove(int word);
+int mergeMoves(int first, int second, int *merged);
+int setsFlags(int word);
+int repeatsFlags(int first, int second);
+void optimizeImage(void);
+int assembleSource(Source *source, int threads);
+int compareSymbols(const void *a, const void *b);
+void finishAssembly(Assembly *assembly, int errors);
+int assembleOpenSource(Source *source, int threads, FILE *traceOutput, Assembly *assembly);
+size_t commonPrefix(const char *a, const char *b, size_t limit);
+size_t commonSuffix(const char *a, size_t aLength, const char *b, size_t bLength, size_t limit);
+int findLine(Watch *watch, size_t offset, int after);
+char *firstToken(char *p, char *end, int *length);
+void markDirty(Watch *watch, int from, int to);
+void resetWatch(Watch *watch);
+int updateWatch(Watch *watch, Source *source, int *encoded);
+int writeWatchOutput(Watch *watch, const char *outputFileName);
\ No newline at end of file
@@ -0,0 +1,129 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "libassemble.h"
+#include "object.h"
+
+// Writes a whole buffer with write(), retrying the short writes of pipes,
+// returns 0 on failure
+static int writeImage(int fd, const void *data, size_t length) {
+    const char *p = data;
+    while (length > 0) {
+        ssize_t written = write(fd, p, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        p += written;
+        length -= written;
+    }
+    return 1;
+}
+
+// Lays out an assembled object in the object.h format, returns a malloc'd buffer
+static char *formatObject(const Assembly *assembly, size_t *length) {
+    uint32_t stringSize = 0;
+    for (size_t i = 0; i < assembly->symbol_count; i++) {
+        stringSize += strlen(assembly->symbols[i].name) + 1;
+    }
+    ObjectHeader header = { .version = OBJECT_VERSION, .word_count = assembly->size / sizeof(uint32_t),
+                            .symbol_count = assembly->symbol_count, .relocation_count = assembly->relocation_count,
+                            .string_size = stringSize };
+    memcpy(header.magic, OBJECT_MAGIC, sizeof(header.magic));
+    *length = sizeof(header) + assembly->size + assembly->symbol_count * sizeof(ObjectSymbol)
+              + assembly->relocation_count * sizeof(ObjectRelocation) + stringSize;
+    char *buffer = malloc(*length);
+    if (buffer == NULL) {
+        perror("Error allocating object");
+        exit(EXIT_FAILURE);
+    }
+    char *p = buffer;
+    memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+    memcpy(p, assembly->image, assembly->size);
+    p += assembly->size;
+
+    char *strings = buffer + *length - stringSize;
+    uint32_t name = 0;
+    for (size_t i = 0; i < assembly->symbol_count; i++) {
+        const AssemblySymbol *symbol = &assembly->symbols[i];
+        int undefined = symbol->flags & ASSEMBLY_SYMBOL_UNDEFINED;
+        ObjectSymbol entry = { name, undefined ? 0 : symbol->address / 4,
+                               undefined ? OBJECT_SYMBOL_UNDEFINED : OBJECT_SYMBOL_GLOBAL };
+        memcpy(p, &entry, sizeof(entry));
+        p += sizeof(entry);
+        size_t size = strlen(symbol->name) + 1;
+        memcpy(strings + name, symbol->name, size);
+        name += size;
+    }
+    for (size_t i = 0; i < assembly->relocation_count; i++) {
+        const AssemblyRelocation *relocation = &assembly->relocations[i];
+        ObjectRelocation entry = { relocation->index, relocation->bits, relocation->symbol };
+        memcpy(p, &entry, sizeof(entry));
+        p += sizeof(entry);
+    }
+    return buffer;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 4 && strcmp(argv[1], "--watch") == 0) {
+        return assemble_watch(argv[2], argv[3]) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    int threads = 1;
+    int object = 0;
+    int first = 1;
+    for (; first < argc - 2; first++) {
+        if (strcmp(argv[first], "-j") == 0 && first + 1 < argc - 2) {
+            threads = atoi(argv[++first]);
+        } else if (strcmp(argv[first], "-c") == 0) {
+            object = 1;
+        } else if (strcmp(argv[first], "-O") == 0) {
+            assemble_set_optimize(1);
+        } else {
+            break;
+        }
+    }
+    if (argc - first != 2 || threads < 1) {
+        fprintf(stderr, "Usage: %s [-j <threads>] [-c] [-O] <input file | -> <output file | ->\n"
+                        "       %s --watch <input file> <output file>\n"
+                        "-c writes a relocatable object for link instead of an image\n"
+                        "-O removes redundant instructions and reports what changed\n", argv[0], argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    char *inputFileName = argv[first];
+    char *outputFileName = argv[first + 1];
+    int toStdout = strcmp(outputFileName, "-") == 0;
+
+    // With the image on stdout the trace goes to stderr
+    Assembly assembly;
+    FILE *trace = toStdout ? stderr : stdout;
+    int assembled = object ? assemble_object(inputFileName, trace, &assembly)
+                           : assemble_file(inputFileName, threads, trace, &assembly);
+    fputs(assembly.diagnostics, stderr);
+    if (!assembled) {
+        exit(EXIT_FAILURE);
+    }
+
+    // The file is only created once the whole image assembled
+    int outputFd = toStdout ? STDOUT_FILENO : open(outputFileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (outputFd < 0) {
+        perror("Error opening output file");
+        exit(EXIT_FAILURE);
+    }
+    size_t length = assembly.size;
+    char *output = object ? formatObject(&assembly, &length) : (char *)assembly.image;
+    if (!writeImage(outputFd, output, length) || close(outputFd) != 0) {
+        perror("Error writing output file");
+        exit(EXIT_FAILURE);
+    }
+    if (object) {
+        free(output);
+    }
+    assembly_free(&assembly);
+    return 0;
+}
@@ -0,0 +1,219 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "emulate.h"
+#include "batch.h"
+
+typedef struct {
+    char *binary;          // Path of the guest binary
+    char *output;          // Path of its state dump
+    RunStatus status;
+    uint64_t instructions; // Instructions executed
+    double seconds;        // Wall time of the run
+    int failed;            // Not run yet, or could not be loaded or its output written
+} BatchJob;
+
+// Per-worker deque of job indices. The owner takes from the head, idle
+// workers steal from the tail so they disturb the owner as little as possible.
+typedef struct {
+    pthread_mutex_t lock;
+    size_t *jobs;
+    size_t head;
+    size_t tail;
+} WorkQueue;
+
+typedef struct {
+    BatchJob *jobs;
+    WorkQueue *queues;
+    int workers;
+    uint64_t max_instructions;
+    double timeout;
+} Batch;
+
+typedef struct {
+    Batch *batch;
+    int id;
+} Worker;
+
+static void *checked_malloc(size_t size) {
+    void *block = malloc(size);
+    if (!block) {
+        perror("Error allocating batch");
+        exit(EXIT_FAILURE);
+    }
+    return block;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compare_jobs(const void *a, const void *b) {
+    return strcmp(((const BatchJob *)a)->binary, ((const BatchJob *)b)->binary);
+}
+
+// Takes a job from the head (owner) or tail (thief) of a queue, returns 0 if empty
+static int take_job(WorkQueue *queue, int steal, size_t *job) {
+    int found = 0;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->head < queue->tail) {
+        *job = steal ? queue->jobs[--queue->tail] : queue->jobs[queue->head++];
+        found = 1;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+static void run_job(BatchJob *job, CPUState *cpu, uint32_t *memory, uint64_t max_instructions, double timeout) {
+    double start = now_seconds();
+    memset(memory, 0, MEMORY_SIZE);
+    init_cpu(cpu, memory, NULL);
+
+    size_t size;
+    if (!load_binary(job->binary, memory, MEMORY_SIZE, &size)) {
+        return;
+    }
+    job->status = emulate_bounded(cpu, memory+MEMORY_OFFSET, size, max_instructions, timeout);
+    job->instructions = cpu->instructions;
+
+    int fd = open(job->output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(job->output);
+        return;
+    }
+    job->failed = !write_state(fd, cpu, memory);
+    close(fd);
+    job->seconds = now_seconds() - start;
+}
+
+static void *worker_main(void *arg) {
+    Worker *worker = arg;
+    Batch *batch = worker->batch;
+    uint32_t *memory = malloc(MEMORY_SIZE);
+    if (!memory) {
+        perror("Error allocating guest memory");
+        return NULL; // Other workers steal this worker's jobs, if none can they stay failed
+    }
+    CPUState cpu;
+    size_t job;
+    for (;;) {
+        int found = take_job(&batch->queues[worker->id], 0, &job);
+        for (int i = 1; !found && i < batch->workers; i++) {
+            found = take_job(&batch->queues[(worker->id + i) % batch->workers], 1, &job);
+        }
+        if (!found) break; // Every queue is drained, no new jobs are ever added
+        run_job(&batch->jobs[job], &cpu, memory, batch->max_instructions, batch->timeout);
+    }
+    free(memory);
+    return NULL;
+}
+
+// Collects dir/*.bin into a sorted job list, returns the number of jobs or -1
+static long find_jobs(const char *dir, BatchJob **jobs) {
+    DIR *directory = opendir(dir);
+    if (!directory) {
+        perror(dir);
+        return -1;
+    }
+    size_t count = 0, capacity = 64;
+    *jobs = checked_malloc(capacity * sizeof(BatchJob));
+    struct dirent *entry;
+    while ((entry = readdir(directory)) != NULL) {
+        size_t length = strlen(entry->d_name);
+        if (length <= 4 || strcmp(entry->d_name + length - 4, ".bin") != 0) continue;
+        if (count == capacity) {
+            capacity *= 2;
+            BatchJob *grown = realloc(*jobs, capacity * sizeof(BatchJob));
+            if (!grown) {
+                perror("Error allocating batch");
+                exit(EXIT_FAILURE);
+            }
+            *jobs = grown;
+        }
+        BatchJob *job = &(*jobs)[count++];
+        memset(job, 0, sizeof(*job));
+        job->failed = 1; // Until a worker has run it
+        job->binary = checked_malloc(strlen(dir) + length + 2);
+        sprintf(job->binary, "%s/%s", dir, entry->d_name);
+        job->output = checked_malloc(strlen(dir) + length + 2);
+        sprintf(job->output, "%s/%.*s.out", dir, (int)(length - 4), entry->d_name);
+    }
+    closedir(directory);
+    qsort(*jobs, count, sizeof(BatchJob), compare_jobs);
+    return count;
+}
+
+int run_batch(const char *dir, int threads, uint64_t max_instructions, double timeout) {
+    BatchJob *jobs;
+    long count = find_jobs(dir, &jobs);
+    if (count < 0) return 0;
+    if (threads < 1) threads = 1;
+    if (threads > count && count > 0) threads = count;
+
+    Batch batch = { jobs, checked_malloc(threads * sizeof(WorkQueue)), threads, max_instructions, timeout };
+    size_t *order = checked_malloc((count + 1) * sizeof(size_t));
+    for (int i = 0; i < threads; i++) { // Contiguous slices, neighbours tend to cost alike
+        WorkQueue *queue = &batch.queues[i];
+        pthread_mutex_init(&queue->lock, NULL);
+        queue->jobs = order;
+        queue->head = count * i / threads;
+        queue->tail = count * (i + 1) / threads;
+    }
+    for (long i = 0; i < count; i++) order[i] = i;
+
+    double start = now_seconds();
+    pthread_t *handles = checked_malloc(threads * sizeof(pthread_t));
+    Worker *workers = checked_malloc(threads * sizeof(Worker));
+    int started = 0;
+    for (int i = 0; i < threads; i++) {
+        workers[i] = (Worker){ &batch, i };
+        int error = pthread_create(&handles[i], NULL, worker_main, &workers[i]);
+        if (error != 0) { // The workers that did start steal the other queues' jobs
+            fprintf(stderr, "Error creating worker %d: %s\n", i, strerror(error));
+            break;
+        }
+        started++;
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(handles[i], NULL);
+    }
+    if (started == 0) { // Run the whole batch on this thread instead
+        worker_main(&workers[0]);
+        started = 1;
+    }
+    double elapsed = now_seconds() - start;
+
+    int ok = 1;
+    uint64_t total_instructions = 0;
+    for (long i = 0; i < count; i++) {
+        BatchJob *job = &jobs[i];
+        if (job->failed) {
+            printf("%s: error\n", job->binary);
+            ok = 0;
+        } else {
+            printf("%s: %s (%lu instructions, %.6fs)\n", job->binary, run_status_name(job->status), job->instructions, job->seconds);
+            if (job->status != RUN_HALT && job->status != RUN_END) ok = 0;
+        }
+        total_instructions += job->instructions;
+        free(job->binary);
+        free(job->output);
+    }
+    printf("%ld guests, %lu instructions, %d threads, %.3fs\n", count, total_instructions, started, elapsed);
+
+    for (int i = 0; i < threads; i++) {
+        pthread_mutex_destroy(&batch.queues[i].lock);
+    }
+    free(workers);
+    free(handles);
+    free(order);
+    free(batch.queues);
+    free(jobs);
+    return ok;
+}
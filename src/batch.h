@@ -0,0 +1,6 @@
+#include <stdint.h>
+
+// Runs every *.bin guest in dir on a work-stealing pool of threads, each
+// guest's final state going to <name>.out next to it. Returns 1 when every
+// guest loaded and ran to HALT or the end of its image, 0 otherwise.
+int run_batch(const char *dir, int threads, uint64_t max_instructions, double timeout);
@@ -0,0 +1,105 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Assembler throughput benchmark: `bench_assemble [-j <threads>] <lines>...`
+// generates a synthetic source of each size with ./gen_asm, assembles it with
+// ./assemble on the given number of threads (its stdout discarded) and prints
+// lines per second and the assembler's peak RSS as JSON. A run that crashes or
+// fails is reported with its status.
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Runs argv with stdout redirected to output, returns the wait status
+static int run(char *const argv[], const char *output, double *seconds, long *peak_rss_kb) {
+    double start = now_seconds();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        int fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || dup2(fd, STDOUT_FILENO) < 0) {
+            perror(output);
+            _exit(127);
+        }
+        close(fd);
+        execv(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        perror("wait4");
+        return -1;
+    }
+    *seconds = now_seconds() - start;
+    *peak_rss_kb = usage.ru_maxrss;
+    return status;
+}
+
+int main(int argc, char **argv) {
+    char *threads = "1";
+    int first = 1;
+    if (argc > 2 && strcmp(argv[1], "-j") == 0) {
+        threads = argv[2];
+        first = 3;
+    }
+    if (first >= argc || atoi(threads) < 1) {
+        fprintf(stderr, "Usage: %s [-j <threads>] <lines>...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *tmp = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    char source[1024], binary[1024];
+    snprintf(source, sizeof(source), "%s/bench_assemble.%d.s", tmp, (int)getpid());
+    snprintf(binary, sizeof(binary), "%s/bench_assemble.%d.bin", tmp, (int)getpid());
+
+    int failures = 0;
+    printf("{\"threads\": %d, \"benchmarks\": [", atoi(threads));
+    for (int i = first; i < argc; i++) {
+        double seconds;
+        long rss;
+        char *generate[] = { "./gen_asm", argv[i], NULL };
+        if (run(generate, source, &seconds, &rss) != 0) {
+            fprintf(stderr, "Failed to generate %s lines\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        struct stat info;
+        stat(source, &info);
+
+        char *assemble[] = { "./assemble", "-j", threads, source, binary, NULL };
+        int status = run(assemble, "/dev/null", &seconds, &rss);
+        char result[64];
+        if (status != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            strcpy(result, "ok");
+        } else if (status != -1 && WIFSIGNALED(status)) {
+            snprintf(result, sizeof(result), "killed by signal %d", WTERMSIG(status));
+            failures++;
+        } else {
+            snprintf(result, sizeof(result), "exit %d", status == -1 ? -1 : WEXITSTATUS(status));
+            failures++;
+        }
+        long lines = atol(argv[i]);
+        double rate = strcmp(result, "ok") == 0 ? lines / seconds : 0; // A failed run is no measurement
+        printf("%s\n  {\"lines\": %ld, \"bytes\": %ld, \"status\": \"%s\", \"seconds\": %.6f, "
+               "\"lines_per_second\": %.0f, \"peak_rss_kb\": %ld}",
+               i == first ? "" : ",", lines, (long)info.st_size, result, seconds, rate, rss);
+        fflush(stdout);
+    }
+    printf("\n]}\n");
+    unlink(source);
+    unlink(binary);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "emulate.h"
+#include "libemulate.h"
+
+// Runs each guest binary several times with tracing off and prints the median
+// speed as JSON: `bench_emulate [-n runs] <binary>...`. Every run must HALT.
+
+#define DEFAULT_RUNS 5
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Benchmark name: the file name without directory and extension
+static void bench_name(const char *path, char *name, size_t size) {
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    snprintf(name, size, "%s", base);
+    char *dot = strrchr(name, '.');
+    if (dot) *dot = '\0';
+}
+
+int main(int argc, char **argv) {
+    int runs = DEFAULT_RUNS;
+    int first = 1;
+    if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+        runs = atoi(argv[2]);
+        first = 3;
+    }
+    if (first >= argc || runs < 1) {
+        fprintf(stderr, "Usage: %s [-n <runs>] <binary file>...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    double *seconds = malloc(runs * sizeof(double));
+    printf("{\"runs\": %d, \"benchmarks\": [", runs);
+    for (int i = first; i < argc; i++) {
+        uint64_t instructions = 0;
+        for (int run = 0; run < runs; run++) {
+            Emulator *emulator = emulator_create(MEMORY_SIZE);
+            if (!emulator || !emulator_load_file(emulator, argv[i])) {
+                return EXIT_FAILURE;
+            }
+            double start = now_seconds();
+            EmulatorStatus status = emulator_run_until(emulator, EMULATOR_NO_STOP_PC, 0, 0);
+            seconds[run] = now_seconds() - start;
+            if (status != EMULATOR_HALT) {
+                fprintf(stderr, "%s: stopped without HALT at PC=0x%lx\n", argv[i], emulator_get_pc(emulator));
+                return EXIT_FAILURE;
+            }
+            instructions = emulator_instructions(emulator);
+            emulator_destroy(emulator);
+        }
+        qsort(seconds, runs, sizeof(double), compare_doubles);
+        double median = runs % 2 ? seconds[runs / 2] : (seconds[runs / 2 - 1] + seconds[runs / 2]) / 2;
+
+        char name[256];
+        bench_name(argv[i], name, sizeof(name));
+        printf("%s\n  {\"name\": \"%s\", \"instructions\": %lu, \"median_seconds\": %.6f, "
+               "\"min_seconds\": %.6f, \"max_seconds\": %.6f, \"mips\": %.2f, \"ns_per_instruction\": %.3f}",
+               i == first ? "" : ",", name, instructions, median, seconds[0], seconds[runs - 1],
+               instructions / median / 1e6, median * 1e9 / instructions);
+        fflush(stdout);
+    }
+    printf("\n]}\n");
+    free(seconds);
+    return EXIT_SUCCESS;
+}
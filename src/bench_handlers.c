@@ -0,0 +1,290 @@
+#define _GNU_SOURCE // sched_setaffinity
+#include <math.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "emulate.h"
+
+// Microbenchmark of the individual instruction handlers:
+// `bench_handlers [-n encodings] [-s samples] [-c cpu]`. Each handler is called
+// over an array of randomised valid encodings; after a warm-up pass every
+// sample times one pass over the array. Prints cycles per call (TSC ticks on
+// x86, nanoseconds elsewhere) as JSON with the median, mean and 95% confidence
+// interval of the samples. The "baseline" entry is an empty handler and shows
+// the harness overhead included in every other entry.
+
+#define DEFAULT_ENCODINGS 4096
+#define DEFAULT_SAMPLES 101
+#define BASE_ADDRESS 0x40000 // Registers point here so loads and stores stay in memory
+
+typedef void (*Handler)(CPUState *cpu, uint32_t instruction);
+typedef uint32_t (*Generator)(void);
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint32_t next_random(void) { // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (rng_state * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+static uint32_t random_register(void) {
+    return next_random() % 31; // X0-X30
+}
+
+static uint64_t read_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+// Encoders for each handler, following the field layout the handler decodes
+
+static uint32_t gen_arithmetic_immediate(void) {
+    uint32_t sf = next_random() & 1, opc = next_random() & 3, sh = next_random() & 1;
+    return (sf << 31) | (opc << 29) | (0x22 << 23) | (sh << 22) | ((next_random() & 0xFFF) << 10)
+           | (random_register() << 5) | random_register();
+}
+
+static uint32_t gen_arithmetic_register(void) {
+    uint32_t sf = next_random() & 1, opc = next_random() & 3, shift = next_random() % 3;
+    uint32_t amount = next_random() % (sf ? 64 : 32);
+    return (sf << 31) | (opc << 29) | (0x0B << 24) | (shift << 22) | (random_register() << 16)
+           | (amount << 10) | (random_register() << 5) | random_register();
+}
+
+static uint32_t gen_logical(void) {
+    uint32_t sf = next_random() & 1, opc = next_random() & 3, shift = next_random() & 3, N = next_random() & 1;
+    uint32_t amount = next_random() % (sf ? 64 : 32);
+    return (sf << 31) | (opc << 29) | (0x0A << 24) | (shift << 22) | (N << 21) | (random_register() << 16)
+           | (amount << 10) | (random_register() << 5) | random_register();
+}
+
+static uint32_t gen_multiply(void) {
+    uint32_t sf = next_random() & 1, x = next_random() & 1;
+    return (sf << 31) | (0xD8 << 21) | (random_register() << 16) | (x << 15) | (random_register() << 10)
+           | (random_register() << 5) | random_register();
+}
+
+static uint32_t gen_move_immediate(void) {
+    static const uint32_t opcs[] = { 0, 2, 3 }; // MOVN, MOVZ, MOVK
+    uint32_t sf = next_random() & 1, hw = next_random() % (sf ? 4 : 2);
+    return (sf << 31) | (opcs[next_random() % 3] << 29) | (0x25 << 23) | (hw << 21)
+           | ((next_random() & 0xFFFF) << 5) | random_register();
+}
+
+static uint32_t gen_single_data_transfer(void) {
+    uint32_t sf = next_random() & 1, L = next_random() & 1;
+    uint32_t Rt = random_register(), Xn = random_register();
+    switch (next_random() % 4) {
+        case 0: // Unsigned offset
+            return 0xB9000000 | (sf << 30) | (L << 22) | ((next_random() & 0x3FF) << 10) | (Xn << 5) | Rt;
+        case 1: // Pre/post-index
+            return 0xB8000000 | (sf << 30) | (L << 22) | ((next_random() & 0x1FF) << 12)
+                   | ((next_random() & 1) << 11) | (1 << 10) | (Xn << 5) | Rt;
+        case 2: // Register offset
+            return 0xB8200000 | (sf << 30) | (L << 22) | (random_register() << 16) | (0x1A << 10) | (Xn << 5) | Rt;
+        default: // Literal load
+            return 0x18000000 | (sf << 30) | ((next_random() & 0xFFF) << 5) | Rt;
+    }
+}
+
+static uint32_t gen_load_store_pair(void) {
+    uint32_t opc = (next_random() & 1) << 1, index = 1 + next_random() % 3, L = next_random() & 1;
+    return (opc << 30) | (0x5 << 27) | (index << 23) | (L << 22) | ((next_random() & 0x7F) << 15)
+           | (random_register() << 10) | (random_register() << 5) | random_register();
+}
+
+static uint32_t gen_conditional_select(void) {
+    uint32_t sf = next_random() & 1, op = next_random() & 1, op2 = next_random() & 1;
+    return (sf << 31) | (op << 30) | (0xD4 << 21) | (random_register() << 16) | ((next_random() & 0xF) << 12)
+           | (op2 << 10) | (random_register() << 5) | random_register();
+}
+
+static uint32_t gen_bitfield(void) {
+    uint32_t sf = next_random() & 1, opc = next_random() & 2, width = sf ? 64 : 32;
+    return (sf << 31) | (opc << 29) | (0x26 << 23) | (sf << 22) | ((next_random() % width) << 16)
+           | ((next_random() % width) << 10) | (random_register() << 5) | random_register();
+}
+
+static uint32_t gen_branch(void) {
+    switch (next_random() % 3) {
+        case 0:
+            return (0x05 << 26) | (next_random() & 0xFFF); // B
+        case 1:
+            return 0xD61F0000 | (random_register() << 5);  // BR
+        default:
+            return 0x54000000 | ((next_random() & 0x7FFFF) << 5) | (next_random() % 15); // B.cond
+    }
+}
+
+// check_condition() and apply_shift() are not instruction handlers; their
+// arguments are packed into the "encoding" and unpacked by a wrapper
+
+static uint32_t gen_condition(void) {
+    return ((next_random() & 0xF) << 4) | (next_random() & 0xF); // pstate:cond
+}
+
+static uint32_t gen_shift(void) {
+    uint32_t sf = next_random() & 1;
+    return (sf << 10) | ((next_random() & 3) << 8) | (next_random() % (sf ? 64 : 32)); // sf:type:amount
+}
+
+static volatile uint64_t sink;
+
+static void baseline_handler(CPUState *cpu, uint32_t instruction) {
+    sink = instruction;
+}
+
+static void condition_handler(CPUState *cpu, uint32_t instruction) {
+    cpu->pstate = instruction >> 4;
+    sink = check_condition(cpu, instruction & 0xF);
+}
+
+static void shift_handler(CPUState *cpu, uint32_t instruction) {
+    uint64_t value = cpu->regs[instruction & 0x1F];
+    apply_shift(&value, (instruction >> 8) & 3, instruction & 0x3F, instruction >> 10);
+    sink = value;
+}
+
+typedef struct {
+    const char *name;
+    Handler handler;
+    Generator generator;
+} Benchmark;
+
+static const Benchmark benchmarks[] = {
+    { "baseline", baseline_handler, gen_condition },
+    { "arithmetic_immediate", arithmetic_immediate, gen_arithmetic_immediate },
+    { "arithmetic_register", arithmetic_register, gen_arithmetic_register },
+    { "logical_instruction", logical_instruction, gen_logical },
+    { "multiply_instruction", multiply_instruction, gen_multiply },
+    { "move_immediate", move_immediate, gen_move_immediate },
+    { "single_data_transfer", single_data_transfer, gen_single_data_transfer },
+    { "load_store_pair", load_store_pair, gen_load_store_pair },
+    { "conditional_select", conditional_select, gen_conditional_select },
+    { "bitfield_instruction", bitfield_instruction, gen_bitfield },
+    { "branch_instruction", branch_instruction, gen_branch },
+    { "check_condition", condition_handler, gen_condition },
+    { "apply_shift", shift_handler, gen_shift },
+};
+
+// Registers start close to BASE_ADDRESS so that addresses, including
+// pre/post-index write-back drift within one pass, stay inside guest memory
+static void reset_cpu(CPUState *cpu, const uint64_t *registers) {
+    memcpy(cpu->regs, registers, sizeof(cpu->regs));
+    cpu->pc = BASE_ADDRESS;
+    cpu->pstate = 0x4;
+    cpu->fault = 0;
+}
+
+static uint64_t time_pass(CPUState *cpu, const uint64_t *registers, Handler handler, const uint32_t *encodings, int count) {
+    reset_cpu(cpu, registers);
+    uint64_t start = read_cycles();
+    for (int i = 0; i < count; i++) {
+        handler(cpu, encodings[i]);
+    }
+    return read_cycles() - start;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+    int count = DEFAULT_ENCODINGS;
+    int samples = DEFAULT_SAMPLES;
+    int cpu_number = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            samples = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            cpu_number = atoi(argv[++i]);
+        } else {
+            count = 0;
+            break;
+        }
+    }
+    if (count < 1 || samples < 2) {
+        fprintf(stderr, "Usage: %s [-n <encodings>] [-s <samples>] [-c <cpu>]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu_number, &cpus);
+    int pinned = sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+    if (!pinned) {
+        perror("sched_setaffinity");
+    }
+
+    uint32_t *memory = calloc(MEMORY_SIZE, 1);
+    uint32_t *encodings = malloc(count * sizeof(uint32_t));
+    double *per_call = malloc(samples * sizeof(double));
+    if (!memory || !encodings || !per_call) {
+        perror("Error allocating benchmark");
+        return EXIT_FAILURE;
+    }
+    uint64_t registers[31];
+    for (int i = 0; i < 31; i++) {
+        registers[i] = BASE_ADDRESS + (next_random() & 0xFFF8);
+    }
+    CPUState cpu;
+    init_cpu(&cpu, memory, NULL);
+
+    printf("{\"unit\": \"%s\", \"pinned_cpu\": %d, \"encodings\": %d, \"samples\": %d, \"handlers\": [",
+#if defined(__x86_64__) || defined(__i386__)
+           "tsc_cycles",
+#else
+           "ns",
+#endif
+           pinned ? cpu_number : -1, count, samples);
+    size_t benchmark_count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+    for (size_t b = 0; b < benchmark_count; b++) {
+        const Benchmark *bench = &benchmarks[b];
+        for (int i = 0; i < count; i++) {
+            encodings[i] = bench->generator();
+        }
+        for (int warm = 0; warm < 3; warm++) {
+            time_pass(&cpu, registers, bench->handler, encodings, count);
+        }
+        double sum = 0;
+        for (int s = 0; s < samples; s++) {
+            per_call[s] = (double)time_pass(&cpu, registers, bench->handler, encodings, count) / count;
+            sum += per_call[s];
+        }
+        double mean = sum / samples;
+        double variance = 0;
+        for (int s = 0; s < samples; s++) {
+            variance += (per_call[s] - mean) * (per_call[s] - mean);
+        }
+        variance /= samples - 1;
+        double ci95 = 1.96 * sqrt(variance / samples);
+        qsort(per_call, samples, sizeof(double), compare_doubles);
+
+        printf("%s\n  {\"name\": \"%s\", \"median\": %.2f, \"mean\": %.2f, \"ci95_low\": %.2f, \"ci95_high\": %.2f, "
+               "\"min\": %.2f, \"max\": %.2f}",
+               b ? "," : "", bench->name, per_call[samples / 2], mean, mean - ci95, mean + ci95,
+               per_call[0], per_call[samples - 1]);
+        fflush(stdout);
+    }
+    printf("\n]}\n");
+
+    free(per_call);
+    free(encodings);
+    free(memory);
+    return EXIT_SUCCESS;
+}
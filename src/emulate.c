@@ -1,28 +1,51 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 #include "emulate.h"
+#include "snapshot.h"
 
-uint32_t memory[MEMORY_SIZE / sizeof(uint32_t)];
-
-void load_binary(const char *filename, uint32_t *memory, size_t *size) {
+int load_binary(const char *filename, uint32_t *memory, size_t memory_size, size_t *size) {
     FILE *file = fopen(filename, "rb");
     if (!file) {
-        perror("Error opening file");
-        exit(EXIT_FAILURE);
+        perror(filename);
+        return 0;
     }
     fseek(file, 0, SEEK_END);
-    *size = ftell(file) / sizeof(uint32_t);
+    size_t words = ftell(file) / sizeof(uint32_t);
     fseek(file, 0, SEEK_SET);
-    fread(memory+MEMORY_OFFSET, sizeof(uint32_t), *size, file);
+    if (words > memory_size / sizeof(uint32_t) - MEMORY_OFFSET) {
+        fprintf(stderr, "%s: image does not fit in guest memory\n", filename);
+        fclose(file);
+        return 0; // *size is left as it was, nothing was written
+    }
+    *size = fread(memory+MEMORY_OFFSET, sizeof(uint32_t), words, file);
     fclose(file);
+    return 1;
 }
 
-void init_cpu(CPUState *cpu) {
+void init_cpu(CPUState *cpu, uint32_t *memory, FILE *trace) {
     memset(cpu->regs, 0, sizeof(cpu->regs));
+    memset(cpu->vregs, 0, sizeof(cpu->vregs));
     cpu->zr = 0;
     cpu->pc = 0;
     cpu->pstate = 0x4; // Z flag set
+    cpu->memory = memory;
+    cpu->memory_size = MEMORY_SIZE;
+    cpu->trace = trace;
+    cpu->instructions = 0;
+    cpu->fault = 0;
+    cpu->core_id = 0;
+    cpu->dirty_pages = NULL;
+    cpu->coverage = NULL;
+    cpu->prev_location = 0;
+    cpu->exclusive_valid = 0;
+    cpu->exclusive_address = 0;
+    cpu->exclusive_value = 0;
 }
 
 void set_flag(CPUState *cpu, int flag_pos, int condition) {
@@ -110,14 +133,14 @@ void arithmetic_immediate(CPUState *cpu, uint32_t instruction) {
                     
             break;
         default:
-            printf("Unknown arithmetic immediate opcode: 0x%x\n", opc);
+            TRACE(cpu, "Unknown arithmetic immediate opcode: 0x%x\n", opc);
             return;
     }
     if (rd != 31) {
         cpu->regs[rd] = result;
     }
 
-    printf("arithmetic_immediate: X%d = X%d %s %lu (result: %lu)\n", rd, rn, (opc & 0x2) ? "-" : "+", operand2, cpu->regs[rd]);
+    TRACE(cpu, "arithmetic_immediate: X%d = X%d %s %lu (result: %lu)\n", rd, rn, (opc & 0x2) ? "-" : "+", operand2, cpu->regs[rd]);
 }
 
 void and_register(CPUState *cpu, uint32_t instruction) {
@@ -125,7 +148,7 @@ void and_register(CPUState *cpu, uint32_t instruction) {
     uint32_t rn = (instruction >> 5) & 0x1F;
     uint32_t rm = (instruction >> 16) & 0x1F;
     cpu->regs[rd] = cpu->regs[rn] & cpu->regs[rm];
-    printf("and_register: X%d = X%d & X%d (result: %lu)\n", rd, rn, rm, cpu->regs[rd]);
+    TRACE(cpu, "and_register: X%d = X%d & X%d (result: %lu)\n", rd, rn, rm, cpu->regs[rd]);
 }
 
 void move_immediate(CPUState *cpu, uint32_t instruction) {
@@ -159,7 +182,7 @@ void move_immediate(CPUState *cpu, uint32_t instruction) {
                 }
                 break;
             default:
-                printf("Unknown Data Processing Immediate opcode: 0x%x\n", opc);
+                TRACE(cpu, "Unknown Data Processing Immediate opcode: 0x%x\n", opc);
                 return;
         }
     }
@@ -168,9 +191,38 @@ void move_immediate(CPUState *cpu, uint32_t instruction) {
         cpu->regs[rd] &= 0xFFFFFFFF; // Ensure 32-bit result
     }
 
-    printf("move_immediate: X%d = %lu\n", rd, cpu->regs[rd]);
+    TRACE(cpu, "move_immediate: X%d = %lu\n", rd, cpu->regs[rd]);
 }
 
+// SBFM/UBFM and their aliases (ASR/LSL/LSR immediate, SBFX/UBFX, SXT*/UXT*)
+void bitfield_instruction(CPUState *cpu, uint32_t instruction) {
+    uint32_t sf = (instruction >> 31) & 0x1;     // Size flag (bit 31)
+    uint32_t opc = (instruction >> 29) & 0x3;    // 0 = SBFM, 2 = UBFM (bits 30-29)
+    uint32_t immr = (instruction >> 16) & 0x3F;  // Rotate amount (bits 21-16)
+    uint32_t imms = (instruction >> 10) & 0x3F;  // Top bit of the field (bits 15-10)
+    uint32_t rn = (instruction >> 5) & 0x1F;     // Source register (bits 9-5)
+    uint32_t rd = instruction & 0x1F;            // Destination register (bits 4-0)
+    uint32_t datasize = sf ? 64 : 32;
+
+    if (opc == 1 || opc == 3 || immr >= datasize || imms >= datasize) {
+        TRACE(cpu, "Unknown bitfield instruction: 0x%08x\n", instruction);
+        return;
+    }
+    uint64_t source = rn == 31 ? 0 : cpu->regs[rn];
+    uint32_t width = imms >= immr ? imms - immr + 1 : imms + 1; // Bits in the field
+    uint64_t mask = width == 64 ? UINT64_MAX : (1ULL << width) - 1;
+    uint64_t field = (imms >= immr ? source >> immr : source) & mask;
+    if (opc == 0 && width < 64 && ((field >> (width - 1)) & 1)) {
+        field |= ~mask; // SBFM sign-extends the field
+    }
+    uint64_t result = imms >= immr ? field : field << (datasize - immr);
+    if (sf == 0) result &= 0xFFFFFFFF; // 32-bit result
+    if (rd != 31) {
+        cpu->regs[rd] = result;
+    }
+    TRACE(cpu, "bitfield_instruction: X%d = %s(X%d, immr=%d, imms=%d) (result: 0x%lx)\n",
+          rd, opc == 0 ? "SBFM" : "UBFM", rn, immr, imms, result);
+}
 
 void data_processing_immediate(CPUState *cpu, uint32_t instruction) {
     uint32_t opcode = (instruction >> 23) & 0x7; // Bits 25-23
@@ -181,8 +233,11 @@ void data_processing_immediate(CPUState *cpu, uint32_t instruction) {
         case 0x5: // MOV (immediate)
             move_immediate(cpu, instruction);
             break;
+        case 0x6: // Bitfield
+            bitfield_instruction(cpu, instruction);
+            break;
         default:
-            printf("Unknown Data Processing Immediate opcode: 0x%x\n", opcode);
+            TRACE(cpu, "Unknown Data Processing Immediate opcode: 0x%x\n", opcode);
             break;
     }
 }
@@ -246,7 +301,7 @@ void arithmetic_register(CPUState *cpu, uint32_t instruction) {
         operand1 &= 0xFFFFFFFF;
     }
 
-    printf("arithmetic_register: PC=0x%lx, instruction=0x%08x, opc=0x%x, rd=%d, rn=%d, rm=%d\n",
+    TRACE(cpu, "arithmetic_register: PC=0x%lx, instruction=0x%08x, opc=0x%x, rd=%d, rn=%d, rm=%d\n",
            cpu->pc, instruction, opc, rd, rn, rm);
 
     switch (opc) {
@@ -279,16 +334,16 @@ void arithmetic_register(CPUState *cpu, uint32_t instruction) {
                                   ((int64_t)operand1 < 0 && (int64_t)operand_value > 0 && (int64_t)result > 0)); // Overflow flag
             break;
         default:
-            printf("Unknown arithmetic instruction opcode: 0x%x\n", opc);
+            TRACE(cpu, "Unknown arithmetic instruction opcode: 0x%x\n", opc);
             return;
     }
     if (rd != 31) { //ZR Register Case
         cpu->regs[rd] = result;
     } else {
-        printf("Attempt to write to ZR prevented. Result: 0x%lx\n", result);
+        TRACE(cpu, "Attempt to write to ZR prevented. Result: 0x%lx\n", result);
     }
 
-    printf("arithmetic_register: X%d = X%d %s X%d (result: %lu)\n", rd, rn, (opc & 0x2) ? "-" : "+", rm, result);
+    TRACE(cpu, "arithmetic_register: X%d = X%d %s X%d (result: %lu)\n", rd, rn, (opc & 0x2) ? "-" : "+", rm, result);
 }
 
 void logical_instruction(CPUState *cpu, uint32_t instruction) {
@@ -323,7 +378,6 @@ void logical_instruction(CPUState *cpu, uint32_t instruction) {
             break;
         case 0x1: // ORR/ORN
             result = operand1 | operand_value;
-            printf("1) %ld 2) %ld", operand1, operand_value);
             operation = N ? "ORN" : "ORR";
             break;
         case 0x2: // EOR/EON
@@ -340,7 +394,7 @@ void logical_instruction(CPUState *cpu, uint32_t instruction) {
             set_flag(cpu, V_FLAG, 0); // Overflow flag (logical operations set V to 0)
             break;
         default:
-            printf("Unknown logical instruction opcode: 0x%x\n", opc);
+            TRACE(cpu, "Unknown logical instruction opcode: 0x%x\n", opc);
             return;
     }
 
@@ -350,7 +404,7 @@ void logical_instruction(CPUState *cpu, uint32_t instruction) {
     if (rd != 31) {
         cpu->regs[rd] = result;
     }
-    printf("logical_instruction: X%d = X%d %s X%d (result: %lu)\n", rd, rn, operation, rm, result);
+    TRACE(cpu, "logical_instruction: X%d = X%d %s X%d (result: %lu)\n", rd, rn, operation, rm, result);
 }
 
 
@@ -384,9 +438,37 @@ void multiply_instruction(CPUState *cpu, uint32_t instruction) {
 
     if (sf == 0) result &= 0xFFFFFFFF; // 32-bit result
     cpu->regs[rd] = result;
-    printf("multiply_instruction: X%d = X%d %c (X%d * X%d) (result: %lu)\n", rd, ra, (x == 0 ? '+' : '-'), rn, rm, result);
+    TRACE(cpu, "multiply_instruction: X%d = X%d %c (X%d * X%d) (result: %lu)\n", rd, ra, (x == 0 ? '+' : '-'), rn, rm, result);
 }
 
+// CSEL/CSINC/CSINV/CSNEG: Rd = cond ? Rn : f(Rm)
+void conditional_select(CPUState *cpu, uint32_t instruction) {
+    uint32_t sf = (instruction >> 31) & 0x1;     // Size flag (bit 31)
+    uint32_t op = (instruction >> 30) & 0x1;     // Invert flag (bit 30)
+    uint32_t rm = (instruction >> 16) & 0x1F;    // Second operand (bits 20-16)
+    uint32_t cond = (instruction >> 12) & 0xF;   // Condition (bits 15-12)
+    uint32_t op2 = (instruction >> 10) & 0x3;    // Increment flag (bits 11-10)
+    uint32_t rn = (instruction >> 5) & 0x1F;     // First operand (bits 9-5)
+    uint32_t rd = instruction & 0x1F;            // Destination register (bits 4-0)
+
+    if (((instruction >> 29) & 0x1) || op2 > 1) {
+        TRACE(cpu, "Unknown conditional select instruction: 0x%08x\n", instruction);
+        return;
+    }
+    uint64_t result;
+    if (check_condition(cpu, cond)) {
+        result = rn == 31 ? 0 : cpu->regs[rn];
+    } else {
+        result = rm == 31 ? 0 : cpu->regs[rm];
+        if (op) result = ~result;    // CSINV, CSNEG
+        if (op2) result += 1;        // CSINC, CSNEG
+    }
+    if (sf == 0) result &= 0xFFFFFFFF; // 32-bit result
+    if (rd != 31) {
+        cpu->regs[rd] = result;
+    }
+    TRACE(cpu, "conditional_select: X%d = cond 0x%x ? X%d : X%d (op %d, op2 %d) (result: %lu)\n", rd, cond, rn, rm, op, op2, result);
+}
 
 void data_processing_register(CPUState *cpu, uint32_t instruction) {
     uint32_t op = (instruction >> 24) & 0x1; // Arithmetic or Logical
@@ -400,8 +482,80 @@ void data_processing_register(CPUState *cpu, uint32_t instruction) {
     }
 }
 
+// Guest memory accesses. Naturally aligned halfwords, words and doublewords are accessed
+// with relaxed host atomics, so cores sharing memory (see smp.h) never see
+// torn values. Unaligned accesses are plain copies.
+uint64_t load_guest(uint8_t *address, uint64_t width) {
+    if (width == 1) return __atomic_load_n(address, __ATOMIC_RELAXED);
+    if (width == 2) {
+        if (((uintptr_t)address & 1) == 0) return __atomic_load_n((uint16_t *)address, __ATOMIC_RELAXED);
+        uint16_t value;
+        memcpy(&value, address, 2);
+        return value;
+    }
+    if (width == 8) {
+        if (((uintptr_t)address & 7) == 0) return __atomic_load_n((uint64_t *)address, __ATOMIC_RELAXED);
+        uint64_t value;
+        memcpy(&value, address, 8);
+        return value;
+    }
+    if (((uintptr_t)address & 3) == 0) return __atomic_load_n((uint32_t *)address, __ATOMIC_RELAXED);
+    uint32_t value;
+    memcpy(&value, address, 4);
+    return value;
+}
+
+void store_guest(uint8_t *address, uint64_t width, uint64_t data) {
+    if (width == 1) {
+        __atomic_store_n(address, (uint8_t)data, __ATOMIC_RELAXED);
+    } else if (width == 2) {
+        uint16_t half = data;
+        if (((uintptr_t)address & 1) == 0) {
+            __atomic_store_n((uint16_t *)address, half, __ATOMIC_RELAXED);
+        } else {
+            memcpy(address, &half, 2);
+        }
+    } else if (width == 8) {
+        if (((uintptr_t)address & 7) == 0) {
+            __atomic_store_n((uint64_t *)address, data, __ATOMIC_RELAXED);
+        } else {
+            memcpy(address, &data, 8);
+        }
+    } else {
+        uint32_t word = data;
+        if (((uintptr_t)address & 3) == 0) {
+            __atomic_store_n((uint32_t *)address, word, __ATOMIC_RELAXED);
+        } else {
+            memcpy(address, &word, 4);
+        }
+    }
+}
+
+// Checks that a guest access of width bytes at address lies inside guest memory,
+// otherwise flags a fault so the run loop stops instead of touching host memory
+int check_access(CPUState *cpu, uint64_t address, uint64_t width) {
+    uint64_t limit = cpu->memory_size - MEMORY_OFFSET * sizeof(uint32_t);
+    if (address > limit || width > limit - address) {
+        TRACE(cpu, "Memory access out of range: address=0x%lx, size=%lu\n", address, width);
+        cpu->fault = 1;
+        return 0;
+    }
+    return 1;
+}
+
+// Records the pages touched by a store when the instance tracks dirty pages
+void mark_dirty(CPUState *cpu, uint64_t address, uint64_t width) {
+    if (cpu->dirty_pages) {
+        uint64_t offset = address + MEMORY_OFFSET * sizeof(uint32_t); // From the start of memory
+        cpu->dirty_pages[offset / DIRTY_PAGE_SIZE] = 1;
+        cpu->dirty_pages[(offset + width - 1) / DIRTY_PAGE_SIZE] = 1;
+    }
+}
+
 void single_data_transfer(CPUState *cpu, uint32_t instruction) {
     uint32_t sf = (instruction >> 30) & 0x1;      // Size flag (bit 30)
+    uint32_t size = (instruction >> 30) & 0x3;    // Access size, 1 << size bytes (bits 31-30)
+    uint64_t width = 1 << size;
     uint32_t literal = !((instruction >> 29) & 0x1); // Literal flag (bit 29)
     uint32_t L = (instruction >> 22) & 0x1;       // Load/Store flag (bit 22)
     uint32_t U = (instruction >> 24) & 0x1;       // Option (bit 24)
@@ -411,7 +565,7 @@ void single_data_transfer(CPUState *cpu, uint32_t instruction) {
     uint32_t Xn = (instruction >> 5) & 0x1F;      // Base register (bits 9-5)
     uint32_t Rt = instruction & 0x1F;             // Target register (bits 4-0)
     uint32_t I = (instruction >> 11) & 0x1; // Index flag (bit 11)
-    uint8_t *byte_memory = (uint8_t *)(memory+MEMORY_OFFSET);
+    uint8_t *byte_memory = (uint8_t *)(cpu->memory+MEMORY_OFFSET);
     uint64_t address;
     uint64_t data;
 
@@ -419,8 +573,8 @@ void single_data_transfer(CPUState *cpu, uint32_t instruction) {
     if (simm9 & 0x100) {
         simm9 |= ~0x1FF;
     }
-    printf("Instruction: 0x%08x\n", instruction);
-    printf("sf: %u, literal: %u, L: %u, U: %u, offset: %u, simm9: %d, Xn: %u, Rt: %u\n",
+    TRACE(cpu, "Instruction: 0x%08x\n", instruction);
+    TRACE(cpu, "sf: %u, literal: %u, L: %u, U: %u, offset: %u, simm9: %d, Xn: %u, Rt: %u\n",
            sf, literal, L, U, offset, simm9, Xn, Rt);
 
     if (literal) {
@@ -428,92 +582,151 @@ void single_data_transfer(CPUState *cpu, uint32_t instruction) {
         int32_t simm19 = (instruction >> 5) & 0x7FFFF; // Signed immediate (bits 5-23)
         int64_t offset = ((int64_t)simm19 << 45) >> 45; // Sign-extend the 19-bit immediate
         address = cpu->pc + (offset * 4);
-        printf("Literal load: simm19: %d, offset: %ld, address: 0x%lx\n", simm19, offset, address);
+        TRACE(cpu, "Literal load: simm19: %d, offset: %ld, address: 0x%lx\n", simm19, offset, address);
+        if (!check_access(cpu, address, sf ? 8 : 4)) { return; }
         if (sf == 0) { // 32-bit load
-            data = *(uint32_t *)(byte_memory + address);
+            data = load_guest(byte_memory + address, 4);
             cpu->regs[Rt] = data;
-            printf("32-bit LOAD: X%d = [0x%lx] (data: 0x%x)\n", Rt, address, (uint32_t)data);
+            TRACE(cpu, "32-bit LOAD: X%d = [0x%lx] (data: 0x%x)\n", Rt, address, (uint32_t)data);
         } else { // 64-bit load
-            data = *(uint64_t *)(byte_memory + address);
+            data = load_guest(byte_memory + address, 8);
             cpu->regs[Rt] = data;
-            printf("64-bit LOAD: X%d = [0x%lx] (data: %lu)\n", Rt, address, data);
+            TRACE(cpu, "64-bit LOAD: X%d = [0x%lx] (data: %lu)\n", Rt, address, data);
         }
     } else {
         // Handle non-literal load/store
         address = cpu->regs[Xn];
-        printf("Non-literal load/store: initial address: 0x%lx\n", address);
-        if (U) { // Unsigned Offset
-            if (sf == 0) { // 32-bit variant
-                address += (offset * 4);
-            } else { // 64-bit variant
-                address += (offset * 8);
-            }
-            printf("Unsigned Offset: new address: 0x%lx\n", address);
+        TRACE(cpu, "Non-literal load/store: initial address: 0x%lx\n", address);
+        if (U) { // Unsigned Offset, scaled by the access size
+            address += (uint64_t)offset << size;
+            TRACE(cpu, "Unsigned Offset: new address: 0x%lx\n", address);
         } else {
             if (R) { // Register Offset
                 uint32_t Xm = (instruction >> 16) & 0x1F; // Offset register
                 address += cpu->regs[Xm];
-                printf("Register Offset: Xm: %u, new address: 0x%lx\n", Xm, address);
+                TRACE(cpu, "Register Offset: Xm: %u, new address: 0x%lx\n", Xm, address);
             } else {
                 if (I) { // Pre-Indexed
                     address += simm9;
                     cpu->regs[Xn] = address; // Write-back the updated address to the base register
-                    printf("Pre-Indexed: new address: 0x%lx, updated base register X%d: 0x%lx\n", address, Xn, cpu->regs[Xn]);
+                    TRACE(cpu, "Pre-Indexed: new address: 0x%lx, updated base register X%d: 0x%lx\n", address, Xn, cpu->regs[Xn]);
                 } else { // Post-Indexed
-                    printf("Post-Indexed: address remains unchanged initially: 0x%lx\n", address);
+                    TRACE(cpu, "Post-Indexed: address remains unchanged initially: 0x%lx\n", address);
                 }
             }
         }
+        if (!check_access(cpu, address, width)) { return; }
         if (L) { // Load
             if (Rt == 31) { return; }       // if Rt is ZR register, abort
-            if (sf == 0) { // 32-bit load
-                data = *(uint32_t *)(byte_memory + address);
+            if (size < 2) { // LDRB/LDRH, zero-extended
+                data = load_guest(byte_memory + address, width);
                 cpu->regs[Rt] = data;
-                printf("32-bit LOAD: X%d = [0x%lx] (data: 0x%x)\n", Rt, address, (uint32_t)data);
+                TRACE(cpu, "%lu-bit LOAD: X%d = [0x%lx] (data: 0x%lx)\n", width * 8, Rt, address, data);
+            } else if (sf == 0) { // 32-bit load
+                data = load_guest(byte_memory + address, 4);
+                cpu->regs[Rt] = data;
+                TRACE(cpu, "32-bit LOAD: X%d = [0x%lx] (data: 0x%x)\n", Rt, address, (uint32_t)data);
             } else { // 64-bit load
-                data = *(uint64_t *)(byte_memory + address);
+                data = load_guest(byte_memory + address, 8);
                 cpu->regs[Rt] = data;
-                printf("64-bit LOAD: X%d = [0x%lx] (data: %lu)\n", Rt, address, data);
+                TRACE(cpu, "64-bit LOAD: X%d = [0x%lx] (data: %lu)\n", Rt, address, data);
             }
         } else { // Store
-            if (sf == 0) { // 32-bit store
+            mark_dirty(cpu, address, width);
+            if (size < 2) { // STRB/STRH
+                data = cpu->regs[Rt] & ((1ULL << (width * 8)) - 1);
+                store_guest(byte_memory + address, width, data);
+                TRACE(cpu, "%lu-bit STORE: [0x%lx] = X%d (data: 0x%lx)\n", width * 8, address, Rt, data);
+            } else if (sf == 0) { // 32-bit store
                 data = cpu->regs[Rt] & 0xFFFFFFFF;
-                *(uint32_t *)(byte_memory + address) = data;
-                printf("32-bit STORE: [0x%lx] = X%d (data: 0x%x)\n", address, Rt, (uint32_t)data);
+                store_guest(byte_memory + address, 4, data);
+                TRACE(cpu, "32-bit STORE: [0x%lx] = X%d (data: 0x%x)\n", address, Rt, (uint32_t)data);
             } else { // 64-bit store
                 data = cpu->regs[Rt];
-                *(uint64_t *)(byte_memory + address) = data;
-                printf("64-bit STORE: [0x%lx] = X%d (data: %lu)\n", address, Rt, data);
+                store_guest(byte_memory + address, 8, data);
+                TRACE(cpu, "64-bit STORE: [0x%lx] = X%d (data: %lu)\n", address, Rt, data);
             }
         }
         // Handle post-index addressing mode
         if (!literal && !U && !R && !I) {
             cpu->regs[Xn] += simm9; // Update base register with signed offset
-            printf("Post-Indexed Update: new base register X%d: 0x%lx\n", Xn, cpu->regs[Xn]);
+            TRACE(cpu, "Post-Indexed Update: new base register X%d: 0x%lx\n", Xn, cpu->regs[Xn]);
         }
     }
 }
 
+// LDP/STP of two W or X registers with signed offset, pre- or post-index
+void load_store_pair(CPUState *cpu, uint32_t instruction) {
+    uint32_t opc = (instruction >> 30) & 0x3;     // 0 = 32-bit, 2 = 64-bit (bits 31-30)
+    uint32_t index = (instruction >> 23) & 0x3;   // 1 = post, 2 = offset, 3 = pre (bits 24-23)
+    uint32_t L = (instruction >> 22) & 0x1;       // Load/Store flag (bit 22)
+    int32_t imm7 = (instruction >> 15) & 0x7F;    // Signed scaled offset (bits 21-15)
+    uint32_t Rt2 = (instruction >> 10) & 0x1F;    // Second register (bits 14-10)
+    uint32_t Xn = (instruction >> 5) & 0x1F;      // Base register (bits 9-5)
+    uint32_t Rt = instruction & 0x1F;             // First register (bits 4-0)
+    uint64_t width = opc ? 8 : 4;
+    uint8_t *byte_memory = (uint8_t *)(cpu->memory+MEMORY_OFFSET);
+
+    if ((opc != 0 && opc != 2) || index == 0 || ((instruction >> 26) & 0x1)) {
+        TRACE(cpu, "Unknown load/store pair instruction: 0x%08x\n", instruction);
+        return;
+    }
+    if (imm7 & 0x40) {
+        imm7 |= ~0x7F; // Sign-extend
+    }
+    int64_t offset = (int64_t)imm7 * (int64_t)width;
+    uint64_t address = cpu->regs[Xn] + (index == 1 ? 0 : offset);
+    if (!check_access(cpu, address, 2 * width)) { return; }
+    if (L) {
+        uint64_t first = load_guest(byte_memory + address, width);
+        uint64_t second = load_guest(byte_memory + address + width, width);
+        if (Rt != 31) cpu->regs[Rt] = first;
+        if (Rt2 != 31) cpu->regs[Rt2] = second;
+        TRACE(cpu, "LDP: X%d, X%d = [0x%lx] (data: 0x%lx, 0x%lx)\n", Rt, Rt2, address, first, second);
+    } else {
+        uint64_t first = Rt == 31 ? 0 : cpu->regs[Rt];
+        uint64_t second = Rt2 == 31 ? 0 : cpu->regs[Rt2];
+        mark_dirty(cpu, address, 2 * width);
+        store_guest(byte_memory + address, width, first);
+        store_guest(byte_memory + address + width, width, second);
+        TRACE(cpu, "STP: [0x%lx] = X%d, X%d (data: 0x%lx, 0x%lx)\n", address, Rt, Rt2, first, second);
+    }
+    if (index != 2) { // Pre/post-index write-back
+        cpu->regs[Xn] += offset;
+        TRACE(cpu, "Pair write-back: base register X%d: 0x%lx\n", Xn, cpu->regs[Xn]);
+    }
+}
+
+// AFL-style edge coverage: each block transition bumps the map entry indexed by
+// the hashed destination block mixed with the previous one
+void record_edge(CPUState *cpu, uint64_t target) {
+    if (cpu->coverage) {
+        uint32_t location = (uint32_t)((target >> 2) * 2654435761u) & (COVERAGE_MAP_SIZE - 1);
+        cpu->coverage[location ^ cpu->prev_location]++;
+        cpu->prev_location = location >> 1;
+    }
+}
+
 void branch_instruction(CPUState *cpu, uint32_t instruction) {
     uint32_t op = (instruction >> 26) & 0x3F; // Bits 31-26
     int32_t simm26, simm19;
     int64_t offset;
 
-    printf("Branch instruction: PC=0x%lx, instruction=0x%08x, op=0x%x\n", cpu->pc, instruction, op);
+    TRACE(cpu, "Branch instruction: PC=0x%lx, instruction=0x%08x, op=0x%x\n", cpu->pc, instruction, op);
 
     switch (op) {
         case 0x05: // Unconditional branch
             simm26 = (instruction & 0x3FFFFFF); // Bits 25-0
-            offset = (int64_t)simm26 << 2;
-            printf("Unconditional branch: offset=0x%lx, PC before=0x%lx\n", offset, cpu->pc);
+            offset = (((int64_t)simm26 << 38) >> 38) << 2;
+            TRACE(cpu, "Unconditional branch: offset=0x%lx, PC before=0x%lx\n", offset, cpu->pc);
             cpu->pc += offset - 4;
-            printf("Unconditional branch to PC=0x%lx\n", cpu->pc);
+            TRACE(cpu, "Unconditional branch to PC=0x%lx\n", cpu->pc);
             break;
         case 0x35: // Register branch
             {
                 uint32_t Xn = (instruction >> 5) & 0x1F; // Bits 9-5
-                cpu->pc = cpu->regs[Xn];
-                printf("Register branch to PC=0x%lx\n", cpu->pc);
+                cpu->pc = cpu->regs[Xn] - 4; // The PC is advanced past the branch afterwards
+                TRACE(cpu, "Register branch to PC=0x%lx\n", cpu->regs[Xn]);
             }
             break;
         case 0x15: // Conditional branch
@@ -521,29 +734,249 @@ void branch_instruction(CPUState *cpu, uint32_t instruction) {
             uint32_t cond = instruction & 0xF;     // Bits 3-0
             offset = (((int64_t)simm19 << 45) >> 45) << 2;
             if (check_condition(cpu, cond)) {
-                printf("Condition met for branch: cond=0x%x, offset=0x%lx\n", cond, offset);
+                TRACE(cpu, "Condition met for branch: cond=0x%x, offset=0x%lx\n", cond, offset);
                 cpu->pc += offset - 4;
-                printf("Conditional branch to PC=0x%lx on condition %x\n", cpu->pc, cond);
-                return;
+                TRACE(cpu, "Conditional branch to PC=0x%lx on condition %x\n", cpu->pc, cond);
             } else {
-                printf("Condition %x not met, no branch taken\n", cond);
+                TRACE(cpu, "Condition %x not met, no branch taken\n", cond);
             }
             break;
         default:
-            printf("Unknown branch instruction: 0x%08x\n", instruction);
+            TRACE(cpu, "Unknown branch instruction: 0x%08x\n", instruction);
             break;
     }
+    record_edge(cpu, cpu->pc + 4); // Next block, taken or not
+}
+
+void load_store_exclusive(CPUState *cpu, uint32_t instruction) {
+    uint32_t sf = (instruction >> 30) & 0x1;      // Size flag (bit 30)
+    uint32_t L = (instruction >> 22) & 0x1;       // Load/Store flag (bit 22)
+    uint32_t o0 = (instruction >> 15) & 0x1;      // Acquire/Release flag (bit 15)
+    uint32_t Rs = (instruction >> 16) & 0x1F;     // Status register (bits 20-16)
+    uint32_t Xn = (instruction >> 5) & 0x1F;      // Base register (bits 9-5)
+    uint32_t Rt = instruction & 0x1F;             // Target register (bits 4-0)
+    uint64_t width = sf ? 8 : 4;
+    uint64_t address = cpu->regs[Xn];
+    uint8_t *byte_memory = (uint8_t *)(cpu->memory+MEMORY_OFFSET);
+
+    if (((instruction >> 24) & 0x3F) != 0x08 || ((instruction >> 31) & 0x1) == 0) {
+        TRACE(cpu, "Unknown load/store exclusive instruction: 0x%08x\n", instruction);
+        return;
+    }
+    if ((address & (width - 1)) != 0) { // Exclusives must be naturally aligned
+        TRACE(cpu, "Unaligned exclusive access: address=0x%lx\n", address);
+        cpu->fault = 1;
+        return;
+    }
+    if (!check_access(cpu, address, width)) { return; }
+
+    if (L) { // LDXR/LDAXR: load and open the reservation
+        uint64_t data;
+        if (sf) {
+            data = __atomic_load_n((uint64_t *)(byte_memory + address), o0 ? __ATOMIC_ACQUIRE : __ATOMIC_RELAXED);
+        } else {
+            data = __atomic_load_n((uint32_t *)(byte_memory + address), o0 ? __ATOMIC_ACQUIRE : __ATOMIC_RELAXED);
+        }
+        cpu->exclusive_valid = 1;
+        cpu->exclusive_address = address;
+        cpu->exclusive_value = data;
+        if (Rt != 31) {
+            cpu->regs[Rt] = data;
+        }
+        TRACE(cpu, "Load exclusive: X%d = [0x%lx] (data: 0x%lx)\n", Rt, address, data);
+    } else { // STXR/STLXR: store only if memory still holds the reserved value
+        int success = 0;
+        mark_dirty(cpu, address, width);
+        if (cpu->exclusive_valid && cpu->exclusive_address == address) {
+            int order = o0 ? __ATOMIC_SEQ_CST : __ATOMIC_RELAXED;
+            if (sf) {
+                uint64_t expected = cpu->exclusive_value;
+                success = __atomic_compare_exchange_n((uint64_t *)(byte_memory + address), &expected,
+                                                      cpu->regs[Rt], 0, order, __ATOMIC_RELAXED);
+            } else {
+                uint32_t expected = cpu->exclusive_value;
+                success = __atomic_compare_exchange_n((uint32_t *)(byte_memory + address), &expected,
+                                                      (uint32_t)cpu->regs[Rt], 0, order, __ATOMIC_RELAXED);
+            }
+        }
+        cpu->exclusive_valid = 0;
+        if (Rs != 31) {
+            cpu->regs[Rs] = success ? 0 : 1;
+        }
+        TRACE(cpu, "Store exclusive: [0x%lx] = X%d (%s)\n", address, Rt, success ? "succeeded" : "failed");
+    }
+}
+
+void system_instruction(CPUState *cpu, uint32_t instruction) {
+    uint32_t Rt = instruction & 0x1F;             // Target register (bits 4-0)
+    if ((instruction & 0xFFFFF0FF) == 0xD50330BF) { // DMB <option>
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        TRACE(cpu, "Data memory barrier: option=0x%x\n", (instruction >> 8) & 0xF);
+    } else if ((instruction & 0xFFF00000) == 0xD5300000 && ((instruction >> 5) & 0xFFFF) == MPIDR_EL1) {
+        if (Rt != 31) {
+            cpu->regs[Rt] = cpu->core_id;
+        }
+        TRACE(cpu, "MRS: X%d = MPIDR_EL1 (core %lu)\n", Rt, cpu->core_id);
+    } else {
+        TRACE(cpu, "Unknown system instruction: 0x%08x\n", instruction);
+    }
+}
+
+// 128-bit views of a V register. Element-wise operations on them compile to
+// single host SIMD instructions (SSE2/AVX on x86), with a scalar fallback
+// generated by the compiler elsewhere.
+typedef uint8_t vec_u8 __attribute__((vector_size(16)));
+typedef uint16_t vec_u16 __attribute__((vector_size(16)));
+typedef uint32_t vec_u32 __attribute__((vector_size(16)));
+typedef uint64_t vec_u64 __attribute__((vector_size(16)));
+
+static vec_u64 read_vreg(CPUState *cpu, uint32_t n) {
+    vec_u64 value;
+    memcpy(&value, cpu->vregs[n], sizeof(value));
+    return value;
+}
+
+static void write_vreg(CPUState *cpu, uint32_t n, vec_u64 value, uint32_t Q) {
+    if (!Q) value[1] = 0; // 64-bit arrangements clear the upper half
+    memcpy(cpu->vregs[n], &value, sizeof(value));
+}
+
+// LD1/ST1 (multiple structures) of one register: [Xn] or post-indexed [Xn], #imm / Xm
+void simd_load_store(CPUState *cpu, uint32_t instruction) {
+    uint32_t Q = (instruction >> 30) & 0x1;       // 128-bit flag (bit 30)
+    uint32_t post = (instruction >> 23) & 0x1;    // Post-index flag (bit 23)
+    uint32_t L = (instruction >> 22) & 0x1;       // Load/Store flag (bit 22)
+    uint32_t Rm = (instruction >> 16) & 0x1F;     // Post-index register, 31 for immediate (bits 20-16)
+    uint32_t Xn = (instruction >> 5) & 0x1F;      // Base register (bits 9-5)
+    uint32_t Vt = instruction & 0x1F;             // Vector register (bits 4-0)
+    uint64_t width = Q ? 16 : 8;
+    uint8_t *byte_memory = (uint8_t *)(cpu->memory+MEMORY_OFFSET);
+
+    if ((instruction & 0xBF20F000) != 0x0C007000 || (!post && Rm != 0)) {
+        TRACE(cpu, "Unknown SIMD load/store instruction: 0x%08x\n", instruction);
+        return;
+    }
+    uint64_t address = cpu->regs[Xn];
+    if (!check_access(cpu, address, width)) { return; }
+    if (L) {
+        vec_u64 value = { 0, 0 };
+        memcpy(&value, byte_memory + address, width);
+        write_vreg(cpu, Vt, value, Q);
+        TRACE(cpu, "LD1: V%d = [0x%lx] (%lu bytes)\n", Vt, address, width);
+    } else {
+        mark_dirty(cpu, address, width);
+        memcpy(byte_memory + address, cpu->vregs[Vt], width);
+        TRACE(cpu, "ST1: [0x%lx] = V%d (%lu bytes)\n", address, Vt, width);
+    }
+    if (post) {
+        cpu->regs[Xn] = address + (Rm == 31 ? width : cpu->regs[Rm]);
+        TRACE(cpu, "Post-Indexed: updated base register X%d: 0x%lx\n", Xn, cpu->regs[Xn]);
+    }
+}
+
+// Element-wise ADD (op 0), SUB (op 1) or MUL (op 2) for element size 8 << size bits
+static vec_u64 vector_arithmetic(vec_u64 a, vec_u64 b, uint32_t size, int op) {
+    switch (size) {
+        case 0: {
+            vec_u8 x = (vec_u8)a, y = (vec_u8)b;
+            return (vec_u64)(op == 0 ? x + y : op == 1 ? x - y : x * y);
+        }
+        case 1: {
+            vec_u16 x = (vec_u16)a, y = (vec_u16)b;
+            return (vec_u64)(op == 0 ? x + y : op == 1 ? x - y : x * y);
+        }
+        case 2: {
+            vec_u32 x = (vec_u32)a, y = (vec_u32)b;
+            return (vec_u64)(op == 0 ? x + y : op == 1 ? x - y : x * y);
+        }
+        default:
+            return op == 0 ? a + b : a - b;
+    }
+}
+
+// AdvSIMD integer subset: ADD/SUB/MUL/AND/ORR/EOR (vector), DUP (general), UMOV and ADDV
+void simd_data_processing(CPUState *cpu, uint32_t instruction) {
+    uint32_t Q = (instruction >> 30) & 0x1;       // 128-bit flag (bit 30)
+    uint32_t U = (instruction >> 29) & 0x1;       // Unsigned/alternate flag (bit 29)
+    uint32_t size = (instruction >> 22) & 0x3;    // Element size (bits 23-22)
+    uint32_t Rm = (instruction >> 16) & 0x1F;     // Second operand (bits 20-16)
+    uint32_t Rn = (instruction >> 5) & 0x1F;      // First operand (bits 9-5)
+    uint32_t Rd = instruction & 0x1F;             // Destination (bits 4-0)
+
+    if ((instruction & 0x9F200400) == 0x0E200400) { // Three registers of the same type
+        uint32_t opcode = (instruction >> 11) & 0x1F;
+        vec_u64 a = read_vreg(cpu, Rn), b = read_vreg(cpu, Rm), result;
+        if (opcode == 0x10) { // ADD/SUB
+            result = vector_arithmetic(a, b, size, U);
+        } else if (opcode == 0x13 && !U && size != 3) { // MUL
+            result = vector_arithmetic(a, b, size, 2);
+        } else if (opcode == 0x03 && !U && size == 0) { // AND
+            result = a & b;
+        } else if (opcode == 0x03 && !U && size == 2) { // ORR
+            result = a | b;
+        } else if (opcode == 0x03 && U && size == 0) { // EOR
+            result = a ^ b;
+        } else {
+            TRACE(cpu, "Unknown SIMD instruction: 0x%08x\n", instruction);
+            return;
+        }
+        write_vreg(cpu, Rd, result, Q);
+        TRACE(cpu, "SIMD three-same: V%d = V%d op 0x%x V%d (size %d, Q %d)\n", Rd, Rn, opcode, Rm, size, Q);
+    } else if ((instruction & 0xBFE08400) == 0x0E000400) { // DUP (general) and UMOV
+        uint32_t imm5 = (instruction >> 16) & 0x1F;
+        uint32_t imm4 = (instruction >> 11) & 0xF;
+        uint32_t element = __builtin_ctz(imm5 | 0x10); // log2 of the element size in bytes
+        if (element > 3) {
+            TRACE(cpu, "Unknown SIMD copy: 0x%08x\n", instruction);
+            return;
+        }
+        if (imm4 == 0x1) { // DUP Vd.T, Rn
+            uint64_t value = Rn == 31 ? 0 : cpu->regs[Rn];
+            vec_u64 result;
+            switch (element) {
+                case 0: result = (vec_u64)((vec_u8){ 0 } + (uint8_t)value); break;
+                case 1: result = (vec_u64)((vec_u16){ 0 } + (uint16_t)value); break;
+                case 2: result = (vec_u64)((vec_u32){ 0 } + (uint32_t)value); break;
+                default: result = (vec_u64){ value, value }; break;
+            }
+            write_vreg(cpu, Rd, result, Q);
+            TRACE(cpu, "DUP: V%d = X%d (0x%lx) in %d-byte elements\n", Rd, Rn, value, 1 << element);
+        } else if (imm4 == 0x7) { // UMOV Rd, Vn.T[index]
+            uint32_t index = imm5 >> (element + 1);
+            uint64_t value = 0;
+            memcpy(&value, (uint8_t *)cpu->vregs[Rn] + (index << element), 1 << element);
+            if (Rd != 31) {
+                cpu->regs[Rd] = value;
+            }
+            TRACE(cpu, "UMOV: X%d = V%d[%d] (0x%lx)\n", Rd, Rn, index, value);
+        } else {
+            TRACE(cpu, "Unknown SIMD copy: 0x%08x\n", instruction);
+        }
+    } else if ((instruction & 0xBF3FFC00) == 0x0E31B800 && size != 3) { // ADDV
+        uint32_t bytes = 1 << size;
+        uint64_t sum = 0;
+        for (uint32_t i = 0; i < (Q ? 16 : 8); i += bytes) {
+            uint64_t element = 0;
+            memcpy(&element, (uint8_t *)cpu->vregs[Rn] + i, bytes);
+            sum += element;
+        }
+        sum &= size == 2 ? 0xFFFFFFFF : (1ULL << (8 * bytes)) - 1;
+        write_vreg(cpu, Rd, (vec_u64){ sum, 0 }, 0);
+        TRACE(cpu, "ADDV: V%d = sum of V%d (0x%lx)\n", Rd, Rn, sum);
+    } else {
+        TRACE(cpu, "Unknown SIMD instruction: 0x%08x\n", instruction);
+    }
 }
 
 void decode_and_execute(CPUState *cpu, uint32_t *memory, uint32_t instruction) {
-    printf("\nDecoding instruction at PC=0x%lx: 0x%08x\n", cpu->pc, instruction);
+    TRACE(cpu, "\nDecoding instruction at PC=0x%lx: 0x%08x\n", cpu->pc, instruction);
     if (instruction == HALT) {
-        printf("HALT instruction executed at PC=0x%lx\n", cpu->pc);
+        TRACE(cpu, "HALT instruction executed at PC=0x%lx\n", cpu->pc);
         return;
     }
 
     uint32_t op0 = (instruction >> 25) & 0xF; // Bits 28-25
-    printf("Instruction group: op0=0x%x\n", op0);
+    TRACE(cpu, "Instruction group: op0=0x%x\n", op0);
     switch (op0) {
         case 0x8: // Data Processing (Immediate)
         case 0x9:
@@ -552,69 +985,261 @@ void decode_and_execute(CPUState *cpu, uint32_t *memory, uint32_t instruction) {
         case 0x5: // Data Processing (Register)
             data_processing_register(cpu, instruction);
             break;
-        case 0xd: // Multiply (Register)
-            multiply_instruction(cpu, instruction);
+        case 0xd: // Multiply and Conditional Select (Register)
+            if (((instruction >> 21) & 0xFF) == 0xD4) {
+                conditional_select(cpu, instruction);
+            } else {
+                multiply_instruction(cpu, instruction);
+            }
+            break;
+        case 0x4: // Load/Store Exclusive and Pair
+            if (((instruction >> 27) & 0x7) == 0x5) {
+                load_store_pair(cpu, instruction);
+            } else {
+                load_store_exclusive(cpu, instruction);
+            }
+            break;
+        case 0x6: // SIMD Loads and Stores
+            simd_load_store(cpu, instruction);
             break;
-        case 0x6: // Loads and Stores
-        case 0x7:
-        case 0xC:
+        case 0x7: // SIMD Data Processing
+            simd_data_processing(cpu, instruction);
+            break;
+        case 0xC: // Loads and Stores
             single_data_transfer(cpu, instruction);
             break;
-        case 0xA: // Branches
+        case 0xA: // Branches and System
         case 0xB:
-        printf("Branch instruction: 0x%08x\n", instruction);
+            if ((instruction >> 22) == 0x354) { // Barriers and system registers
+                system_instruction(cpu, instruction);
+                break;
+            }
+        TRACE(cpu, "Branch instruction: 0x%08x\n", instruction);
             branch_instruction(cpu, instruction);  
             break;
         default:
-            printf("Unknown instrucstion group: op0=0x%x\n", op0);
+            TRACE(cpu, "Unknown instrucstion group: op0=0x%x\n", op0);
             break;
     }
 }
 
-void emulate(CPUState *cpu, uint32_t *memory, size_t size) {
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Runs until HALT, the end of the loaded image, a memory fault, max_instructions
+// executed, timeout seconds elapsed (0 disables either limit) or an instruction
+// leaves the PC at stop_pc (NO_STOP_PC disables it)
+RunStatus emulate_until(CPUState *cpu, uint32_t *memory, size_t size, uint64_t max_instructions, double timeout, uint64_t stop_pc) {
+    double deadline = timeout > 0 ? now_seconds() + timeout : 0;
     while (cpu->pc < size * 4) {
+        if (max_instructions && cpu->instructions >= max_instructions) return RUN_LIMIT;
+        if (deadline && (cpu->instructions & 0xFFFF) == 0 && now_seconds() > deadline) return RUN_TIMEOUT;
         uint32_t instruction = memory[cpu->pc / 4];
         decode_and_execute(cpu, memory, instruction);
         cpu->pc += 4; // Increment PC by 4 (size of an instruction)
-        if (instruction == HALT) break;
+        cpu->instructions++;
+        if (instruction == HALT) return RUN_HALT;
+        if (cpu->fault) return RUN_FAULT;
+        if (cpu->pc == stop_pc) return RUN_BREAK;
     }
+    return RUN_END;
 }
 
-void output_state(CPUState *cpu, uint32_t *memory, size_t size) {
-    char pstate_str[5];
-    format_pstate(cpu->pstate, pstate_str);
-    printf("Registers:\n");
-    for (int i = 0; i < 31; i++) {
-        printf("X%02d = %016lx\n", i, cpu->regs[i]);
-    }
-    printf("PC = %016lx\n\n", cpu->pc-4);
-    printf("PSTATE : %s\n", pstate_str);
-    printf("Non-Zero Memory:\n");
-    for (size_t i = 0; i < (MEMORY_SIZE / sizeof(uint32_t)); i++) {
-        if (memory[i] != 0) {
-            printf("0x%08lx: 0x%08x\n", i * 4, memory[i]);
+RunStatus emulate_bounded(CPUState *cpu, uint32_t *memory, size_t size, uint64_t max_instructions, double timeout) {
+    return emulate_until(cpu, memory, size, max_instructions, timeout, NO_STOP_PC);
+}
+
+void emulate(CPUState *cpu, uint32_t *memory, size_t size) {
+    emulate_bounded(cpu, memory, size, 0, 0);
+}
+
+// Returns the name a run status is reported under by batch, lockstep, smp and serve
+const char *run_status_name(RunStatus status) {
+    static const char *names[] = { "halt", "end", "fault", "limit", "timeout", "break" };
+    return (unsigned)status < sizeof(names) / sizeof(names[0]) ? names[status] : "unknown";
+}
+
+// Returns the index of the first non-zero word in memory[start..words), or words if none.
+// Whole 64-byte blocks are tested for all-zero at once so the mostly empty
+// memory is skipped at memory bandwidth instead of word by word.
+static size_t next_nonzero_word(const uint32_t *memory, size_t start, size_t words) {
+    size_t i = start;
+    while (i < words && (i % 16) != 0) { // Scalar head up to a block boundary
+        if (memory[i] != 0) return i;
+        i++;
+    }
+    for (; i + 16 <= words; i += 16) {
+#if defined(__AVX2__)
+        __m256i a = _mm256_loadu_si256((const __m256i *)(memory + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(memory + i + 8));
+        __m256i any = _mm256_or_si256(a, b);
+        if (_mm256_testz_si256(any, any)) continue;
+#elif defined(__SSE2__)
+        __m128i a = _mm_loadu_si128((const __m128i *)(memory + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(memory + i + 4));
+        __m128i c = _mm_loadu_si128((const __m128i *)(memory + i + 8));
+        __m128i d = _mm_loadu_si128((const __m128i *)(memory + i + 12));
+        __m128i any = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, _mm_setzero_si128())) == 0xFFFF) continue;
+#else
+        uint64_t any = 0;
+        for (int j = 0; j < 16; j += 2) {
+            uint64_t pair;
+            memcpy(&pair, memory + i + j, sizeof(pair));
+            any |= pair;
         }
+        if (any == 0) continue;
+#endif
+        break; // Block holds a non-zero word
+    }
+    for (; i < words; i++) { // Scalar search inside the block, or the tail
+        if (memory[i] != 0) return i;
     }
+    return words;
 }
 
-int main(int argc, char **argv) {
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s <binary file> [output file]\n", argv[0]);
-        return EXIT_FAILURE;
+// Writes value as lowercase hex, zero-padded to at least min_digits (like %0*lx)
+static char *put_hex(char *out, uint64_t value, int min_digits) {
+    static const char hex_digits[] = "0123456789abcdef";
+    int digits = 1;
+    while (digits < 16 && (value >> (digits * 4)) != 0) digits++;
+    if (digits < min_digits) digits = min_digits;
+    for (int i = digits - 1; i >= 0; i--) {
+        out[i] = hex_digits[value & 0xF];
+        value >>= 4;
     }
+    return out + digits;
+}
 
-    CPUState cpu;
-    init_cpu(&cpu);
+static char *put_str(char *out, const char *str) {
+    size_t len = strlen(str);
+    memcpy(out, str, len);
+    return out + len;
+}
 
-    size_t size;
-    load_binary(argv[1], memory, &size);
+// Formats the final state dump of one or more cores sharing memory into a
+// malloc'd buffer, returns NULL on failure. With several cores each register
+// block is headed by "Core N:"; a single core gives the classic dump.
+char *format_state(CPUState *cpus, int count, uint32_t *memory, size_t *length) {
+    size_t words = cpus[0].memory_size / sizeof(uint32_t);
+    size_t nonzero = 0; // Sized from a first pass, reserving a line per word would cost MBs
+    for (size_t i = next_nonzero_word(memory, 0, words); i < words; i = next_nonzero_word(memory, i + 1, words)) {
+        nonzero++;
+    }
+    // Every register line plus at most one 16-digit-address line per non-zero word
+    size_t capacity = 1024 * count + nonzero * sizeof("0x0000000000000000: 0x00000000\n");
+    char *buffer = malloc(capacity);
+    if (!buffer) {
+        perror("Error allocating output buffer");
+        return NULL;
+    }
+    char *out = buffer;
+    for (int core = 0; core < count; core++) {
+        CPUState *cpu = &cpus[core];
+        char pstate_str[5];
+        format_pstate(cpu->pstate, pstate_str);
 
-    emulate(&cpu, memory+MEMORY_OFFSET, size);
+        if (count > 1) {
+            out = put_str(out, core ? "\nCore " : "Core ");
+            out += sprintf(out, "%d:\n", core);
+        }
+        out = put_str(out, "Registers:\n");
+        for (int i = 0; i < 31; i++) {
+            *out++ = 'X';
+            *out++ = '0' + i / 10;
+            *out++ = '0' + i % 10;
+            out = put_str(out, " = ");
+            out = put_hex(out, cpu->regs[i], 16);
+            *out++ = '\n';
+        }
+        out = put_str(out, "PC = ");
+        out = put_hex(out, cpu->pc-4, 16); // The last instruction executed, the HALT when halted
+        out = put_str(out, "\n\nPSTATE : ");
+        out = put_str(out, pstate_str);
+        *out++ = '\n';
+    }
+    out = put_str(out, "Non-Zero Memory:\n");
+    for (size_t i = next_nonzero_word(memory, 0, words); i < words; i = next_nonzero_word(memory, i + 1, words)) {
+        out = put_str(out, "0x");
+        out = put_hex(out, i * 4, 8);
+        out = put_str(out, ": 0x");
+        out = put_hex(out, memory[i], 8);
+        *out++ = '\n';
+    }
+    *length = out - buffer;
+    return buffer;
+}
 
-    if (argc == 3) {
-        freopen(argv[2], "w", stdout);
+// Writes the final state dump of one or more cores to fd, returns 0 on failure
+int write_cores_state(int fd, CPUState *cpus, int count, uint32_t *memory) {
+    size_t length;
+    char *buffer = format_state(cpus, count, memory, &length);
+    if (!buffer) {
+        return 0;
     }
-    output_state(&cpu, memory, size);
+    const char *out = buffer + length;
+    const char *pending = buffer;
+    while (pending < out) {
+        ssize_t written = write(fd, pending, out - pending);
+        if (written < 0) {
+            perror("Error writing state");
+            free(buffer);
+            return 0;
+        }
+        pending += written;
+    }
+    free(buffer);
+    return 1;
+}
+
+int write_state(int fd, CPUState *cpu, uint32_t *memory) {
+    return write_cores_state(fd, cpu, 1, memory);
+}
 
-    return EXIT_SUCCESS;
-}
\ No newline at end of file
+void output_state(CPUState *cpu, uint32_t *memory, size_t size) {
+    // Anything already printed through stdio must land before the dump
+    fflush(stdout);
+    write_state(fileno(stdout), cpu, memory);
+}
+
+// Writes a binary snapshot (see snapshot.h), returns 0 on failure
+int write_snapshot(const char *filename, CPUState *cpu, uint32_t *memory) {
+    FILE *file = fopen(filename, "wb");
+    if (!file) {
+        perror("Error opening state file");
+        return 0;
+    }
+    size_t words = cpu->memory_size / sizeof(uint32_t);
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.memory_size = cpu->memory_size;
+    memcpy(header.regs, cpu->regs, sizeof(header.regs));
+    header.pc = cpu->pc - 4; // As in the text dump, see snapshot.h
+    header.pstate = cpu->pstate;
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1; // range_count is patched below
+
+    uint32_t range_count = 0;
+    size_t start = next_nonzero_word(memory, 0, words);
+    while (ok && start < words) {
+        size_t end = start + 1;
+        while (end < words && memory[end] != 0) end++;
+        SnapshotRange range = { start * 4, (end - start) * 4 };
+        ok = fwrite(&range, sizeof(range), 1, file) == 1
+            && fwrite(memory + start, sizeof(uint32_t), end - start, file) == end - start;
+        range_count++;
+        start = next_nonzero_word(memory, end, words);
+    }
+
+    header.range_count = range_count;
+    ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+    if (fclose(file) != 0 || !ok) {
+        perror("Error writing state file");
+        return 0;
+    }
+    return 1;
+}
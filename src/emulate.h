@@ -1,39 +1,86 @@
-#include <stdint.h>
-
-#define MEMORY_SIZE (2 * 1024 * 1024) // 2MB of memory
-#define MEMORY_OFFSET 0 // Offsets by MEMORY_OFFSET * 4 bits
-#define HALT 0x8A000000
-
-#define N_FLAG 3 // Negative
-#define Z_FLAG 2 // Zero
-#define C_FLAG 1 // Carry
-#define V_FLAG 0 // Overflow
-
-typedef struct {
-    uint64_t regs[31]; // General purpose registers X0-X30
-    uint64_t zr;       // Zero register
-    uint64_t pc;       // Program Counter
-    uint32_t pstate;   // Processor state (NZCV)
-} CPUState;
-
-extern uint32_t memory[MEMORY_SIZE / sizeof(uint32_t)];
-
-void load_binary(const char *filename, uint32_t *memory, size_t *size);
-void init_cpu(CPUState *cpu);
-void set_flag(CPUState *cpu, int flag_pos, int condition);
-int check_condition(CPUState *cpu, uint32_t cond);
-void format_pstate(uint8_t pstate, char *buffer);
-void arth_immediate(CPUState *cpu, uint32_t instruction);
-void and_register(CPUState *cpu, uint32_t instruction);
-void move_immediate(CPUState *cpu, uint32_t instruction);
-void data_processing_immediate(CPUState *cpu, uint32_t instruction);
-void apply_shift(uint64_t *value, uint32_t shift_type, uint32_t shift_amount, uint32_t sf);
-void arithmetic_instruction(CPUState *cpu, uint32_t instruction);
-void logical_instruction(CPUState *cpu, uint32_t instruction);
-void multiply_instruction(CPUState *cpu, uint32_t instruction);
-void data_processing_register(CPUState *cpu, uint32_t instruction);
-void single_data_transfer(CPUState *cpu, uint32_t instruction);
-void branch_instruction(CPUState *cpu, uint32_t instruction);
-void decode_and_execute(CPUState *cpu, uint32_t *memory, uint32_t instruction);
-void emulate(CPUState *cpu, uint32_t *memory, size_t size);
-void output_state(CPUState *cpu, uint32_t *memory, size_t size);
\ No newline at end of file
+#include <stdint.h>
+#include <stdio.h>
+
+#define MEMORY_SIZE (2 * 1024 * 1024) // 2MB of memory
+#define MEMORY_OFFSET 0 // Offsets by MEMORY_OFFSET * 4 bits
+#define HALT 0x8A000000
+#define DIRTY_PAGE_SIZE 4096 // Granularity of dirty page tracking
+#define COVERAGE_MAP_SIZE 65536 // Entries in an edge coverage map (AFL's default)
+#define MPIDR_EL1 0xC005 // System register encoding (op0:op1:CRn:CRm:op2) read by MRS
+
+#define N_FLAG 3 // Negative
+#define Z_FLAG 2 // Zero
+#define C_FLAG 1 // Carry
+#define V_FLAG 0 // Overflow
+
+typedef struct {
+    uint64_t regs[31]; // General purpose registers X0-X30
+    uint64_t zr;       // Zero register
+    uint64_t vregs[32][2]; // AdvSIMD registers V0-V31, 128 bits each
+    uint64_t pc;       // Program Counter
+    uint32_t pstate;   // Processor state (NZCV)
+    uint32_t *memory;  // Guest memory of this instance
+    uint64_t memory_size; // Bytes of guest memory, MEMORY_SIZE unless set after init_cpu()
+    FILE *trace;       // Per-instruction trace output, NULL to disable
+    uint64_t instructions; // Instructions executed
+    int fault;         // Set when the guest accessed memory out of range
+    uint64_t core_id;  // Core number reported by MPIDR_EL1
+    int exclusive_valid;        // Reservation opened by LDXR
+    uint64_t exclusive_address; // Address of the reservation
+    uint64_t exclusive_value;   // Value loaded by LDXR
+    uint8_t *dirty_pages;       // One flag per DIRTY_PAGE_SIZE page stored to, NULL to disable
+    uint8_t *coverage;          // Edge hit counts, COVERAGE_MAP_SIZE entries, NULL to disable
+    uint32_t prev_location;     // Previous block for edge coverage
+} CPUState;
+
+typedef enum {
+    RUN_HALT,    // HALT instruction executed
+    RUN_END,     // PC ran past the end of the loaded image
+    RUN_FAULT,   // Out of range memory access
+    RUN_LIMIT,   // Instruction limit reached
+    RUN_TIMEOUT, // Time limit reached
+    RUN_BREAK    // Stop PC reached
+} RunStatus;
+
+// Prints to the CPU's trace stream when tracing is enabled
+#define TRACE(cpu, ...) do { if ((cpu)->trace) fprintf((cpu)->trace, __VA_ARGS__); } while (0)
+
+int load_binary(const char *filename, uint32_t *memory, size_t memory_size, size_t *size);
+void init_cpu(CPUState *cpu, uint32_t *memory, FILE *trace);
+void set_flag(CPUState *cpu, int flag_pos, int condition);
+int check_condition(CPUState *cpu, uint32_t cond);
+void format_pstate(uint8_t pstate, char *buffer);
+void arithmetic_immediate(CPUState *cpu, uint32_t instruction);
+void and_register(CPUState *cpu, uint32_t instruction);
+void move_immediate(CPUState *cpu, uint32_t instruction);
+void bitfield_instruction(CPUState *cpu, uint32_t instruction);
+void data_processing_immediate(CPUState *cpu, uint32_t instruction);
+void apply_shift(uint64_t *value, uint32_t shift_type, uint32_t shift_amount, uint32_t sf);
+void arithmetic_register(CPUState *cpu, uint32_t instruction);
+void logical_instruction(CPUState *cpu, uint32_t instruction);
+void multiply_instruction(CPUState *cpu, uint32_t instruction);
+void conditional_select(CPUState *cpu, uint32_t instruction);
+void data_processing_register(CPUState *cpu, uint32_t instruction);
+void single_data_transfer(CPUState *cpu, uint32_t instruction);
+void record_edge(CPUState *cpu, uint64_t target);
+void branch_instruction(CPUState *cpu, uint32_t instruction);
+void decode_and_execute(CPUState *cpu, uint32_t *memory, uint32_t instruction);
+uint64_t load_guest(uint8_t *address, uint64_t width);
+void store_guest(uint8_t *address, uint64_t width, uint64_t data);
+int check_access(CPUState *cpu, uint64_t address, uint64_t width);
+void mark_dirty(CPUState *cpu, uint64_t address, uint64_t width);
+void load_store_exclusive(CPUState *cpu, uint32_t instruction);
+void load_store_pair(CPUState *cpu, uint32_t instruction);
+void system_instruction(CPUState *cpu, uint32_t instruction);
+void simd_load_store(CPUState *cpu, uint32_t instruction);
+void simd_data_processing(CPUState *cpu, uint32_t instruction);
+#define NO_STOP_PC UINT64_MAX
+RunStatus emulate_until(CPUState *cpu, uint32_t *memory, size_t size, uint64_t max_instructions, double timeout, uint64_t stop_pc);
+RunStatus emulate_bounded(CPUState *cpu, uint32_t *memory, size_t size, uint64_t max_instructions, double timeout);
+void emulate(CPUState *cpu, uint32_t *memory, size_t size);
+const char *run_status_name(RunStatus status);
+char *format_state(CPUState *cpus, int count, uint32_t *memory, size_t *length);
+int write_cores_state(int fd, CPUState *cpus, int count, uint32_t *memory);
+int write_state(int fd, CPUState *cpu, uint32_t *memory);
+void output_state(CPUState *cpu, uint32_t *memory, size_t size);
+int write_snapshot(const char *filename, CPUState *cpu, uint32_t *memory);
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emulate.h"
+#include "libemulate.h"
+#include "libassemble.h"
+#include "batch.h"
+#include "lockstep.h"
+#include "smp.h"
+#include "serve.h"
+#include "fuzz.h"
+
+int main(int argc, char **argv) {
+    const char *binary_file = NULL;
+    const char *output_file = NULL;
+    const char *state_file = NULL;
+    const char *batch_dir = NULL;
+    const char *sweep_file = NULL;
+    int cores = 0;
+    int serve = 0;
+    const char *socket_path = NULL;
+    int jobs = 1;
+    uint64_t max_instructions = 0;
+    double timeout = 0;
+    FuzzOptions fuzz = { NULL, "crashes", 0, 0, 0, 0, 0 };
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--state") == 0 && i + 1 < argc) {
+            state_file = argv[++i];
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch_dir = argv[++i];
+        } else if (strcmp(argv[i], "--sweep") == 0 && i + 1 < argc) {
+            sweep_file = argv[++i];
+        } else if (strcmp(argv[i], "--smp") == 0 && i + 1 < argc) {
+            cores = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--serve") == 0) {
+            serve = 1;
+        } else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--fuzz") == 0 && i + 1 < argc) {
+            fuzz.corpus_dir = argv[++i];
+        } else if (strcmp(argv[i], "--input-address") == 0 && i + 1 < argc) {
+            fuzz.input_address = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--input-size") == 0 && i + 1 < argc) {
+            fuzz.input_size = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--crashes") == 0 && i + 1 < argc) {
+            fuzz.crash_dir = argv[++i];
+        } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            fuzz.iterations = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            fuzz.seed = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--limit") == 0 && i + 1 < argc) {
+            max_instructions = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc) {
+            timeout = atof(argv[++i]);
+        } else if (binary_file == NULL) {
+            binary_file = argv[i];
+        } else if (output_file == NULL) {
+            output_file = argv[i];
+        } else {
+            binary_file = NULL; // Too many arguments
+            break;
+        }
+    }
+    if (serve) {
+        return run_server(socket_path, jobs) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (batch_dir != NULL) {
+        return run_batch(batch_dir, jobs, max_instructions, timeout) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (binary_file == NULL) {
+        fprintf(stderr, "Usage: %s <binary file | source.s> [output file] [--state <state file>] [--limit <instructions>] [--timeout <seconds>]\n"
+                        "       %s --batch <directory> [-j <threads>] [--limit <instructions>] [--timeout <seconds>]\n"
+                        "       %s <binary file> [output prefix] --sweep <registers file> [--limit <instructions>]\n"
+                        "       %s <binary file> [output file] --smp <cores> [--limit <instructions>] [--timeout <seconds>]\n"
+                        "       %s --serve [--socket <path>] [-j <instances>]\n"
+                        "       %s <binary file> --fuzz <corpus dir> --input-address <address> --input-size <bytes>\n"
+                        "          [--crashes <dir>] [--iterations <count>] [--seed <seed>] [--limit <instructions>]\n",
+                argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (cores > 0) {
+        return run_smp(binary_file, output_file, cores, max_instructions, timeout) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (fuzz.corpus_dir != NULL) {
+        fuzz.max_instructions = max_instructions ? max_instructions : 1000000; // Loops must not stall the fuzzer
+        return run_fuzzer(binary_file, &fuzz) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (sweep_file != NULL) {
+        char prefix[1024];
+        snprintf(prefix, sizeof(prefix), "%s.", binary_file);
+        return run_sweep(binary_file, sweep_file, output_file ? output_file : prefix, max_instructions) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    Emulator *emulator = emulator_create(MEMORY_SIZE);
+    if (!emulator) {
+        perror("Error allocating guest memory");
+        return EXIT_FAILURE;
+    }
+    emulator_set_trace(emulator, stdout);
+    size_t length = strlen(binary_file);
+    if (length > 2 && strcmp(binary_file + length - 2, ".s") == 0) { // Assemble in memory, no binary file
+        Assembly assembly;
+        int assembled = assemble_file(binary_file, 1, NULL, &assembly);
+        fputs(assembly.diagnostics, stderr);
+        if (!assembled || !emulator_load_image(emulator, assembly.image, assembly.size)) {
+            return EXIT_FAILURE;
+        }
+        assembly_free(&assembly);
+    } else if (!emulator_load_file(emulator, binary_file)) {
+        return EXIT_FAILURE;
+    }
+
+    emulator_run_until(emulator, EMULATOR_NO_STOP_PC, max_instructions, timeout);
+
+    if (state_file != NULL && !emulator_write_snapshot(emulator, state_file)) {
+        return EXIT_FAILURE;
+    }
+    if (output_file != NULL) {
+        freopen(output_file, "w", stdout);
+    }
+    // Anything already printed through stdio must land before the dump
+    fflush(stdout);
+    emulator_write_state(emulator, fileno(stdout));
+
+    emulator_destroy(emulator);
+    return EXIT_SUCCESS;
+}
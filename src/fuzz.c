@@ -0,0 +1,318 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/shm.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "emulate.h"
+#include "fuzz.h"
+
+#define DIRTY_PAGES (MEMORY_SIZE / DIRTY_PAGE_SIZE)
+#define MAX_HAVOC_STACK 8
+#define MAX_CRASH_PCS 1024
+
+typedef struct {
+    uint8_t *data;
+    size_t length;
+} FuzzInput;
+
+static uint64_t rng_state;
+
+static uint64_t next_random(void) { // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Uses the AFL shared memory map when one is announced, private memory otherwise
+static uint8_t *attach_coverage_map(void) {
+    const char *shm_id = getenv("__AFL_SHM_ID");
+    if (shm_id != NULL) {
+        void *map = shmat(atoi(shm_id), NULL, 0);
+        if (map != (void *)-1) return map;
+        perror("shmat");
+    }
+    return calloc(COVERAGE_MAP_SIZE, 1);
+}
+
+int fuzz_init(FuzzTarget *target, const char *binary_file, const FuzzOptions *options) {
+    memset(target, 0, sizeof(*target));
+    if (options->input_size == 0
+        || options->input_address > MEMORY_SIZE - MEMORY_OFFSET * sizeof(uint32_t)
+        || options->input_size > MEMORY_SIZE - MEMORY_OFFSET * sizeof(uint32_t) - options->input_address) {
+        fprintf(stderr, "Input buffer 0x%lx+0x%lx is not inside guest memory\n", options->input_address, options->input_size);
+        return 0;
+    }
+    target->memory = calloc(MEMORY_SIZE, 1);
+    target->snapshot = calloc(MEMORY_SIZE, 1);
+    target->dirty_pages = calloc(DIRTY_PAGES, 1);
+    target->coverage = attach_coverage_map();
+    if (!target->memory || !target->snapshot || !target->dirty_pages || !target->coverage) {
+        perror("Error allocating fuzz target");
+        return 0;
+    }
+    if (!load_binary(binary_file, target->snapshot, MEMORY_SIZE, &target->size)) {
+        return 0;
+    }
+    memcpy(target->memory, target->snapshot, MEMORY_SIZE);
+    target->input_address = options->input_address;
+    target->input_size = options->input_size;
+    target->max_instructions = options->max_instructions;
+    return 1;
+}
+
+// Restores the snapshot, runs one input and leaves its coverage in target->coverage
+RunStatus fuzz_run(FuzzTarget *target, const uint8_t *input, size_t length) {
+    uint8_t *bytes = (uint8_t *)target->memory;
+    uint8_t *pristine = (uint8_t *)target->snapshot;
+    for (size_t page = 0; page < DIRTY_PAGES; page++) {
+        if (target->dirty_pages[page]) {
+            memcpy(bytes + page * DIRTY_PAGE_SIZE, pristine + page * DIRTY_PAGE_SIZE, DIRTY_PAGE_SIZE);
+            target->dirty_pages[page] = 0;
+        }
+    }
+    if (length > target->input_size) length = target->input_size;
+
+    CPUState *cpu = &target->cpu;
+    init_cpu(cpu, target->memory, NULL);
+    cpu->dirty_pages = target->dirty_pages;
+    cpu->coverage = target->coverage;
+    memset(target->coverage, 0, COVERAGE_MAP_SIZE);
+
+    if (length > 0) {
+        memcpy(bytes + MEMORY_OFFSET * sizeof(uint32_t) + target->input_address, input, length);
+        for (uint64_t a = target->input_address; a < target->input_address + length; a += DIRTY_PAGE_SIZE) {
+            mark_dirty(cpu, a, 1);
+        }
+        mark_dirty(cpu, target->input_address + length - 1, 1);
+    }
+    cpu->regs[0] = length;
+    cpu->regs[1] = target->input_address;
+
+    return emulate_bounded(cpu, target->memory+MEMORY_OFFSET, target->size, target->max_instructions, 0);
+}
+
+void fuzz_free(FuzzTarget *target) {
+    if (getenv("__AFL_SHM_ID") != NULL) {
+        shmdt(target->coverage);
+    } else {
+        free(target->coverage);
+    }
+    free(target->dirty_pages);
+    free(target->snapshot);
+    free(target->memory);
+}
+
+// AFL hit count buckets: 1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128+
+static uint8_t bucket(uint8_t count) {
+    if (count <= 3) return count == 3 ? 4 : count;
+    if (count <= 7) return 8;
+    if (count <= 15) return 16;
+    if (count <= 31) return 32;
+    if (count <= 127) return 64;
+    return 128;
+}
+
+// Returns the number of map entries that reached a bucket not seen before
+static int merge_coverage(const uint8_t *coverage, uint8_t *virgin) {
+    int new_bits = 0;
+    const uint64_t *words = (const uint64_t *)coverage;
+    for (size_t w = 0; w < COVERAGE_MAP_SIZE / sizeof(uint64_t); w++) {
+        if (words[w] == 0) continue; // Most of the map is untouched
+        for (size_t i = w * 8; i < w * 8 + 8; i++) {
+            uint8_t hits = coverage[i] ? bucket(coverage[i]) : 0;
+            if (hits & virgin[i]) {
+                virgin[i] &= ~hits;
+                new_bits++;
+            }
+        }
+    }
+    return new_bits;
+}
+
+static void mutate(FuzzInput *input, const FuzzInput *corpus, size_t corpus_count, size_t capacity) {
+    static const uint8_t interesting8[] = { 0, 1, 0x7F, 0x80, 0xFF, 16, 32, 64, 100 };
+    static const uint32_t interesting32[] = { 0, 1, 0xFFFFFFFF, 0x7FFFFFFF, 0x80000000, 0x10000, 0xFFFF };
+    int stack = 1 + next_random() % MAX_HAVOC_STACK;
+    for (int i = 0; i < stack; i++) {
+        if (input->length == 0) input->length = 1 + next_random() % capacity;
+        size_t at = next_random() % input->length;
+        switch (next_random() % 8) {
+            case 0: input->data[at] ^= 1 << (next_random() % 8); break;                             // Flip a bit
+            case 1: input->data[at] = next_random(); break;                                         // Random byte
+            case 2: input->data[at] = interesting8[next_random() % sizeof(interesting8)]; break;    // Interesting byte
+            case 3: input->data[at] += 1 + next_random() % 16; break;                               // Arithmetic
+            case 4: input->data[at] -= 1 + next_random() % 16; break;
+            case 5: if (input->length >= 4) {                                                       // Interesting word
+                        uint32_t value = interesting32[next_random() % (sizeof(interesting32) / sizeof(uint32_t))];
+                        memcpy(input->data + next_random() % (input->length - 3), &value, 4);
+                    }
+                    break;
+            case 6: input->length = 1 + next_random() % capacity; break;                            // Resize
+            case 7: { // Splice in a chunk of another corpus entry
+                const FuzzInput *other = &corpus[next_random() % corpus_count];
+                if (other->length == 0) break;
+                size_t from = next_random() % other->length;
+                size_t chunk = 1 + next_random() % (other->length - from);
+                if (chunk > input->length - at) chunk = input->length - at;
+                memcpy(input->data + at, other->data + from, chunk);
+                break;
+            }
+        }
+    }
+}
+
+// Input buffers are zeroed so a mutation that grows an input never reads stale bytes
+static void *checked_calloc(size_t count, size_t size) {
+    void *block = calloc(count, size);
+    if (!block) {
+        perror("Error allocating fuzz corpus");
+        exit(EXIT_FAILURE);
+    }
+    return block;
+}
+
+static void grow_corpus(FuzzInput **corpus, size_t *allocated) {
+    *allocated *= 2;
+    FuzzInput *grown = realloc(*corpus, *allocated * sizeof(FuzzInput));
+    if (!grown) {
+        perror("Error allocating fuzz corpus");
+        exit(EXIT_FAILURE);
+    }
+    *corpus = grown;
+}
+
+static int save_input(const char *path, const FuzzInput *input) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        perror(path);
+        return 0;
+    }
+    fwrite(input->data, 1, input->length, file);
+    fclose(file);
+    return 1;
+}
+
+// Reads every non-empty regular file in dir as a seed, truncated to capacity
+static size_t load_corpus(const char *dir, FuzzInput **corpus, size_t *allocated, size_t capacity) {
+    size_t count = 0;
+    DIR *directory = opendir(dir);
+    if (directory) {
+        struct dirent *entry;
+        while ((entry = readdir(directory)) != NULL) {
+            char path[4096];
+            struct stat info;
+            snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+            if (stat(path, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0) continue;
+            FILE *file = fopen(path, "rb");
+            if (!file) continue;
+            if (count == *allocated) grow_corpus(corpus, allocated);
+            FuzzInput *input = &(*corpus)[count];
+            input->data = checked_calloc(capacity, 1);
+            input->length = fread(input->data, 1, capacity, file);
+            fclose(file);
+            if (input->length == 0) { // Emptied since the stat
+                free(input->data);
+                continue;
+            }
+            count++;
+        }
+        closedir(directory);
+    } else {
+        mkdir(dir, 0755);
+    }
+    if (count == 0) { // Start from a small all-zero input
+        FuzzInput *input = &(*corpus)[count++];
+        input->data = checked_calloc(capacity, 1);
+        input->length = capacity < 16 ? capacity : 16;
+    }
+    return count;
+}
+
+int run_fuzzer(const char *binary_file, const FuzzOptions *options) {
+    FuzzTarget target;
+    if (!fuzz_init(&target, binary_file, options)) {
+        return 0;
+    }
+    rng_state = options->seed ? options->seed : (uint64_t)time(NULL) | 1;
+    mkdir(options->crash_dir, 0755);
+
+    size_t capacity = options->input_size;
+    size_t allocated = 64;
+    FuzzInput *corpus = checked_calloc(allocated, sizeof(FuzzInput));
+    size_t corpus_count = load_corpus(options->corpus_dir, &corpus, &allocated, capacity);
+    uint8_t *virgin = checked_calloc(COVERAGE_MAP_SIZE, 1);
+    memset(virgin, 0xFF, COVERAGE_MAP_SIZE);
+    for (size_t i = 0; i < corpus_count; i++) { // Seeds define the baseline coverage
+        fuzz_run(&target, corpus[i].data, corpus[i].length);
+        merge_coverage(target.coverage, virgin);
+    }
+
+    uint64_t crash_pcs[MAX_CRASH_PCS];
+    int crash_pc_count = 0;
+    uint64_t execs = 0, crashes = 0, hangs = 0, finds = 0;
+    FuzzInput candidate = { checked_calloc(capacity, 1), 0 };
+    double start = now_seconds(), last_report = start;
+
+    while (options->iterations == 0 || execs < options->iterations) {
+        const FuzzInput *parent = &corpus[next_random() % corpus_count];
+        memcpy(candidate.data, parent->data, parent->length);
+        candidate.length = parent->length;
+        mutate(&candidate, corpus, corpus_count, capacity);
+
+        RunStatus status = fuzz_run(&target, candidate.data, candidate.length);
+        execs++;
+        if (status == RUN_FAULT) {
+            crashes++;
+            uint64_t pc = target.cpu.pc - 4; // The faulting instruction
+            int known = 0;
+            for (int i = 0; i < crash_pc_count; i++) known |= crash_pcs[i] == pc;
+            if (!known && crash_pc_count < MAX_CRASH_PCS) {
+                crash_pcs[crash_pc_count++] = pc;
+                char path[4096];
+                snprintf(path, sizeof(path), "%s/crash-%08lx-%06lu", options->crash_dir, pc, execs);
+                save_input(path, &candidate);
+                fprintf(stderr, "crash: fault at PC=0x%lx, input saved to %s\n", pc, path);
+            }
+        } else if (status == RUN_LIMIT) {
+            hangs++;
+        }
+        if (merge_coverage(target.coverage, virgin) && status != RUN_FAULT) {
+            if (corpus_count == allocated) grow_corpus(&corpus, &allocated);
+            FuzzInput *find = &corpus[corpus_count++];
+            find->data = checked_calloc(capacity, 1);
+            memcpy(find->data, candidate.data, candidate.length);
+            find->length = candidate.length;
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/id-%06lu", options->corpus_dir, finds++);
+            save_input(path, find);
+        }
+
+        double now = now_seconds();
+        if (now - last_report >= 1.0) {
+            fprintf(stderr, "execs %lu (%.0f/s), corpus %zu, crashes %lu (%d unique), hangs %lu\n",
+                    execs, execs / (now - start), corpus_count, crashes, crash_pc_count, hangs);
+            last_report = now;
+        }
+    }
+    double elapsed = now_seconds() - start;
+    fprintf(stderr, "execs %lu (%.0f/s), corpus %zu, crashes %lu (%d unique), hangs %lu\n",
+            execs, elapsed > 0 ? execs / elapsed : 0, corpus_count, crashes, crash_pc_count, hangs);
+
+    for (size_t i = 0; i < corpus_count; i++) {
+        free(corpus[i].data);
+    }
+    free(corpus);
+    free(candidate.data);
+    free(virgin);
+    fuzz_free(&target);
+    return 1;
+}
@@ -0,0 +1,41 @@
+#include <stdint.h>
+
+// In-process fuzzing: `emulate <binary> --fuzz <corpus dir> --input-address <a>
+// --input-size <n>` loads the binary once, snapshots the initial state and then
+// for every input restores the snapshot (only pages dirtied by the previous
+// run are copied back), writes the input to the guest buffer at <a>, sets
+// X0 = input length and X1 = <a>, and runs to HALT or the instruction limit.
+//
+// Edge coverage is recorded AFL-style from branch_instruction() into a 64 KB
+// map. When __AFL_SHM_ID is set the map is the SysV shared memory segment it
+// names, so external tools see it; otherwise it is private. The built-in
+// driver mutates inputs from the corpus, keeps those reaching new edges (saved
+// as <corpus dir>/id-NNNNNN) and saves inputs that fault to the crash
+// directory as crash-<faulting PC>-NNNNNN, one per faulting PC.
+
+typedef struct {
+    const char *corpus_dir;     // Seed inputs, new finds are added here
+    const char *crash_dir;      // Where faulting inputs are saved
+    uint64_t input_address;     // Guest address of the input buffer
+    uint64_t input_size;        // Capacity of the input buffer in bytes
+    uint64_t max_instructions;  // Per-input instruction limit (hangs)
+    uint64_t iterations;        // Inputs to run, 0 for no limit
+    uint64_t seed;              // Random seed, 0 to seed from the clock
+} FuzzOptions;
+
+typedef struct {
+    CPUState cpu;
+    uint32_t *memory;           // Working guest memory
+    uint32_t *snapshot;         // Guest memory right after loading
+    uint8_t *dirty_pages;       // Pages that differ from the snapshot
+    uint8_t *coverage;          // Edge hit counts of the last run
+    size_t size;                // Image size in words
+    uint64_t input_address;
+    uint64_t input_size;
+    uint64_t max_instructions;
+} FuzzTarget;
+
+int fuzz_init(FuzzTarget *target, const char *binary_file, const FuzzOptions *options);
+RunStatus fuzz_run(FuzzTarget *target, const uint8_t *input, size_t length);
+void fuzz_free(FuzzTarget *target);
+int run_fuzzer(const char *binary_file, const FuzzOptions *options);
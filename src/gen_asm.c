@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Synthetic assembly generator for assembler benchmarks:
+// `gen_asm <lines> [seed]` writes <lines> lines of source to stdout. The mix
+// follows generated code: mostly data processing and loads/stores, a label
+// every few lines, forward and backward b/b.cond to nearby labels, literal
+// loads of labels and .int data words. Every referenced label is defined.
+
+#define BRANCH_WINDOW 16 // Labels a branch may jump over
+
+static unsigned long long rng_state;
+
+static unsigned next_random(void) { // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (rng_state * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+static const char *reg(int sf) {
+    static char names[4][8];
+    static int next = 0;
+    char *name = names[next++ & 3];
+    sprintf(name, "%c%u", sf ? 'x' : 'w', next_random() % 31);
+    return name;
+}
+
+static const char *conditions[] = { "eq", "ne", "ge", "lt", "gt", "le" };
+static const char *shifts[] = { "lsl", "lsr", "asr" };
+
+int main(int argc, char **argv) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s <lines> [seed]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    long lines = atol(argv[1]);
+    rng_state = argc > 2 ? strtoull(argv[2], NULL, 0) : 1;
+    if (rng_state == 0) rng_state = 1;
+
+    long labels = 0;           // Labels defined so far (L0 .. L<labels-1>)
+    long max_referenced = -1;  // Highest label number used by a forward reference
+    long line = 0;
+    while (line < lines) {
+        unsigned sf = next_random() & 1;
+        unsigned kind = next_random() % 100;
+        if (kind < 12) { // Label
+            printf("L%ld:\n", labels++);
+        } else if (kind < 35) { // Arithmetic, immediate or shifted register
+            static const char *ops[] = { "add", "adds", "sub", "subs" };
+            const char *op = ops[next_random() % 4];
+            if (next_random() & 1) {
+                printf("  %s %s, %s, #%u\n", op, reg(sf), reg(sf), next_random() % 4096);
+            } else {
+                printf("  %s %s, %s, %s, %s #%u\n", op, reg(sf), reg(sf), reg(sf),
+                       shifts[next_random() % 3], next_random() % (sf ? 64 : 32));
+            }
+        } else if (kind < 47) { // Logical
+            static const char *ops[] = { "and", "orr", "eor", "bic", "ands", "eon" };
+            printf("  %s %s, %s, %s\n", ops[next_random() % 6], reg(sf), reg(sf), reg(sf));
+        } else if (kind < 57) { // Wide moves
+            static const char *ops[] = { "movz", "movk", "movn" };
+            printf("  %s %s, #0x%x, lsl #%u\n", ops[next_random() % 3], reg(sf), next_random() & 0xFFFF,
+                   (next_random() % (sf ? 4 : 2)) * 16);
+        } else if (kind < 62) { // Multiply
+            static const char *ops[] = { "madd", "msub" };
+            printf("  %s %s, %s, %s, %s\n", ops[next_random() % 2], reg(sf), reg(sf), reg(sf), reg(sf));
+        } else if (kind < 64) { // Compare
+            printf("  cmp %s, %s\n", reg(sf), reg(sf));
+        } else if (kind < 80) { // Loads and stores
+            const char *op = next_random() & 1 ? "ldr" : "str";
+            switch (next_random() % 4) {
+                case 0: printf("  %s %s, [%s, #%u]\n", op, reg(sf), reg(1), (next_random() % 256) * (sf ? 8 : 4)); break;
+                case 1: printf("  %s %s, [%s, #%d]!\n", op, reg(sf), reg(1), (int)(next_random() % 256) - 128); break;
+                case 2: printf("  %s %s, [%s], #%d\n", op, reg(sf), reg(1), (int)(next_random() % 256) - 128); break;
+                default: printf("  %s %s, [%s, %s]\n", op, reg(sf), reg(1), reg(1)); break;
+            }
+        } else if (kind < 84 && labels > 0) { // Literal load of a defined label
+            printf("  ldr %s, L%ld\n", reg(sf), labels - 1 - next_random() % (labels < BRANCH_WINDOW ? labels : BRANCH_WINDOW));
+        } else if (kind < 96) { // Branch, forward or backward
+            long target;
+            if (labels > 0 && (next_random() & 1)) {
+                target = labels - 1 - next_random() % (labels < BRANCH_WINDOW ? labels : BRANCH_WINDOW);
+            } else {
+                target = labels + next_random() % BRANCH_WINDOW;
+                if (target > max_referenced) max_referenced = target;
+            }
+            if (next_random() % 4 == 0) {
+                printf("  b L%ld\n", target);
+            } else {
+                printf("  b.%s L%ld\n", conditions[next_random() % 6], target);
+            }
+        } else { // Data word
+            printf("  .int 0x%x\n", next_random());
+        }
+        line++;
+    }
+    while (labels <= max_referenced) { // Define labels still referenced forward
+        printf("L%ld:\n", labels++);
+    }
+    printf("  and x0, x0, x0\n");
+    return EXIT_SUCCESS;
+}
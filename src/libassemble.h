@@ -0,0 +1,61 @@
+#include <stdint.h>
+#include <stdio.h>
+
+// Assembler library: link assemble.o and assemble a source held in memory or a
+// file straight to an image, without an intermediate binary file. The assembler
+// keeps its working state in globals, so assemblies must not overlap; -j style
+// threading happens inside one call. Running out of memory exits the process.
+
+#define ASSEMBLY_SYMBOL_GLOBAL 1    // Exported with .global
+#define ASSEMBLY_SYMBOL_UNDEFINED 2 // Referenced but left to the linker (assemble_object only)
+
+typedef struct {
+    char *name;
+    uint64_t address;         // 0 if undefined
+    int flags;                // ASSEMBLY_SYMBOL_*
+} AssemblySymbol;
+
+// Label offset the linker fills in once the undefined symbol has an address
+typedef struct {
+    size_t index;             // Image word holding the offset field
+    int bits;                 // Field width: 26 for b, 19 for b.cond and ldr literal
+    size_t symbol;            // Index of the undefined label in symbols
+} AssemblyRelocation;
+
+typedef struct {
+    uint32_t *image;          // Encoded words, NULL if the assembly failed
+    size_t size;              // Image size in bytes
+    AssemblySymbol *symbols;  // Defined labels, ordered by address
+    size_t symbol_count;
+    AssemblyRelocation *relocations; // Empty unless assembled by assemble_object
+    size_t relocation_count;
+    char *diagnostics;        // Errors, warnings and -O notes, one per line, "" if none
+    int errors;
+} Assembly;
+
+// Assemble length bytes of source text (no terminating NUL needed) or a file
+// ("-" for stdin) on threads threads, tracing every instruction to trace (NULL
+// to disable). Return 0 if the source has errors, described in diagnostics.
+// The Assembly must be released with assembly_free() either way. A source that
+// loads literals with ldr = is assembled on one thread, its pools laid out in order.
+int assemble_source(const char *source, size_t length, int threads, FILE *trace, Assembly *assembly);
+int assemble_file(const char *filename, int threads, FILE *trace, Assembly *assembly);
+void assembly_free(Assembly *assembly);
+
+// Assemble a file as one relocatable object: references to labels it does not
+// define become relocations instead of errors, and symbols lists only its
+// .global labels and those undefined labels. Always single-threaded; separate
+// objects can be assembled concurrently by separate processes.
+int assemble_object(const char *filename, FILE *trace, Assembly *assembly);
+
+// Enables the peephole pass (assemble -O) for the following assemblies: it
+// removes and merges redundant instructions in straight-line code, moves
+// labels and branches to match and adds a summary note to diagnostics. Code
+// must only take addresses through labels; .int words are never changed.
+// Watch mode does not optimize.
+void assemble_set_optimize(int enabled);
+
+// Assembles input into output, then keeps the source, symbol table and
+// encodings resident and reassembles only the lines that changed whenever
+// input is modified, patching output in place. Returns only on a fatal error.
+int assemble_watch(const char *input, const char *output);
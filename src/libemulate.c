@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emulate.h"
+#include "libemulate.h"
+
+struct Emulator {
+    CPUState cpu;
+    uint32_t *memory;
+    size_t memory_size; // Bytes
+    size_t size;        // Loaded image size in words
+};
+
+Emulator *emulator_create(size_t memory_size) {
+    Emulator *emulator = calloc(1, sizeof(Emulator));
+    if (!emulator) {
+        return NULL;
+    }
+    emulator->memory_size = (memory_size + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+    emulator->memory = calloc(emulator->memory_size ? emulator->memory_size : sizeof(uint32_t), 1);
+    if (!emulator->memory) {
+        free(emulator);
+        return NULL;
+    }
+    emulator_reset(emulator);
+    return emulator;
+}
+
+void emulator_destroy(Emulator *emulator) {
+    if (emulator) {
+        free(emulator->memory);
+        free(emulator);
+    }
+}
+
+void emulator_reset(Emulator *emulator) {
+    FILE *trace = emulator->cpu.trace;
+    init_cpu(&emulator->cpu, emulator->memory, trace);
+    emulator->cpu.memory_size = emulator->memory_size;
+}
+
+// Zeroes the guest memory after the image just loaded, so nothing a previous
+// image or its run stored survives into the next one
+static void clear_after_image(Emulator *emulator) {
+    size_t used = (MEMORY_OFFSET + emulator->size) * sizeof(uint32_t);
+    memset((uint8_t *)emulator->memory + used, 0, emulator->memory_size - used);
+}
+
+int emulator_load_image(Emulator *emulator, const void *image, size_t length) {
+    if (!emulator_write_memory(emulator, 0, image, length)) {
+        return 0;
+    }
+    emulator->size = length / sizeof(uint32_t);
+    clear_after_image(emulator);
+    emulator_reset(emulator);
+    return 1;
+}
+
+int emulator_load_file(Emulator *emulator, const char *filename) {
+    if (!load_binary(filename, emulator->memory, emulator->memory_size, &emulator->size)) {
+        return 0;
+    }
+    clear_after_image(emulator);
+    emulator_reset(emulator);
+    return 1;
+}
+
+void emulator_set_trace(Emulator *emulator, FILE *trace) {
+    emulator->cpu.trace = trace;
+}
+
+uint64_t emulator_get_register(Emulator *emulator, int index) {
+    return index >= 0 && index < 31 ? emulator->cpu.regs[index] : 0;
+}
+
+void emulator_set_register(Emulator *emulator, int index, uint64_t value) {
+    if (index >= 0 && index < 31) {
+        emulator->cpu.regs[index] = value;
+    }
+}
+
+uint64_t emulator_get_pc(Emulator *emulator) {
+    return emulator->cpu.pc;
+}
+
+void emulator_set_pc(Emulator *emulator, uint64_t pc) {
+    emulator->cpu.pc = pc;
+}
+
+uint32_t emulator_get_pstate(Emulator *emulator) {
+    return emulator->cpu.pstate;
+}
+
+void emulator_set_pstate(Emulator *emulator, uint32_t pstate) {
+    emulator->cpu.pstate = pstate;
+}
+
+uint64_t emulator_instructions(Emulator *emulator) {
+    return emulator->cpu.instructions;
+}
+
+size_t emulator_memory_size(Emulator *emulator) {
+    return emulator->memory_size;
+}
+
+int emulator_read_memory(Emulator *emulator, uint64_t address, void *buffer, size_t length) {
+    uint8_t *guest = (uint8_t *)(emulator->memory+MEMORY_OFFSET);
+    size_t limit = emulator->memory_size - MEMORY_OFFSET * sizeof(uint32_t);
+    if (address > limit || length > limit - address) {
+        return 0;
+    }
+    memcpy(buffer, guest + address, length);
+    return 1;
+}
+
+int emulator_write_memory(Emulator *emulator, uint64_t address, const void *buffer, size_t length) {
+    uint8_t *guest = (uint8_t *)(emulator->memory+MEMORY_OFFSET);
+    size_t limit = emulator->memory_size - MEMORY_OFFSET * sizeof(uint32_t);
+    if (address > limit || length > limit - address) {
+        return 0;
+    }
+    memcpy(guest + address, buffer, length);
+    return 1;
+}
+
+// The public statuses are RunStatus under stable names
+_Static_assert(EMULATOR_HALT == (int)RUN_HALT && EMULATOR_END == (int)RUN_END && EMULATOR_FAULT == (int)RUN_FAULT
+    && EMULATOR_LIMIT == (int)RUN_LIMIT && EMULATOR_TIMEOUT == (int)RUN_TIMEOUT && EMULATOR_BREAK == (int)RUN_BREAK,
+    "EmulatorStatus must match RunStatus");
+_Static_assert(EMULATOR_NO_STOP_PC == NO_STOP_PC, "EMULATOR_NO_STOP_PC must match NO_STOP_PC");
+
+EmulatorStatus emulator_step(Emulator *emulator, uint64_t count) {
+    if (count == 0) {
+        return EMULATOR_LIMIT; // All of none ran; a limit of 0 would mean no limit
+    }
+    return emulator_run_until(emulator, EMULATOR_NO_STOP_PC, emulator->cpu.instructions + count, 0);
+}
+
+EmulatorStatus emulator_run_until(Emulator *emulator, uint64_t stop_pc, uint64_t max_instructions, double timeout) {
+    emulator->cpu.fault = 0;
+    return (EmulatorStatus)emulate_until(&emulator->cpu, emulator->memory+MEMORY_OFFSET, emulator->size, max_instructions, timeout, stop_pc);
+}
+
+char *emulator_format_state(Emulator *emulator, size_t *length) {
+    return format_state(&emulator->cpu, 1, emulator->memory, length);
+}
+
+int emulator_write_state(Emulator *emulator, int fd) {
+    return write_state(fd, &emulator->cpu, emulator->memory);
+}
+
+int emulator_write_snapshot(Emulator *emulator, const char *filename) {
+    return write_snapshot(filename, &emulator->cpu, emulator->memory);
+}
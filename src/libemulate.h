@@ -0,0 +1,67 @@
+#include <stdint.h>
+#include <stdio.h>
+
+// Embeddable emulator: `make libemulate.a libemulate.so` and include this
+// header. Every Emulator owns its CPU state and guest memory and the library
+// keeps no global state, so independent instances may run concurrently on
+// different threads. One instance must not be used from two threads at once.
+
+typedef struct Emulator Emulator;
+
+// Why a run stopped
+typedef enum {
+    EMULATOR_HALT,    // HALT instruction executed
+    EMULATOR_END,     // PC ran past the end of the loaded image
+    EMULATOR_FAULT,   // Out of range memory access
+    EMULATOR_LIMIT,   // Instruction limit reached
+    EMULATOR_TIMEOUT, // Time limit reached
+    EMULATOR_BREAK    // Stop PC reached
+} EmulatorStatus;
+
+#define EMULATOR_NO_STOP_PC UINT64_MAX
+
+// Creates an instance with memory_size bytes of zeroed guest memory (rounded
+// up to a whole word), returns NULL on failure
+Emulator *emulator_create(size_t memory_size);
+void emulator_destroy(Emulator *emulator);
+
+// Copies an image to address 0, zeroes the rest of guest memory and resets the
+// CPU. Execution stops with EMULATOR_END once the PC leaves the image. Return 0
+// on failure, leaving the previous image loaded.
+int emulator_load_image(Emulator *emulator, const void *image, size_t length);
+int emulator_load_file(Emulator *emulator, const char *filename);
+void emulator_reset(Emulator *emulator);
+
+// Per-instruction trace output, NULL (the default) to disable
+void emulator_set_trace(Emulator *emulator, FILE *trace);
+
+// Index 0-30 selects X0-X30, 31 the zero register
+uint64_t emulator_get_register(Emulator *emulator, int index);
+void emulator_set_register(Emulator *emulator, int index, uint64_t value);
+uint64_t emulator_get_pc(Emulator *emulator);
+void emulator_set_pc(Emulator *emulator, uint64_t pc);
+uint32_t emulator_get_pstate(Emulator *emulator);
+void emulator_set_pstate(Emulator *emulator, uint32_t pstate);
+uint64_t emulator_instructions(Emulator *emulator);
+size_t emulator_memory_size(Emulator *emulator);
+
+// Copy guest memory, return 0 if the range is not inside guest memory
+int emulator_read_memory(Emulator *emulator, uint64_t address, void *buffer, size_t length);
+int emulator_write_memory(Emulator *emulator, uint64_t address, const void *buffer, size_t length);
+
+// Executes count instructions, returns EMULATOR_LIMIT when all of them ran
+// (immediately when count is 0)
+EmulatorStatus emulator_step(Emulator *emulator, uint64_t count);
+// Runs until HALT, the end of the image or a fault. Also stops with
+// EMULATOR_BREAK when an instruction leaves the PC at stop_pc, before executing
+// it, so a run started at stop_pc executes at least one instruction
+// (EMULATOR_NO_STOP_PC disables this), with EMULATOR_LIMIT once the instance
+// has executed max_instructions in total and with EMULATOR_TIMEOUT after
+// timeout seconds (0 disables either limit)
+EmulatorStatus emulator_run_until(Emulator *emulator, uint64_t stop_pc, uint64_t max_instructions, double timeout);
+
+// State export: the text dump printed by the CLI (malloc'd, caller frees),
+// written to a file descriptor, or a binary snapshot file (see snapshot.h)
+char *emulator_format_state(Emulator *emulator, size_t *length);
+int emulator_write_state(Emulator *emulator, int fd);
+int emulator_write_snapshot(Emulator *emulator, const char *filename);
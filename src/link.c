@@ -0,0 +1,198 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "object.h"
+
+// Linker for objects written by `assemble -c`:
+// `link <object file>... <output file | ->` places the objects one after the
+// other in command line order, resolves every relocation against the .global
+// labels of all objects and writes the flat image.
+
+typedef struct {
+    const char *filename;
+    ObjectHeader header;
+    uint32_t *words;
+    ObjectSymbol *symbols;
+    ObjectRelocation *relocations;
+    char *strings;
+    uint32_t base; // Word index of the object in the image
+} Object;
+
+typedef struct {
+    const char *name;
+    uint32_t address; // Word index in the image
+    const Object *object;
+} GlobalSymbol;
+
+static void *read_part(FILE *file, size_t count, size_t size) {
+    void *data = malloc(count * size + 1);
+    if (data && fread(data, size, count, file) != count) {
+        free(data);
+        return NULL;
+    }
+    return data;
+}
+
+int load_object(const char *filename, Object *object) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        perror(filename);
+        return 0;
+    }
+    ObjectHeader *header = &object->header;
+    object->filename = filename;
+    if (fread(header, sizeof(*header), 1, file) != 1
+        || memcmp(header->magic, OBJECT_MAGIC, sizeof(header->magic)) != 0
+        || header->version != OBJECT_VERSION) {
+        fprintf(stderr, "%s: not an object file\n", filename);
+        fclose(file);
+        return 0;
+    }
+    object->words = read_part(file, header->word_count, sizeof(uint32_t));
+    object->symbols = read_part(file, header->symbol_count, sizeof(ObjectSymbol));
+    object->relocations = read_part(file, header->relocation_count, sizeof(ObjectRelocation));
+    object->strings = read_part(file, header->string_size, 1);
+    fclose(file);
+    if (!object->words || !object->symbols || !object->relocations || !object->strings) {
+        fprintf(stderr, "%s: truncated object file\n", filename);
+        return 0;
+    }
+    object->strings[header->string_size] = '\0';
+    for (uint32_t i = 0; i < header->symbol_count; i++) {
+        ObjectSymbol *symbol = &object->symbols[i];
+        if (symbol->name >= header->string_size || ((symbol->flags & OBJECT_SYMBOL_GLOBAL) && symbol->value > header->word_count)) {
+            fprintf(stderr, "%s: corrupt symbol %u\n", filename, i);
+            return 0;
+        }
+    }
+    for (uint32_t i = 0; i < header->relocation_count; i++) {
+        ObjectRelocation *relocation = &object->relocations[i];
+        if (relocation->index >= header->word_count || relocation->symbol >= header->symbol_count
+            || (relocation->bits != 26 && relocation->bits != 19)) {
+            fprintf(stderr, "%s: corrupt relocation %u\n", filename, i);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int compare_globals(const void *a, const void *b) {
+    return strcmp(((const GlobalSymbol *)a)->name, ((const GlobalSymbol *)b)->name);
+}
+
+// Patches the signed word offset from index to target into a b (imm26) or
+// b.cond/ldr literal (imm19) field, returns 0 if it does not fit
+int patch_offset(uint32_t *image, uint32_t index, uint32_t target, uint32_t bits) {
+    int64_t offset = (int64_t)target - index;
+    if (offset < -(1LL << (bits - 1)) || offset >= 1LL << (bits - 1)) {
+        return 0;
+    }
+    uint32_t mask = (1u << bits) - 1;
+    int shift = bits == 26 ? 0 : 5;
+    image[index] = (image[index] & ~(mask << shift)) | (((uint32_t)offset & mask) << shift);
+    return 1;
+}
+
+// Writes a whole buffer, retrying short writes, returns 0 on failure
+static int write_all(int fd, const void *data, size_t length) {
+    const char *p = data;
+    while (length > 0) {
+        ssize_t written = write(fd, p, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        p += written;
+        length -= written;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <object file>... <output file | ->\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int count = argc - 2;
+    Object *objects = calloc(count, sizeof(Object));
+    if (!objects) {
+        perror("Error allocating objects");
+        return EXIT_FAILURE;
+    }
+    size_t words = 0, global_count = 0;
+    for (int i = 0; i < count; i++) {
+        if (!load_object(argv[i + 1], &objects[i])) {
+            return EXIT_FAILURE;
+        }
+        objects[i].base = words;
+        words += objects[i].header.word_count;
+        global_count += objects[i].header.symbol_count;
+    }
+
+    // Exports of all objects, sorted by name to find duplicates and look up relocations
+    GlobalSymbol *globals = malloc((global_count ? global_count : 1) * sizeof(GlobalSymbol));
+    uint32_t *image = malloc((words ? words : 1) * sizeof(uint32_t));
+    if (!globals || !image) {
+        perror("Error allocating image");
+        return EXIT_FAILURE;
+    }
+    global_count = 0;
+    for (int i = 0; i < count; i++) {
+        Object *object = &objects[i];
+        memcpy(image + object->base, object->words, object->header.word_count * sizeof(uint32_t));
+        for (uint32_t j = 0; j < object->header.symbol_count; j++) {
+            ObjectSymbol *symbol = &object->symbols[j];
+            if (symbol->flags & OBJECT_SYMBOL_GLOBAL) {
+                globals[global_count++] = (GlobalSymbol){ object->strings + symbol->name, object->base + symbol->value, object };
+            }
+        }
+    }
+    qsort(globals, global_count, sizeof(GlobalSymbol), compare_globals);
+    int errors = 0;
+    for (size_t i = 1; i < global_count; i++) {
+        if (strcmp(globals[i - 1].name, globals[i].name) == 0) {
+            fprintf(stderr, "Duplicate symbol: %s in %s and %s\n", globals[i].name, globals[i - 1].object->filename,
+                    globals[i].object->filename);
+            errors++;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        Object *object = &objects[i];
+        for (uint32_t j = 0; j < object->header.relocation_count; j++) {
+            ObjectRelocation *relocation = &object->relocations[j];
+            GlobalSymbol key = { object->strings + object->symbols[relocation->symbol].name, 0, NULL };
+            GlobalSymbol *target = bsearch(&key, globals, global_count, sizeof(GlobalSymbol), compare_globals);
+            if (!target) {
+                fprintf(stderr, "Undefined symbol: %s in %s\n", key.name, object->filename);
+                errors++;
+            } else if (!patch_offset(image, object->base + relocation->index, target->address, relocation->bits)) {
+                fprintf(stderr, "Offset out of range: %s in %s\n", key.name, object->filename);
+                errors++;
+            }
+        }
+    }
+    if (errors) {
+        return EXIT_FAILURE;
+    }
+
+    const char *output = argv[argc - 1];
+    int fd = strcmp(output, "-") == 0 ? STDOUT_FILENO : open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || !write_all(fd, image, words * sizeof(uint32_t)) || close(fd) != 0) {
+        perror(output);
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < count; i++) {
+        free(objects[i].words);
+        free(objects[i].symbols);
+        free(objects[i].relocations);
+        free(objects[i].strings);
+    }
+    free(objects);
+    free(globals);
+    free(image);
+    return EXIT_SUCCESS;
+}
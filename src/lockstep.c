@@ -0,0 +1,453 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "emulate.h"
+#include "lockstep.h"
+
+// Lanes advance together while they share a PC. When a conditional branch
+// diverges, the lanes with the lowest PC run first (masked) and the others
+// wait, so the groups meet again at the first common PC after the branch.
+//
+// Data processing and branch instructions run vectorised over all lanes. Loads,
+// stores and anything else fall back to the scalar handlers lane by lane, which
+// keeps every lane bit-for-bit identical to a run of the scalar emulator.
+
+#define MASK32 0xFFFFFFFFULL
+
+static inline lane_u64 splat(uint64_t value) {
+    return (lane_u64){ 0 } + value;
+}
+
+// Blends result into dest for the lanes selected by mask (all ones or all zeros)
+static inline lane_u64 blend(lane_u64 dest, lane_u64 result, lane_u64 mask) {
+    return (result & mask) | (dest & ~mask);
+}
+
+static inline lane_u64 set_flag_lanes(lane_u64 pstate, int flag_pos, lane_u64 condition) {
+    return (pstate & ~(1ULL << flag_pos)) | ((condition & 1) << flag_pos);
+}
+
+// Vector counterpart of check_condition(): all-ones lanes where cond holds
+static lane_u64 check_condition_lanes(lane_u64 pstate, uint32_t cond) {
+    lane_u64 N = (pstate >> N_FLAG) & 1;
+    lane_u64 Z = (pstate >> Z_FLAG) & 1;
+    lane_u64 C = (pstate >> C_FLAG) & 1;
+    lane_u64 V = (pstate >> V_FLAG) & 1;
+    lane_u64 holds;
+
+    switch (cond) {
+        case 0x0: holds = Z; break;                     // EQ
+        case 0x1: holds = Z ^ 1; break;                 // NE
+        case 0x2: holds = C; break;                     // CS/HS
+        case 0x3: holds = C ^ 1; break;                 // CC/LO
+        case 0x4: holds = N; break;                     // MI
+        case 0x5: holds = N ^ 1; break;                 // PL
+        case 0x6: holds = V; break;                     // VS
+        case 0x7: holds = V ^ 1; break;                 // VC
+        case 0x8: holds = C & (Z ^ 1); break;           // HI
+        case 0x9: holds = (C ^ 1) | Z; break;           // LS
+        case 0xA: holds = (N ^ V) ^ 1; break;           // GE
+        case 0xB: holds = N ^ V; break;                 // LT
+        case 0xC: holds = (Z ^ 1) & ((N ^ V) ^ 1); break; // GT
+        case 0xD: holds = Z | (N ^ V); break;           // LE
+        case 0xE: holds = splat(1); break;              // AL
+        default: holds = splat(0); break;               // NV
+    }
+    return 0 - holds;
+}
+
+static lane_u64 apply_shift_lanes(lane_u64 value, uint32_t shift_type, uint32_t shift_amount, uint32_t sf) {
+    if (sf == 0) { // 32-bit mode
+        value &= MASK32;
+        switch (shift_type) {
+            case 0: value <<= shift_amount; break;
+            case 1: value >>= shift_amount; break;
+            case 2: value = (lane_u64)(((lane_s64)(value << 32) >> 32) >> shift_amount); break;
+            case 3: if (shift_amount) value = (value >> shift_amount) | (value << (32 - shift_amount)); break;
+        }
+        return value & MASK32;
+    }
+    switch (shift_type) {
+        case 0: value <<= shift_amount; break;
+        case 1: value >>= shift_amount; break;
+        case 2: value = (lane_u64)((lane_s64)value >> shift_amount); break;
+        case 3: if (shift_amount) value = (value >> shift_amount) | (value << (64 - shift_amount)); break;
+    }
+    return value;
+}
+
+// Signed lane comparisons, all-ones where true
+static inline lane_u64 positive(lane_u64 value) { return (lane_u64)((lane_s64)value > 0); }
+static inline lane_u64 negative(lane_u64 value) { return (lane_u64)((lane_s64)value < 0); }
+
+// Flags of ADDS/SUBS as computed by arithmetic_immediate() and arithmetic_register()
+static lane_u64 arithmetic_flags(lane_u64 pstate, uint32_t opc, uint32_t sf, lane_u64 operand1, lane_u64 operand2, lane_u64 result, lane_u64 carry) {
+    lane_u64 sign = sf ? result >> 63 : (result >> 31) & 1;
+    pstate = set_flag_lanes(pstate, N_FLAG, sign);
+    pstate = set_flag_lanes(pstate, Z_FLAG, (lane_u64)(result == 0));
+    pstate = set_flag_lanes(pstate, C_FLAG, carry);
+    lane_u64 overflow;
+    if (opc == 0x1) {
+        overflow = (positive(operand1) & positive(operand2) & negative(result))
+                 | (negative(operand1) & negative(operand2) & positive(result));
+    } else {
+        overflow = (positive(operand1) & negative(operand2) & negative(result))
+                 | (negative(operand1) & positive(operand2) & positive(result));
+    }
+    return set_flag_lanes(pstate, V_FLAG, overflow);
+}
+
+static void arithmetic_immediate_lanes(LockstepState *state, uint32_t instruction, lane_u64 mask) {
+    uint32_t sf = (instruction >> 31) & 0x1;
+    uint32_t rd = (instruction >> 0) & 0x1F;
+    uint32_t rn = (instruction >> 5) & 0x1F;
+    uint32_t imm12 = (instruction >> 10) & 0xFFF;
+    uint32_t sh = (instruction >> 22) & 1;
+    uint32_t opc = (instruction >> 29) & 0x3;
+
+    lane_u64 operand1 = state->regs[rn];
+    lane_u64 operand2 = splat((sh == 1) ? (imm12 << 12) : imm12);
+    lane_u64 result = (opc & 0x2) ? operand1 - operand2 : operand1 + operand2;
+    if (sf == 0) result &= MASK32;
+
+    if (opc == 0x1) {
+        lane_u64 carry = (lane_u64)(operand1 > UINT64_MAX - operand2);
+        state->pstate = blend(state->pstate, arithmetic_flags(state->pstate, opc, sf, operand1, operand2, result, carry), mask);
+    } else if (opc == 0x3) {
+        lane_u64 carry = (lane_u64)(operand1 >= operand2);
+        state->pstate = blend(state->pstate, arithmetic_flags(state->pstate, opc, sf, operand1, operand2, result, carry), mask);
+    }
+    if (rd != 31) {
+        state->regs[rd] = blend(state->regs[rd], result, mask);
+    }
+}
+
+static void move_immediate_lanes(LockstepState *state, uint32_t instruction, lane_u64 mask) {
+    uint32_t sf = (instruction >> 31) & 0x1;
+    uint32_t rd = (instruction >> 0) & 0x1F;
+    uint32_t imm16 = (instruction >> 5) & 0xFFFF;
+    uint32_t hw = (instruction >> 21) & 0x3;
+    uint32_t opc = (instruction >> 29) & 0x3;
+    uint64_t shifted_imm16 = (uint64_t)imm16 << (hw * 16);
+    if (rd == 31) return;
+
+    lane_u64 result = state->regs[rd];
+    switch (opc) {
+        case 0x0: result = splat(~shifted_imm16); break;                                // movn
+        case 0x2: result = splat(shifted_imm16); break;                                 // movz
+        case 0x3: result = (result & ~(0xFFFFULL << (hw * 16))) | shifted_imm16; break; // movk
+    }
+    if (sf == 0) result &= MASK32;
+    state->regs[rd] = blend(state->regs[rd], result, mask);
+}
+
+static void arithmetic_register_lanes(LockstepState *state, uint32_t instruction, lane_u64 mask) {
+    uint32_t sf = (instruction >> 31) & 0x1;
+    uint32_t rd = (instruction >> 0) & 0x1F;
+    uint32_t rn = (instruction >> 5) & 0x1F;
+    uint32_t rm = (instruction >> 16) & 0x1F;
+    uint32_t operand = (instruction >> 10) & 0x3F;
+    uint32_t shift = (instruction >> 22) & 0x3;
+    uint32_t opc = (instruction >> 29) & 0x3;
+
+    lane_u64 operand_value = apply_shift_lanes(state->regs[rm], shift, operand, sf);
+    lane_u64 operand1 = state->regs[rn];
+    if (sf == 0) operand1 &= MASK32;
+
+    lane_u64 result = (opc & 0x2) ? operand1 - operand_value : operand1 + operand_value;
+    if (sf == 0) result &= MASK32;
+
+    if (opc == 0x1) {
+        lane_u64 carry = (lane_u64)(result < operand1);
+        state->pstate = blend(state->pstate, arithmetic_flags(state->pstate, opc, sf, operand1, operand_value, result, carry), mask);
+    } else if (opc == 0x3) {
+        lane_u64 carry = (lane_u64)(operand1 >= operand_value);
+        state->pstate = blend(state->pstate, arithmetic_flags(state->pstate, opc, sf, operand1, operand_value, result, carry), mask);
+    }
+    if (rd != 31) {
+        state->regs[rd] = blend(state->regs[rd], result, mask);
+    }
+}
+
+static void logical_lanes(LockstepState *state, uint32_t instruction, lane_u64 mask) {
+    uint32_t sf = (instruction >> 31) & 0x1;
+    uint32_t rd = (instruction >> 0) & 0x1F;
+    uint32_t rn = (instruction >> 5) & 0x1F;
+    uint32_t rm = (instruction >> 16) & 0x1F;
+    uint32_t operand = (instruction >> 10) & 0x3F;
+    uint32_t shift = (instruction >> 22) & 0x3;
+    uint32_t N = (instruction >> 21) & 0x1;
+    uint32_t opc = (instruction >> 29) & 0x3;
+
+    lane_u64 operand_value = apply_shift_lanes(state->regs[rm], shift, operand, sf);
+    if (N) operand_value = ~operand_value;
+    lane_u64 operand1 = state->regs[rn];
+    if (sf == 0) operand1 &= MASK32;
+
+    lane_u64 result;
+    switch (opc) {
+        case 0x1: result = operand1 | operand_value; break; // ORR/ORN
+        case 0x2: result = operand1 ^ operand_value; break; // EOR/EON
+        default: result = operand1 & operand_value; break;  // AND/BIC, ANDS/BICS
+    }
+    if (opc == 0x3) {
+        lane_u64 pstate = state->pstate;
+        pstate = set_flag_lanes(pstate, N_FLAG, sf ? result >> 63 : (result >> 31) & 1);
+        pstate = set_flag_lanes(pstate, Z_FLAG, (lane_u64)(result == 0));
+        pstate &= ~((1ULL << C_FLAG) | (1ULL << V_FLAG));
+        state->pstate = blend(state->pstate, pstate, mask);
+    }
+    if (sf == 0) result &= MASK32;
+    if (rd != 31) {
+        state->regs[rd] = blend(state->regs[rd], result, mask);
+    }
+}
+
+static void multiply_lanes(LockstepState *state, uint32_t instruction, lane_u64 mask) {
+    uint32_t sf = (instruction >> 31) & 0x1;
+    uint32_t rm = (instruction >> 16) & 0x1F;
+    uint32_t ra = (instruction >> 10) & 0x1F;
+    uint32_t x = (instruction >> 15) & 0x1;
+    uint32_t rn = (instruction >> 5) & 0x1F;
+    uint32_t rd = instruction & 0x1F;
+    if (rd == 31) return;
+
+    lane_u64 product = state->regs[rn] * state->regs[rm];
+    lane_u64 accumulate = state->regs[ra];
+    if (sf == 0) {
+        product &= MASK32;
+        accumulate &= MASK32;
+    }
+    lane_u64 result = x ? accumulate - product : accumulate + product;
+    if (sf == 0) result &= MASK32;
+    state->regs[rd] = blend(state->regs[rd], result, mask);
+}
+
+// Executes one instruction vectorised for the lanes in mask, returns 0 when it
+// has no vector handler. PCs are advanced here, including for branches.
+static int execute_lanes(LockstepState *state, uint32_t instruction, lane_u64 mask) {
+    uint32_t op0 = (instruction >> 25) & 0xF;
+    if (op0 == 0x8 || op0 == 0x9) {
+        uint32_t opcode = (instruction >> 23) & 0x7;
+        if (opcode == 0x2) {
+            arithmetic_immediate_lanes(state, instruction, mask);
+        } else if (opcode == 0x5 && ((instruction >> 29) & 0x3) != 0x1) {
+            move_immediate_lanes(state, instruction, mask);
+        } else {
+            return 0;
+        }
+    } else if (op0 == 0x5) {
+        if ((instruction >> 24) & 0x1) {
+            arithmetic_register_lanes(state, instruction, mask);
+        } else {
+            logical_lanes(state, instruction, mask);
+        }
+    } else if (op0 == 0xD && ((instruction >> 21) & 0xFF) == 0xD8) {
+        multiply_lanes(state, instruction, mask);
+    } else if (op0 == 0xA || op0 == 0xB) {
+        uint32_t op = (instruction >> 26) & 0x3F;
+        if (op == 0x05) { // Unconditional branch
+            int64_t offset = (((int64_t)(instruction & 0x3FFFFFF) << 38) >> 38) << 2;
+            state->pc = blend(state->pc, state->pc + offset, mask);
+        } else if (op == 0x15) { // Conditional branch, taken lanes jump, the rest fall through
+            int32_t simm19 = (instruction >> 5) & 0x7FFFF;
+            int64_t offset = (((int64_t)simm19 << 45) >> 45) << 2;
+            lane_u64 taken = check_condition_lanes(state->pstate, instruction & 0xF);
+            state->pc = blend(state->pc, state->pc + (offset & taken) + (4 & ~taken), mask);
+        } else {
+            return 0;
+        }
+        return 1;
+    } else {
+        return 0;
+    }
+    state->pc = blend(state->pc, state->pc + 4, mask);
+    return 1;
+}
+
+void lockstep_init(LockstepState *state, uint32_t **memory, uint32_t lanes) {
+    memset(state, 0, sizeof(*state));
+    for (uint32_t lane = 0; lane < LOCKSTEP_LANES; lane++) {
+        state->memory[lane] = memory[lane];
+        state->pstate[lane] = 0x4; // Z flag set, as init_cpu()
+    }
+    state->active = lanes >= LOCKSTEP_LANES ? (1U << LOCKSTEP_LANES) - 1 : (1U << lanes) - 1;
+}
+
+void lockstep_extract(LockstepState *state, int lane, CPUState *cpu) {
+    init_cpu(cpu, state->memory[lane], NULL);
+    for (int i = 0; i < 31; i++) cpu->regs[i] = state->regs[i][lane];
+    memcpy(cpu->vregs, state->vregs[lane], sizeof(cpu->vregs));
+    cpu->pc = state->pc[lane];
+    cpu->pstate = state->pstate[lane];
+    cpu->instructions = state->instructions[lane];
+    cpu->exclusive_valid = state->exclusive_valid[lane];
+    cpu->exclusive_address = state->exclusive_address[lane];
+    cpu->exclusive_value = state->exclusive_value[lane];
+}
+
+void lockstep_insert(LockstepState *state, int lane, CPUState *cpu) {
+    for (int i = 0; i < 31; i++) state->regs[i][lane] = cpu->regs[i];
+    memcpy(state->vregs[lane], cpu->vregs, sizeof(cpu->vregs));
+    state->pc[lane] = cpu->pc;
+    state->pstate[lane] = cpu->pstate;
+    state->exclusive_valid[lane] = cpu->exclusive_valid;
+    state->exclusive_address[lane] = cpu->exclusive_address;
+    state->exclusive_value[lane] = cpu->exclusive_value;
+}
+
+void lockstep_run(LockstepState *state, size_t size, uint64_t max_instructions) {
+    while (state->active) {
+        // Retire lanes that left the image or ran out of instructions
+        for (int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+            if (!(state->active & (1U << lane))) continue;
+            if (state->pc[lane] >= size * 4) {
+                state->status[lane] = RUN_END;
+                state->active &= ~(1U << lane);
+            } else if (max_instructions && state->instructions[lane] >= max_instructions) {
+                state->status[lane] = RUN_LIMIT;
+                state->active &= ~(1U << lane);
+            }
+        }
+        if (!state->active) break;
+
+        // Lowest PC first, restricted to lanes fetching the same word there
+        int first = -1;
+        for (int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+            if ((state->active & (1U << lane)) && (first < 0 || state->pc[lane] < state->pc[first])) first = lane;
+        }
+        uint64_t pc = state->pc[first];
+        uint32_t instruction = state->memory[first][pc / 4];
+        uint32_t lanes = 0;
+        lane_u64 mask = splat(0);
+        for (int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+            if ((state->active & (1U << lane)) && state->pc[lane] == pc && state->memory[lane][pc / 4] == instruction) {
+                lanes |= 1U << lane;
+                mask[lane] = ~0ULL;
+                state->instructions[lane]++;
+            }
+        }
+
+        if (instruction == HALT) {
+            state->pc = blend(state->pc, state->pc + 4, mask);
+            for (int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+                if (lanes & (1U << lane)) state->status[lane] = RUN_HALT;
+            }
+            state->active &= ~lanes;
+        } else if (!execute_lanes(state, instruction, mask)) {
+            for (int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+                if (!(lanes & (1U << lane))) continue;
+                CPUState cpu;
+                lockstep_extract(state, lane, &cpu);
+                decode_and_execute(&cpu, cpu.memory, instruction);
+                cpu.pc += 4;
+                lockstep_insert(state, lane, &cpu);
+                if (cpu.fault) {
+                    state->status[lane] = RUN_FAULT;
+                    state->active &= ~(1U << lane);
+                }
+            }
+        }
+    }
+}
+
+// Parses one line of "xN=value" assignments into the registers of cpu, returns 0 if blank
+static int parse_registers(char *line, CPUState *cpu) {
+    int found = 0;
+    for (char *token = strtok(line, " \t\n"); token != NULL; token = strtok(NULL, " \t\n")) {
+        char *equals = strchr(token, '=');
+        int reg = atoi(token + 1);
+        if ((token[0] != 'x' && token[0] != 'X') || equals == NULL || reg < 0 || reg > 30) {
+            fprintf(stderr, "Ignoring register assignment: %s\n", token);
+            continue;
+        }
+        cpu->regs[reg] = strtoull(equals + 1, NULL, 0);
+        found = 1;
+    }
+    return found;
+}
+
+// Runs binary_file once per line of registers_file, LOCKSTEP_LANES instances at
+// a time. The state of instance i is written to <prefix><i>.out.
+int run_sweep(const char *binary_file, const char *registers_file, const char *prefix, uint64_t max_instructions) {
+    FILE *registers = fopen(registers_file, "r");
+    if (!registers) {
+        perror(registers_file);
+        return 0;
+    }
+    uint32_t *image = calloc(MEMORY_SIZE, 1);
+    if (!image) {
+        perror("Error allocating guest memory");
+        exit(EXIT_FAILURE);
+    }
+    size_t size;
+    if (!load_binary(binary_file, image, MEMORY_SIZE, &size)) {
+        fclose(registers);
+        free(image);
+        return 0;
+    }
+    uint32_t *memory[LOCKSTEP_LANES];
+    for (int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+        memory[lane] = malloc(MEMORY_SIZE);
+        if (!memory[lane]) {
+            perror("Error allocating guest memory");
+            exit(EXIT_FAILURE);
+        }
+    }
+    LockstepState *state = aligned_alloc(sizeof(lane_u64), sizeof(LockstepState));
+    if (!state) {
+        perror("Error allocating lockstep state");
+        exit(EXIT_FAILURE);
+    }
+
+    int ok = 1;
+    int instance = 0;
+    int done = 0;
+    char line[1024];
+    while (!done) {
+        // Gather the next group of instances
+        CPUState initial[LOCKSTEP_LANES];
+        uint32_t lanes = 0;
+        while (lanes < LOCKSTEP_LANES) {
+            if (!fgets(line, sizeof(line), registers)) {
+                done = 1;
+                break;
+            }
+            init_cpu(&initial[lanes], memory[lanes], NULL);
+            if (parse_registers(line, &initial[lanes])) lanes++;
+        }
+        if (lanes == 0) break;
+
+        lockstep_init(state, memory, lanes);
+        for (uint32_t lane = 0; lane < lanes; lane++) {
+            memcpy(memory[lane], image, MEMORY_SIZE);
+            lockstep_insert(state, lane, &initial[lane]);
+        }
+        lockstep_run(state, size, max_instructions);
+
+        for (uint32_t lane = 0; lane < lanes; lane++, instance++) {
+            CPUState cpu;
+            lockstep_extract(state, lane, &cpu);
+            char output_file[1024];
+            snprintf(output_file, sizeof(output_file), "%s%d.out", prefix, instance);
+            int fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0 || !write_state(fd, &cpu, cpu.memory)) {
+                perror(output_file);
+                ok = 0;
+            }
+            if (fd >= 0) close(fd);
+            printf("instance %d: %s (%lu instructions)\n", instance, run_status_name(state->status[lane]), state->instructions[lane]);
+            if (state->status[lane] != RUN_HALT && state->status[lane] != RUN_END) ok = 0;
+        }
+    }
+
+    free(state);
+    for (int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+        free(memory[lane]);
+    }
+    free(image);
+    fclose(registers);
+    return ok;
+}
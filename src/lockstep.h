@@ -0,0 +1,34 @@
+#include <stdint.h>
+
+// Include emulate.h before this header for CPUState and RunStatus.
+
+// Number of guest instances executed together. 8 lanes of 64-bit registers
+// fill one AVX-512 register (two AVX2 registers), 16 lanes fill two.
+#ifndef LOCKSTEP_LANES
+#define LOCKSTEP_LANES 8
+#endif
+
+typedef uint64_t lane_u64 __attribute__((vector_size(LOCKSTEP_LANES * sizeof(uint64_t))));
+typedef int64_t lane_s64 __attribute__((vector_size(LOCKSTEP_LANES * sizeof(int64_t))));
+
+// CPU state of LOCKSTEP_LANES instances in struct-of-arrays form: regs[i]
+// holds register Xi of every instance, so a handler updates all lanes at once.
+typedef struct {
+    lane_u64 regs[32];     // X0-X30 across lanes, regs[31] is the zero register
+    lane_u64 pc;           // Program Counter of each lane
+    lane_u64 pstate;       // Processor state (NZCV) of each lane
+    uint64_t vregs[LOCKSTEP_LANES][32][2]; // V0-V31 of each lane, only used by scalar fallback
+    uint32_t *memory[LOCKSTEP_LANES]; // Guest memory of each lane
+    uint64_t instructions[LOCKSTEP_LANES]; // Instructions executed per lane
+    int exclusive_valid[LOCKSTEP_LANES];        // Reservation of each lane's LDXR, see CPUState
+    uint64_t exclusive_address[LOCKSTEP_LANES];
+    uint64_t exclusive_value[LOCKSTEP_LANES];
+    RunStatus status[LOCKSTEP_LANES];
+    uint32_t active;       // Bit mask of lanes still running
+} LockstepState;
+
+void lockstep_init(LockstepState *state, uint32_t **memory, uint32_t lanes);
+void lockstep_extract(LockstepState *state, int lane, CPUState *cpu);
+void lockstep_insert(LockstepState *state, int lane, CPUState *cpu);
+void lockstep_run(LockstepState *state, size_t size, uint64_t max_instructions);
+int run_sweep(const char *binary_file, const char *registers_file, const char *prefix, uint64_t max_instructions);
@@ -0,0 +1,41 @@
+#include <stdint.h>
+
+// Relocatable object written by `assemble -c` and combined into a flat image by
+// link. All fields are stored in host byte order.
+//
+//   ObjectHeader
+//   word_count x uint32_t        encoded words, label offsets to other objects 0
+//   symbol_count x ObjectSymbol
+//   relocation_count x ObjectRelocation
+//   string_size bytes            NUL-terminated symbol names
+//
+// Labels defined and referenced in the same object are already resolved. The
+// symbols are the labels exported with .global and the labels the object
+// references but does not define; only references to the latter are relocated.
+
+#define OBJECT_MAGIC "A64O"
+#define OBJECT_VERSION 1
+
+#define OBJECT_SYMBOL_GLOBAL 1    // Defined here and visible to other objects
+#define OBJECT_SYMBOL_UNDEFINED 2 // Defined by another object
+
+typedef struct {
+    char magic[4];             // OBJECT_MAGIC
+    uint32_t version;          // OBJECT_VERSION
+    uint32_t word_count;
+    uint32_t symbol_count;
+    uint32_t relocation_count;
+    uint32_t string_size;
+} ObjectHeader;
+
+typedef struct {
+    uint32_t name;             // Offset of the name in the string table
+    uint32_t value;            // Word index of a defined symbol, 0 otherwise
+    uint32_t flags;            // OBJECT_SYMBOL_*
+} ObjectSymbol;
+
+typedef struct {
+    uint32_t index;            // Word holding the offset field
+    uint32_t bits;             // Field width: 26 for b (bits 0-25), 19 for b.cond and ldr literal (bits 5-23)
+    uint32_t symbol;           // Index of the target in the symbol table
+} ObjectRelocation;
@@ -0,0 +1,320 @@
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "emulate.h"
+#include "serve.h"
+
+#define DIRTY_PAGES (MEMORY_SIZE / DIRTY_PAGE_SIZE)
+#define MAX_JOB_LINE (1024 * 1024) // Inline images make for long lines
+
+typedef struct Instance {
+    CPUState cpu;
+    uint32_t *memory;
+    uint8_t dirty_pages[DIRTY_PAGES];
+    struct Instance *next; // Next free instance in the pool
+} Instance;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t available;
+    Instance *free;
+} Pool;
+
+typedef struct {
+    Pool *pool;
+    int fd;
+} Connection;
+
+// Jobs read from one input by one or more workers. The workers take turns to
+// read a line, run their jobs concurrently and write each reply whole.
+typedef struct {
+    Pool *pool;
+    FILE *in;
+    int out;
+    pthread_mutex_t input;  // Guards in, next_job and closed
+    pthread_mutex_t output; // Keeps the replies of concurrent jobs apart
+    long next_job;
+    int closed;             // A reply could not be written, stop reading
+} Stream;
+
+static Instance *acquire_instance(Pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->free == NULL) {
+        pthread_cond_wait(&pool->available, &pool->lock);
+    }
+    Instance *instance = pool->free;
+    pool->free = instance->next;
+    pthread_mutex_unlock(&pool->lock);
+    return instance;
+}
+
+static void release_instance(Pool *pool, Instance *instance) {
+    pthread_mutex_lock(&pool->lock);
+    instance->next = pool->free;
+    pool->free = instance;
+    pthread_cond_signal(&pool->available);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Zeroes only the pages written since the last reset
+static void reset_instance(Instance *instance) {
+    uint8_t *bytes = (uint8_t *)instance->memory;
+    for (size_t page = 0; page < DIRTY_PAGES; page++) {
+        if (instance->dirty_pages[page]) {
+            memset(bytes + page * DIRTY_PAGE_SIZE, 0, DIRTY_PAGE_SIZE);
+            instance->dirty_pages[page] = 0;
+        }
+    }
+    init_cpu(&instance->cpu, instance->memory, NULL);
+    instance->cpu.dirty_pages = instance->dirty_pages;
+}
+
+// Returns 0 when the reader went away (EPIPE) or the write failed otherwise
+static int write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0 && errno == EINTR) continue;
+        if (written < 0) return 0;
+        data += written;
+        length -= written;
+    }
+    return 1;
+}
+
+// Writes a reply and its optional body as one unit, returns 0 on failure
+static int send_reply(Stream *stream, const char *reply, size_t length, const char *body, size_t body_length) {
+    pthread_mutex_lock(&stream->output);
+    int sent = write_all(stream->out, reply, length) && write_all(stream->out, body, body_length);
+    pthread_mutex_unlock(&stream->output);
+    return sent;
+}
+
+static int send_error(Stream *stream, long job, const char *message) {
+    char reply[256];
+    int length = snprintf(reply, sizeof(reply), "error %ld %s\n", job, message);
+    return send_reply(stream, reply, length, NULL, 0);
+}
+
+// Parses an inline image of comma-separated hex words. On failure the words
+// written so far are cleared again and *size is left as it was.
+static int parse_image(const char *text, uint32_t *memory, size_t *size) {
+    size_t words = 0;
+    while (*text != '\0') {
+        char *end;
+        uint32_t word = strtoul(text, &end, 16);
+        if (end == text || words >= MEMORY_SIZE / sizeof(uint32_t) - MEMORY_OFFSET) {
+            memset(memory + MEMORY_OFFSET, 0, words * sizeof(uint32_t));
+            return 0;
+        }
+        memory[MEMORY_OFFSET + words++] = word;
+        text = (*end == ',') ? end + 1 : end;
+    }
+    *size = words;
+    return 1;
+}
+
+// Returns the register number of an x<n> field name, -1 if it names no register
+static int register_field(const char *field) {
+    if (field[0] != 'x' || !isdigit((unsigned char)field[1])) return -1;
+    char *end;
+    long reg = strtol(field + 1, &end, 10);
+    return *end == '\0' && reg <= 30 ? (int)reg : -1; // The '=' was cut off already
+}
+
+// Runs one job and writes its reply, returns 0 if the reply could not be written
+static int run_job(Instance *instance, char *line, long job, Stream *stream) {
+    reset_instance(instance);
+    CPUState *cpu = &instance->cpu;
+    uint64_t max_instructions = 0;
+    double timeout = 0;
+    size_t size = 0;
+    int loaded = 0;
+
+    for (char *field = strtok(line, " \t\r\n"); field != NULL; field = strtok(NULL, " \t\r\n")) {
+        char *value = strchr(field, '=');
+        if (value == NULL) {
+            return send_error(stream, job, "malformed field");
+        }
+        *value++ = '\0';
+        if (strcmp(field, "binary") == 0 || strcmp(field, "image") == 0) {
+            loaded = field[0] == 'b' ? load_binary(value, instance->memory, MEMORY_SIZE, &size)
+                                     : parse_image(value, instance->memory, &size);
+            // Loading writes memory behind the dirty tracking's back, a failed load writes nothing
+            for (size_t page = 0; loaded && page < DIRTY_PAGES
+                                  && page * DIRTY_PAGE_SIZE < (MEMORY_OFFSET + size) * sizeof(uint32_t); page++) {
+                instance->dirty_pages[page] = 1;
+            }
+        } else if (strcmp(field, "limit") == 0) {
+            max_instructions = strtoull(value, NULL, 0);
+        } else if (strcmp(field, "timeout") == 0) {
+            timeout = atof(value);
+        } else if (register_field(field) >= 0) {
+            cpu->regs[register_field(field)] = strtoull(value, NULL, 0);
+        } else {
+            return send_error(stream, job, "unknown field");
+        }
+    }
+    if (!loaded) {
+        return send_error(stream, job, "no loadable image");
+    }
+
+    RunStatus status = emulate_bounded(cpu, instance->memory+MEMORY_OFFSET, size, max_instructions, timeout);
+
+    size_t length;
+    char *dump = format_state(cpu, 1, instance->memory, &length);
+    if (dump == NULL) {
+        return send_error(stream, job, "out of memory");
+    }
+    char header[128];
+    int header_length = snprintf(header, sizeof(header), "result %ld %s %lu %zu\n", job, run_status_name(status), cpu->instructions, length);
+    int sent = send_reply(stream, header, header_length, dump, length);
+    free(dump);
+    return sent;
+}
+
+static void *stream_worker(void *arg) {
+    Stream *stream = arg;
+    char *line = malloc(MAX_JOB_LINE);
+    if (!line) {
+        perror("Error allocating job line");
+        exit(EXIT_FAILURE);
+    }
+    for (;;) {
+        long job = -1;
+        pthread_mutex_lock(&stream->input);
+        while (!stream->closed && fgets(line, MAX_JOB_LINE, stream->in)) {
+            if (strspn(line, " \t\r\n") != strlen(line)) { // Not a blank line
+                job = stream->next_job++;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&stream->input);
+        if (job < 0) break;
+
+        Instance *instance = acquire_instance(stream->pool);
+        int sent = run_job(instance, line, job, stream);
+        release_instance(stream->pool, instance);
+        if (!sent) {
+            pthread_mutex_lock(&stream->input);
+            stream->closed = 1;
+            pthread_mutex_unlock(&stream->input);
+            break;
+        }
+    }
+    free(line);
+    return NULL;
+}
+
+// Serves jobs read from in on up to workers instances at once, until end of
+// file or until a reply cannot be written to out, which ends only this stream.
+// Replies come in the order the jobs finish, tagged with their job numbers.
+static void serve_stream(Pool *pool, FILE *in, int out, int workers) {
+    Stream stream = { .pool = pool, .in = in, .out = out };
+    pthread_mutex_init(&stream.input, NULL);
+    pthread_mutex_init(&stream.output, NULL);
+    pthread_t *threads = malloc(workers * sizeof(pthread_t));
+    if (!threads) {
+        perror("Error allocating workers");
+        exit(EXIT_FAILURE);
+    }
+    int started = 0;
+    for (int i = 1; i < workers; i++) { // This thread is the first worker
+        int error = pthread_create(&threads[started], NULL, stream_worker, &stream);
+        if (error != 0) { // Serve with the workers there are
+            fprintf(stderr, "Error creating worker thread: %s\n", strerror(error));
+            break;
+        }
+        started++;
+    }
+    stream_worker(&stream);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    pthread_mutex_destroy(&stream.input);
+    pthread_mutex_destroy(&stream.output);
+}
+
+static void *connection_main(void *arg) {
+    Connection *connection = arg;
+    FILE *in = fdopen(connection->fd, "r");
+    if (in) {
+        serve_stream(connection->pool, in, connection->fd, 1);
+        fclose(in); // Also closes the socket
+    } else {
+        close(connection->fd);
+    }
+    free(connection);
+    return NULL;
+}
+
+int run_server(const char *socket_path, int instances) {
+    if (instances < 1) instances = 1;
+    signal(SIGPIPE, SIG_IGN); // A client that hangs up must not take the server down
+
+    Pool pool;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.available, NULL);
+    pool.free = NULL;
+    for (int i = 0; i < instances; i++) { // Memory starts zeroed, nothing is dirty
+        Instance *instance = calloc(1, sizeof(Instance));
+        if (!instance || !(instance->memory = calloc(MEMORY_SIZE, 1))) {
+            perror("Error allocating guest memory");
+            return 0;
+        }
+        release_instance(&pool, instance);
+    }
+
+    if (socket_path == NULL) {
+        serve_stream(&pool, stdin, fileno(stdout), instances);
+        while (pool.free != NULL) { // Every job is done, all instances are back
+            Instance *instance = pool.free;
+            pool.free = instance->next;
+            free(instance->memory);
+            free(instance);
+        }
+        return 1;
+    }
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+    unlink(socket_path);
+    if (server < 0 || bind(server, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(server, 16) != 0) {
+        perror(socket_path);
+        return 0;
+    }
+    for (;;) { // One thread per client, concurrency is bounded by the pool
+        int client = accept(server, NULL, NULL);
+        if (client < 0) {
+            perror("accept");
+            continue;
+        }
+        Connection *connection = malloc(sizeof(Connection));
+        if (!connection) {
+            perror("Error allocating connection");
+            close(client);
+            continue;
+        }
+        connection->pool = &pool;
+        connection->fd = client;
+        pthread_t thread;
+        int error = pthread_create(&thread, NULL, connection_main, connection);
+        if (error != 0) { // Turn the client away, the server carries on
+            fprintf(stderr, "Error creating connection thread: %s\n", strerror(error));
+            close(client);
+            free(connection);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+}
@@ -0,0 +1,19 @@
+// Server mode: `emulate --serve [--socket <path>] [-j <instances>]` reads one
+// job per line from stdin, or from each client of a Unix socket, and runs it on
+// a pre-allocated instance whose memory is reset by clearing only the pages
+// the previous job dirtied. A job line is a list of key=value fields:
+//
+//   binary=<path>          guest image file, or
+//   image=<hex>[,<hex>...] guest image given inline as 32-bit words
+//   limit=<instructions>   instruction limit (default: none)
+//   timeout=<seconds>      time limit (default: none)
+//   x<n>=<value>           initial value of register Xn
+//
+// Each job is answered with "result <job> <status> <instructions> <bytes>"
+// followed by <bytes> bytes of the usual state dump, or with
+// "error <job> <message>". Jobs are numbered from 0 in input order.
+//
+// -j sets the number of instances. Jobs from stdin run on all of them at once
+// and are answered in the order they finish; the jobs of one socket client run
+// in order, and the clients share the instances.
+int run_server(const char *socket_path, int instances);
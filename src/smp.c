@@ -0,0 +1,85 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "emulate.h"
+#include "smp.h"
+
+typedef struct {
+    CPUState cpu;
+    size_t size;               // Image size in words
+    uint64_t max_instructions;
+    double timeout;
+    RunStatus status;
+} Core;
+
+static void *core_main(void *arg) {
+    Core *core = arg;
+    core->status = emulate_bounded(&core->cpu, core->cpu.memory+MEMORY_OFFSET, core->size, core->max_instructions, core->timeout);
+    return NULL;
+}
+
+int run_smp(const char *binary_file, const char *output_file, int cores, uint64_t max_instructions, double timeout) {
+    if (cores < 1) cores = 1;
+    uint32_t *memory = calloc(MEMORY_SIZE, 1);
+    if (!memory) {
+        perror("Error allocating guest memory");
+        exit(EXIT_FAILURE);
+    }
+    size_t size;
+    if (!load_binary(binary_file, memory, MEMORY_SIZE, &size)) {
+        free(memory);
+        return 0;
+    }
+
+    Core *core = calloc(cores, sizeof(Core));
+    pthread_t *threads = malloc(cores * sizeof(pthread_t));
+    if (!core || !threads) {
+        perror("Error allocating cores");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < cores; i++) {
+        init_cpu(&core[i].cpu, memory, NULL);
+        core[i].cpu.core_id = i;
+        core[i].size = size;
+        core[i].max_instructions = max_instructions;
+        core[i].timeout = timeout;
+    }
+    for (int i = 0; i < cores; i++) {
+        int error = pthread_create(&threads[i], NULL, core_main, &core[i]);
+        if (error != 0) { // The cores already running share memory with the rest
+            fprintf(stderr, "Error creating core %d: %s\n", i, strerror(error));
+            exit(EXIT_FAILURE);
+        }
+    }
+    int ok = 1;
+    for (int i = 0; i < cores; i++) {
+        pthread_join(threads[i], NULL);
+        fprintf(stderr, "core %d: %s (%lu instructions)\n", i, run_status_name(core[i].status), core[i].cpu.instructions);
+        if (core[i].status != RUN_HALT && core[i].status != RUN_END) ok = 0;
+    }
+
+    // Cores are copied out so the dump sees them as one contiguous array
+    CPUState *cpus = malloc(cores * sizeof(CPUState));
+    if (!cpus) {
+        perror("Error allocating cores");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < cores; i++) {
+        cpus[i] = core[i].cpu;
+    }
+    int fd = output_file ? open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644) : fileno(stdout);
+    if (fd < 0 || !write_cores_state(fd, cpus, cores, memory)) {
+        perror(output_file ? output_file : "stdout");
+        ok = 0;
+    }
+    if (output_file && fd >= 0) close(fd);
+
+    free(cpus);
+    free(threads);
+    free(core);
+    free(memory);
+    return ok;
+}
@@ -0,0 +1,30 @@
+#include <stdint.h>
+
+// SMP mode: `emulate <binary> [output file] --smp N` runs N guest cores, each
+// on its own host thread, sharing one guest memory. Every core starts at PC 0
+// with zeroed registers; `mrs xN, mpidr_el1` returns the core number (0..N-1)
+// so the guest can pick its work. The run ends when every core has halted,
+// left the image, faulted or hit its limit.
+//
+// Memory model
+//
+// - Each core executes its own instructions in program order.
+// - Naturally aligned 32-bit and 64-bit loads and stores are single-copy
+//   atomic (relaxed host atomics). Unaligned accesses may tear. Plain loads
+//   and stores give no ordering guarantee between cores: another core may
+//   observe them in any order until a barrier intervenes.
+// - DMB (any option) is a full sequentially consistent fence: every access
+//   before it is visible to other cores before any access after it.
+// - LDXR opens a reservation on one naturally aligned address and remembers
+//   the value read. STXR stores to that address only if the reservation is
+//   still open and memory still holds the remembered value, writing 0 to Ws
+//   on success and 1 on failure; either way the reservation is closed. A
+//   store of the same value by another core in between does not break the
+//   reservation (the compare-and-swap "ABA" relaxation used by most
+//   emulators), which is harmless for locks, counters and queues.
+// - LDAXR/STLXR additionally have acquire/release (sequentially consistent)
+//   semantics, so a lock can be built without a separate DMB.
+// - Instruction fetch reads memory without synchronisation; code must not be
+//   modified while another core may execute it.
+
+int run_smp(const char *binary_file, const char *output_file, int cores, uint64_t max_instructions, double timeout);
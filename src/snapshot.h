@@ -0,0 +1,31 @@
+#include <stdint.h>
+
+// Binary final-state snapshot written by `emulate --state <file>` and compared
+// by statediff. All fields are stored in host byte order.
+//
+//   SnapshotHeader
+//   range_count x { SnapshotRange, range.length bytes of memory }
+//
+// Only runs of non-zero memory words are stored; everything else is zero.
+//
+// pc is the PC printed by the text dump: the address of the last instruction
+// executed (the HALT for a halted run), which is the CPU's next-instruction PC
+// minus 4. Version 1 stored the next-instruction PC.
+
+#define SNAPSHOT_MAGIC "A64S"
+#define SNAPSHOT_VERSION 2
+
+typedef struct {
+    char magic[4];         // SNAPSHOT_MAGIC
+    uint32_t version;      // SNAPSHOT_VERSION
+    uint64_t memory_size;  // Size of guest memory in bytes
+    uint64_t regs[31];     // General purpose registers X0-X30
+    uint64_t pc;           // Program Counter of the last instruction executed
+    uint32_t pstate;       // Processor state (NZCV)
+    uint32_t range_count;  // Number of memory ranges that follow
+} SnapshotHeader;
+
+typedef struct {
+    uint64_t address;      // Byte address of the first word in the range
+    uint64_t length;       // Length of the range in bytes (multiple of 4)
+} SnapshotRange;
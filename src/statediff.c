@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "snapshot.h"
+
+#define PAGE_SIZE 4096
+
+typedef struct {
+    SnapshotHeader header;
+    uint8_t *memory; // Reconstructed guest memory, header.memory_size bytes
+} Snapshot;
+
+int load_snapshot(const char *filename, Snapshot *snapshot) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        perror(filename);
+        return 0;
+    }
+    SnapshotHeader *header = &snapshot->header;
+    if (fread(header, sizeof(*header), 1, file) != 1
+        || memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0
+        || header->version != SNAPSHOT_VERSION) {
+        fprintf(stderr, "%s: not a state snapshot\n", filename);
+        fclose(file);
+        return 0;
+    }
+    snapshot->memory = calloc(header->memory_size, 1);
+    if (!snapshot->memory) {
+        perror("Error allocating memory");
+        fclose(file);
+        return 0;
+    }
+    for (uint32_t i = 0; i < header->range_count; i++) {
+        SnapshotRange range;
+        if (fread(&range, sizeof(range), 1, file) != 1
+            || range.address > header->memory_size
+            || range.length > header->memory_size - range.address
+            || fread(snapshot->memory + range.address, 1, range.length, file) != range.length) {
+            fprintf(stderr, "%s: truncated or corrupt memory range %u\n", filename, i);
+            free(snapshot->memory);
+            fclose(file);
+            return 0;
+        }
+    }
+    fclose(file);
+    return 1;
+}
+
+// Reports each run of differing words inside one page, returns the number of runs
+int diff_page(const uint8_t *a, const uint8_t *b, uint64_t base, uint64_t length) {
+    int runs = 0;
+    uint64_t offset = 0;
+    while (offset < length) {
+        if (memcmp(a + offset, b + offset, 4) == 0) {
+            offset += 4;
+            continue;
+        }
+        uint64_t start = offset;
+        while (offset < length && memcmp(a + offset, b + offset, 4) != 0) offset += 4;
+        printf("Memory 0x%08lx-0x%08lx differs:\n", base + start, base + offset - 4);
+        for (uint64_t i = start; i < offset; i += 4) {
+            uint32_t word_a, word_b;
+            memcpy(&word_a, a + i, 4);
+            memcpy(&word_b, b + i, 4);
+            printf("  0x%08lx: 0x%08x != 0x%08x\n", base + i, word_a, word_b);
+        }
+        runs++;
+    }
+    return runs;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <state file> <state file>\n", argv[0]);
+        return 2;
+    }
+    Snapshot a, b;
+    if (!load_snapshot(argv[1], &a)) return 2;
+    if (!load_snapshot(argv[2], &b)) return 2;
+
+    int differences = 0;
+    for (int i = 0; i < 31; i++) {
+        if (a.header.regs[i] != b.header.regs[i]) {
+            printf("X%02d = %016lx != %016lx\n", i, a.header.regs[i], b.header.regs[i]);
+            differences++;
+        }
+    }
+    if (a.header.pc != b.header.pc) {
+        printf("PC = %016lx != %016lx\n", a.header.pc, b.header.pc);
+        differences++;
+    }
+    if (a.header.pstate != b.header.pstate) {
+        printf("PSTATE = %x != %x\n", a.header.pstate, b.header.pstate);
+        differences++;
+    }
+    if (a.header.memory_size != b.header.memory_size) {
+        printf("Memory size = 0x%lx != 0x%lx\n", a.header.memory_size, b.header.memory_size);
+        differences++;
+    }
+
+    uint64_t memory_size = a.header.memory_size < b.header.memory_size ? a.header.memory_size : b.header.memory_size;
+    for (uint64_t page = 0; page < memory_size; page += PAGE_SIZE) {
+        uint64_t length = memory_size - page < PAGE_SIZE ? memory_size - page : PAGE_SIZE;
+        if (memcmp(a.memory + page, b.memory + page, length) != 0) {
+            differences += diff_page(a.memory + page, b.memory + page, page, length);
+        }
+    }
+
+    free(a.memory);
+    free(b.memory);
+    return differences ? 1 : 0;
+}